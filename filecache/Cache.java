@@ -16,7 +16,9 @@
  */
 
 import java.io.File;
+import java.io.FileInputStream;
 import java.io.FileNotFoundException;
+import java.io.FileOutputStream;
 import java.io.IOException;
 import java.io.RandomAccessFile;
 import java.nio.file.FileSystemException;
@@ -25,11 +27,23 @@ import java.nio.file.Paths;
 import java.nio.file.StandardCopyOption;
 import java.rmi.RemoteException;
 import java.rmi.server.ServerNotActiveException;
+import java.rmi.server.UnicastRemoteObject;
 import java.util.ArrayList;
+import java.util.Arrays;
 import java.util.HashMap;
+import java.util.HashSet;
 import java.util.Iterator;
 import java.util.LinkedHashSet;
+import java.util.Set;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.ScheduledExecutorService;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicLong;
 import java.util.concurrent.locks.ReentrantLock;
+import java.util.zip.GZIPInputStream;
+import java.util.zip.GZIPOutputStream;
 
 /* For Cache returns to Proxy */
 class OpenReturnVal {
@@ -64,10 +78,46 @@ class Version {
   public final String filename_;
   private int ref_count_;
 
+  /* the storage tier currently holding this version, moves on promote/demote */
+  public int tier_;
+
+  /* reader opens since it landed in its current tier */
+  public int hit_count_;
+
+  /* wall clock time in ms of the last LRU hit, decides if it is cold */
+  public long last_hit_ms_;
+
+  /* stored gzip'ed on disk, see Cache.CompressCacheEntry */
+  public boolean compressed_;
+
+  /* compression was tried and did not pay off, never try it again */
+  public boolean incompressible_;
+
+  /* queued for or being gzip'ed by the compressor thread */
+  public boolean compressing_;
+
+  /* size before and after compression, valid only if compressed_ */
+  public long plain_size_;
+  public long zipped_size_;
+
+  /* non-null while a reader is streaming the plain content back to disk */
+  public ColdInflater inflater_;
+
+  /* a writer's copy moved to the spill directory, outside every tier */
+  public boolean spilled_;
+
   public Version(String filename, int version) {
     filename_ = filename;
     version_ = version;
     ref_count_ = 0;
+    tier_ = Cache.TOP_TIER;
+    hit_count_ = 0;
+    last_hit_ms_ = 0;
+    compressed_ = false;
+    incompressible_ = false;
+    compressing_ = false;
+    inflater_ = null;
+    spilled_ = false;
   }
 
   public int GetRefCount() { return ref_count_; }
@@ -123,10 +173,19 @@ class FileRecord {
   public FileReturnVal GetReaderFile() throws Exception {
     int reader_version_id = GetReaderVersionId();
     Version reader_version = GetReaderVersion();
-    String reader_filename = reader_version.ToFileName();
-    String cache_reader_filepath = Cache.FormatPath(reader_filename);
+    if (reader_version.compressed_ && reader_version.inflater_ == null &&
+        !Cache.StartInflate(reader_version)) {
+      // no room to bring back the plain content of a cold version
+      Cache.events_.Record(CacheEventRing.ENOMEM, filename_,
+                           reader_version.plain_size_, CacheEventRing.INFLATE);
+      return new FileReturnVal(null, FileHandling.Errors.ENOMEM);
+    }
+    Cache.PromoteOnHit(reader_version);
+    String cache_reader_filepath = Cache.FormatPath(reader_version);
     RandomAccessFile file_handle =
-        new RandomAccessFile(cache_reader_filepath, Cache.READER_MODE);
+        (reader_version.inflater_ != null)
+            ? new InflatingFile(cache_reader_filepath, reader_version.inflater_)
+            : new RandomAccessFile(cache_reader_filepath, Cache.READER_MODE);
     reader_version.PlusRefCount();
     Cache.HitFileInLRUCache(reader_version);
     return new FileReturnVal(file_handle, reader_version_id);
@@ -140,21 +199,40 @@ class FileRecord {
   public FileReturnVal GetWriterFile() throws Exception {
     int writer_version_id = IncrementLatestVersionId();
     Version writer_version = new Version(filename_, writer_version_id);
-    String writer_filename = writer_version.ToFileName();
-    String cache_writer_filepath = Cache.FormatPath(writer_filename);
+    String cache_writer_filepath = Cache.FormatPath(writer_version);
     if (GetReaderVersionId() >= INITIAL_VERSION) {
       // there is existing version, copy it
-      String reader_filename = GetReaderVersion().ToFileName();
       GetReaderVersion()
           .PlusRefCount(); // temporarily protect this reader file, do not evict
-      String cache_reader_filepath = Cache.FormatPath(reader_filename);
+      String cache_reader_filepath = Cache.FormatPath(GetReaderVersion());
       boolean success = Cache.ReserveCacheSpace(
-          new File(cache_reader_filepath).length(), false);
+          Cache.PlainSize(GetReaderVersion()), false);
       if (!success) {
         GetReaderVersion().MinusRefCount();
+        Cache.events_.Record(CacheEventRing.ENOMEM, filename_,
+                             Cache.PlainSize(GetReaderVersion()),
+                             CacheEventRing.WRITER_COPY);
         return new FileReturnVal(null, FileHandling.Errors.ENOMEM);
       }
-      CopyFile(cache_writer_filepath, cache_reader_filepath);
+      CacheEvents.WriterCopyEvent copy = new CacheEvents.WriterCopyEvent();
+      copy.begin();
+      if (GetReaderVersion().inflater_ != null) {
+        // a reader is streaming it back, finish that and copy the plain file
+        GetReaderVersion().inflater_.InflateUpTo(
+            GetReaderVersion().plain_size_);
+      }
+      if (GetReaderVersion().compressed_) {
+        Cache.InflateFile(cache_writer_filepath,
+                          Cache.ZippedPath(GetReaderVersion()));
+      } else {
+        CopyFile(cache_writer_filepath, cache_reader_filepath);
+      }
+      copy.end();
+      if (copy.shouldCommit()) {
+        copy.path = filename_;
+        copy.bytes = Cache.PlainSize(GetReaderVersion());
+        copy.commit();
+      }
       GetReaderVersion().MinusRefCount();
     }
     Cache.HitFileInLRUCache(writer_version);
@@ -184,60 +262,59 @@ class FileRecord {
   }
 
   /**
-   * Close an exclusive version of this file
-   * and install this to be the newest visible reader version
+   * Close an exclusive version of this file that Server already committed
+   * with 'server_timestamp', and install this to be the newest visible reader
+   * version unless a newer one got installed meanwhile
    */
-  public void CloseWriterFile(int version_id) {
+  public void CloseWriterFile(int version_id, long server_timestamp) {
     Version writer_version = version_map_.get(version_id);
-    Cache.HitFileInLRUCache(writer_version);
-    byte[] data;
-    try {
-      // must be 0 now
-      writer_version.MinusRefCount();
-      RandomAccessFile file = new RandomAccessFile(
-          Cache.FormatPath(writer_version.ToFileName()), Cache.READER_MODE);
-      Integer max_chunk_size = FileChunk.CHUNK_SIZE;
-      Integer file_remain_size = (int)(file.length() - file.getFilePointer());
-      Integer chunk_size = Math.min(max_chunk_size, file_remain_size);
-      Boolean is_end = (file_remain_size <= max_chunk_size);
-      data = new byte[chunk_size];
-      file.read(data);
-      // upload new version to server iteratively chunk-by-chunk and record the
-      // timestamp
-      String origin_filename = writer_version.filename_;
-      Long[] tuple = Cache.remote_manager_.Upload(
-          origin_filename, new FileChunk(data, is_end, NON_EXIST_VERSION));
-      Long server_timestamp = tuple[TIMESTAMP_INDEX];
-      Integer chunk_id = tuple[CHUNK_INDEX].intValue();
-      while (!is_end) {
-        file_remain_size = (int)(file.length() - file.getFilePointer());
-        chunk_size = Math.min(max_chunk_size, file_remain_size);
-        is_end = (file_remain_size <= max_chunk_size);
-        data = new byte[chunk_size];
-        file.read(data);
-        Cache.remote_manager_.UploadChunk(
-            new FileChunk(data, is_end, chunk_id));
+    if (!writer_version.spilled_) {
+      // a spilled copy joins the LRU only once Unspill moves it back
+      Cache.HitFileInLRUCache(writer_version);
+    }
+    // must be 0 now
+    writer_version.MinusRefCount();
+    String origin_filename = writer_version.filename_;
+    if (server_timestamp < Cache.GetTimestamp(origin_filename)) {
+      // another writer of this file uploaded concurrently and committed later
+      version_map_.remove(version_id);
+      Cache.EvictCacheEntry(writer_version);
+      return;
+    }
+    // a spilled copy is only kept if the cache has room for it by now
+    boolean cached = !writer_version.spilled_ || Cache.Unspill(writer_version);
+    // install to be available new reader version
+    int install_version_id = writer_version.version_;
+    if (GetReaderVersionId() >= INITIAL_VERSION) {
+      // there is existing reader version to be overwritten
+      Version reader_version = GetReaderVersion();
+      if (reader_version.GetRefCount() == NON_REFERENCE) {
+        // there will be no one able to point to this reader version anymore
+        Cache.EvictCacheEntry(reader_version);
+        version_map_.remove(reader_version.version_);
       }
-      file.close();
-      // install to be available new reader version
-      int install_version_id = writer_version.version_;
-      if (GetReaderVersionId() >= INITIAL_VERSION) {
-        // there is existing reader version to be overwritten
-        Version reader_version = GetReaderVersion();
-        if (reader_version.GetRefCount() == NON_REFERENCE) {
-          // there will be no one able to point to this reader version anymore
-          Cache.EvictCacheEntry(reader_version);
-          version_map_.remove(reader_version.version_);
-        }
-      }
-      SetReaderVersionId(install_version_id);
-      // should not remove this versilename, server_timestamp);on from map,
-      // future reader need it
-      Cache.UpdateTimestamp(origin_filename, server_timestamp);
-
-    } catch (Exception e) {
-      e.printStackTrace();
     }
+    if (!cached) {
+      // Server has the new version, the next open downloads it
+      version_map_.remove(version_id);
+      Cache.EvictCacheEntry(writer_version);
+      SetReaderVersionId(NON_EXIST_VERSION);
+      Cache.ForgetTimestamp(origin_filename);
+      return;
+    }
+    SetReaderVersionId(install_version_id);
+    Cache.events_.Record(CacheEventRing.INSTALL, origin_filename,
+                         Cache.PlainSize(writer_version));
+    // should not remove this version from map, future reader need it
+    Cache.UpdateTimestamp(origin_filename, server_timestamp);
+  }
+
+  /* the new version never made it to server, no one shall see it */
+  public void DropWriterFile(int version_id) {
+    Version writer_version = version_map_.get(version_id);
+    writer_version.MinusRefCount();
+    version_map_.remove(version_id);
+    Cache.EvictCacheEntry(writer_version);
   }
 
   public int IncrementLatestVersionId() { return ++latest_version_; }
@@ -264,6 +341,332 @@ class FileRecord {
   }
 }
 
+/**
+ * The Proxy's knowledge about one directory subtree on Server
+ * a file is trusted without any RPC if it was confirmed fresh at the
+ * subtree's current epoch and that epoch was validated recently enough
+ */
+class SubtreeRecord {
+  public static long UNKNOWN_EPOCH = -1;
+
+  /* the subtree epoch last returned by Server */
+  public long epoch_;
+
+  /* wall clock time in ms when epoch_ was last validated */
+  public long validated_at_;
+
+  /* cached file path -> the subtree epoch it was last confirmed fresh at */
+  private final HashMap<String, Long> file_epoch_map_;
+
+  public SubtreeRecord() {
+    epoch_ = UNKNOWN_EPOCH;
+    validated_at_ = 0;
+    file_epoch_map_ = new HashMap<>();
+  }
+
+  public boolean IfTrusted(String path) {
+    return epoch_ >= 0 && file_epoch_map_.getOrDefault(path, UNKNOWN_EPOCH) ==
+                              epoch_;
+  }
+
+  /* 'epoch' must be read before the per-file validation is sent to Server */
+  public void ConfirmFile(String path, long epoch) {
+    if (epoch >= 0) {
+      file_epoch_map_.put(path, epoch);
+    }
+  }
+
+  public void ForgetFile(String path) { file_epoch_map_.remove(path); }
+
+  /**
+   * Move to the epoch Server just returned for a validation since 'since'
+   * files confirmed at 'since' and not changed meanwhile stay trusted
+   */
+  public void Advance(long since, SubtreeResult result) {
+    if (result.epoch < 0) {
+      // Server does not know this directory anymore
+      epoch_ = UNKNOWN_EPOCH;
+      file_epoch_map_.clear();
+      return;
+    }
+    if (since != epoch_) {
+      // a concurrent validation already moved this record
+      return;
+    }
+    if (since >= 0 && result.epoch != since) {
+      HashSet<String> changed = new HashSet<>(result.changed);
+      for (String path : file_epoch_map_.keySet()) {
+        if (file_epoch_map_.get(path) == since && !changed.contains(path)) {
+          file_epoch_map_.put(path, result.epoch);
+        }
+      }
+    }
+    epoch_ = result.epoch;
+    validated_at_ = System.currentTimeMillis();
+  }
+}
+
+/**
+ * Streams the plain content of a compressed version back to disk on demand
+ * so that a reader only waits for the bytes it asks for, not the whole file.
+ * Shared by all readers of the version, the first one to read drives it
+ */
+class ColdInflater {
+  private static final int INFLATE_CHUNK = 64 * 1024;
+
+  private final Version version_;
+  private final GZIPInputStream in_;
+  private final RandomAccessFile out_;
+  private long inflated_;
+
+  public ColdInflater(Version version) throws IOException {
+    version_ = version;
+    in_ = new GZIPInputStream(new FileInputStream(Cache.ZippedPath(version)),
+                              INFLATE_CHUNK);
+    out_ = new RandomAccessFile(Cache.FormatPath(version), Cache.WRITER_MODE);
+    out_.setLength(0);
+    inflated_ = 0;
+  }
+
+  public long PlainSize() { return version_.plain_size_; }
+
+  /* make sure the plain file holds at least the first 'pos' bytes */
+  public void InflateUpTo(long pos) throws IOException {
+    if (Inflate(pos)) {
+      // outside this monitor, a thread holding the cache lock may wait on it
+      Cache.FinishInflate(version_, this);
+    }
+  }
+
+  /* inflate up to 'pos', return True once the whole file is back */
+  private synchronized boolean Inflate(long pos) throws IOException {
+    if (version_.inflater_ != this) {
+      return false; // already finished or aborted
+    }
+    byte[] buf = new byte[INFLATE_CHUNK];
+    long target = Math.min(pos, version_.plain_size_);
+    while (inflated_ < target) {
+      int reads = in_.read(buf);
+      if (reads < 0) {
+        break;
+      }
+      out_.write(buf, 0, reads);
+      inflated_ += reads;
+    }
+    if (inflated_ < version_.plain_size_) {
+      return false;
+    }
+    Close();
+    return true;
+  }
+
+  /* stop streaming, e.g. the version is evicted before fully inflated */
+  public synchronized void Close() throws IOException {
+    in_.close();
+    out_.close();
+  }
+}
+
+/**
+ * Reader handle of a version whose plain content is still being inflated
+ * every read first drives the inflater up to the requested range
+ */
+class InflatingFile extends RandomAccessFile {
+  private final ColdInflater inflater_;
+
+  public InflatingFile(String path, ColdInflater inflater)
+      throws FileNotFoundException {
+    super(path, Cache.READER_MODE);
+    inflater_ = inflater;
+  }
+
+  @Override
+  public int read() throws IOException {
+    inflater_.InflateUpTo(getFilePointer() + 1);
+    return super.read();
+  }
+
+  @Override
+  public int read(byte[] b) throws IOException {
+    return read(b, 0, b.length);
+  }
+
+  @Override
+  public int read(byte[] b, int off, int len) throws IOException {
+    inflater_.InflateUpTo(getFilePointer() + len);
+    return super.read(b, off, len);
+  }
+
+  /* the plain size is known upfront, lseek from the end must not wait */
+  @Override
+  public long length() throws IOException {
+    return inflater_.PlainSize();
+  }
+}
+
+/**
+ * One storage tier of the Proxy cache, e.g. RAM disk, NVMe or HDD
+ * with its own directory and capacity
+ */
+class CacheTier {
+  public String dir_;
+  public long capacity_;
+  public long occupancy_;
+
+  public CacheTier(String dir, long capacity) {
+    dir_ = dir;
+    capacity_ = capacity;
+    occupancy_ = 0;
+  }
+
+  public long Remain() { return capacity_ - occupancy_; }
+}
+
+/**
+ * Streams the full chunks of a writer's private copy to a Server staging
+ * file while the writer session is still open, so that close only sends the
+ * tail and the commit. The staged data stays invisible until that commit
+ *
+ * Only appends are streamed: once the writer changes bytes that were already
+ * picked up, the stream breaks and close uploads the whole file as usual
+ */
+class WriterStream {
+  private final String path_;
+  private RandomAccessFile file_; // read-only view of the writer's copy
+  private int chunk_id_ = FileChunk.NO_SESSION;
+  private long claimed_ = 0; // [0, claimed_) is read, must not change anymore
+  private long acked_ = 0; // [0, acked_) is staged on Server
+  private boolean sending_ = false;
+  private boolean broken_ = false;
+  private boolean finished_ = false;
+
+  public WriterStream(String path, String cache_path) throws IOException {
+    path_ = path;
+    file_ = new RandomAccessFile(cache_path, Cache.READER_MODE);
+  }
+
+  /* the writer's copy moved to 'cache_path' with the same content */
+  public synchronized void Reopen(String cache_path) throws IOException {
+    file_.close();
+    file_ = new RandomAccessFile(cache_path, Cache.READER_MODE);
+  }
+
+  /* the writer's write, serialized against picking up a chunk */
+  public synchronized void Write(RandomAccessFile handle, byte[] buf)
+      throws IOException {
+    if (handle.getFilePointer() < claimed_) {
+      // rewriting what may already be staged
+      broken_ = true;
+    }
+    handle.write(buf);
+  }
+
+  /* send every full chunk written since the last step, in the background */
+  public void Step(FileManagerRemote remote_manager) {
+    while (true) {
+      FileChunk chunk;
+      synchronized (this) {
+        try {
+          if (broken_ || finished_ ||
+              file_.length() - claimed_ <= FileChunk.CHUNK_SIZE) {
+            // the last (partial) chunk is always left to close
+            return;
+          }
+          chunk = Cache.ReadChunk(file_, chunk_id_, claimed_);
+        } catch (IOException e) {
+          e.printStackTrace();
+          broken_ = true;
+          return;
+        }
+        claimed_ += chunk.data.length;
+        sending_ = true;
+      }
+      boolean success = true;
+      int chunk_id = chunk_id_;
+      try {
+        if (chunk_id == FileChunk.NO_SESSION) {
+          Long[] tuple = remote_manager.Upload(path_, chunk);
+          chunk_id = tuple[FileRecord.CHUNK_INDEX].intValue();
+        } else {
+          remote_manager.UploadChunk(chunk);
+        }
+      } catch (IOException e) {
+        e.printStackTrace();
+        success = false;
+      }
+      synchronized (this) {
+        sending_ = false;
+        chunk_id_ = chunk_id;
+        if (success) {
+          acked_ = claimed_;
+        } else {
+          broken_ = true;
+        }
+        notifyAll();
+      }
+    }
+  }
+
+  /**
+   * Stop streaming, waiting for a chunk in flight
+   * return True if close can resume the upload from Acked() in session
+   * SessionId(), otherwise any staged data is dropped on Server
+   */
+  public synchronized boolean Finish(FileManagerRemote remote_manager)
+      throws InterruptedException {
+    finished_ = true;
+    while (sending_) {
+      wait();
+    }
+    try {
+      file_.close();
+    } catch (IOException e) {
+      e.printStackTrace();
+    }
+    if (!broken_) {
+      return chunk_id_ != FileChunk.NO_SESSION;
+    }
+    if (chunk_id_ != FileChunk.NO_SESSION) {
+      try {
+        remote_manager.CancelChunk(chunk_id_);
+      } catch (RemoteException e) {
+        e.printStackTrace();
+      }
+    }
+    return false;
+  }
+
+  public synchronized int SessionId() { return chunk_id_; }
+
+  public synchronized long Acked() { return acked_; }
+}
+
+/**
+ * Receives the new versions Server pushes for subscribed paths and installs
+ * them in the background, so that Server's push thread never waits on the
+ * download of the rest of a large file
+ */
+class PushReceiver extends UnicastRemoteObject implements PushReceiverRemote {
+  private final Cache cache_;
+  private final ExecutorService installer_ =
+      Executors.newSingleThreadExecutor(runnable -> {
+        Thread thread = new Thread(runnable, "push-install");
+        thread.setDaemon(true);
+        return thread;
+      });
+
+  public PushReceiver(Cache cache) throws RemoteException {
+    super(0);
+    cache_ = cache;
+  }
+
+  @Override
+  public void Push(String path, long timestamp, FileChunk chunk)
+      throws RemoteException {
+    installer_.execute(() -> cache_.InstallPushed(path, timestamp, chunk));
+  }
+}
+
 public class Cache {
   /* file descriptor offset */
   private static final int INIT_FD = 1024;
@@ -273,6 +676,20 @@ public class Cache {
   public static final String WRITER_MODE = "rw";
   private static final String Slash = "/";
   public static FileManagerRemote remote_manager_; // to communicate with Server
+  /* hedges idempotent requests to Server replicas, if any are configured */
+  private static HedgedRemote hedged_remote_;
+  private static final String VALIDATE_OP = "Validate";
+  /* groups small uploads into one RPC, null if every close uploads alone */
+  private static UploadBatcher upload_batcher_ = null;
+  /* open writer sessions streaming to Server, by fd, see WriterStream */
+  private static final ConcurrentHashMap<Integer, WriterStream> streams_ =
+      new ConcurrentHashMap<>();
+  private static ScheduledExecutorService streamer_ = null;
+  /* unlinks still to be sent to Server, null if unlink is synchronous */
+  private static DeleteQueue delete_queue_ = null;
+
+  /* exported to Server if the proxy subscribed to pushes, see PushFanout */
+  private PushReceiver push_receiver_ = null;
   private static final HashMap<String, Long> timestamp_map_ = new HashMap<>();
   private int cache_fd_;
   private static final HashMap<String, FileRecord> record_map_ =
@@ -284,15 +701,63 @@ public class Cache {
 
   private final HashMap<Integer, FileHandling.OpenOption> fd_option_map_;
 
+  /* writer fds whose copy is in the spill directory, see GrowWriter */
+  private final Set<Integer> spilled_fds_ = ConcurrentHashMap.newKeySet();
+
   /* the lru freshness ordering of all versions of cached file in this local
    * Cache Proxy */
   public final static LinkedHashSet<Version> lru_ = new LinkedHashSet<>();
 
-  private static Long cache_occupancy_ = 0L;
+  /* storage tiers from fastest to slowest, new versions land on the top
+   * tier and LRU entries are demoted one tier down instead of being evicted
+   * until they fall off the last tier */
+  private static final ArrayList<CacheTier> tiers_ = new ArrayList<>();
+
+  public static final int TOP_TIER = 0;
+
+  static {
+    // the top tier is configured by SetCacheDirectory/SetCacheCapacity
+    tiers_.add(new CacheTier(null, 0));
+  }
+
+  /* reader opens in a lower tier before a version is promoted one tier up */
+  private static final int PROMOTE_HITS = 2;
+
+  /* versions not hit for this long are compressed before anything is
+   * demoted or evicted, negative disables cold compression */
+  private static long compress_age_ms_ = -1;
 
-  private static Long cache_capacity_ = 0L;
+  /* gzips cold versions without holding mtx_, see CompressColdEntry */
+  private static final ExecutorService compressor_ =
+      Executors.newSingleThreadExecutor(runnable -> {
+        Thread thread = new Thread(runnable, "cold-compress");
+        thread.setDaemon(true);
+        return thread;
+      });
 
-  private final ReentrantLock mtx_;
+  /* temp files of versions being compressed, next to their plain file */
+  private static final String ZIP_TEMP_PREFIX = ".zip";
+
+  /* compression must save at least this percentage to be kept */
+  private static final int MIN_COMPRESS_SAVING = 10;
+
+  private static final int PERCENT = 100;
+
+  private static final int EVENT_RING_SIZE = 1 << 16;
+
+  /* where writer sessions continue once the cache is full, null if they get
+   * ENOMEM instead, and how much the spilled copies may take there */
+  private static String spill_dir_ = null;
+  private static long spill_capacity_ = 0;
+  private static final AtomicLong spill_occupancy_ = new AtomicLong();
+
+  public static final String ZIP_SUFFIX = ".gz";
+
+  /* temp files of pushed versions still downloading, in the top tier */
+  private static final String PUSH_PREFIX = ".push";
+
+  /* guards the cache state shared by every session, static like it */
+  private static final ReentrantLock mtx_ = new ReentrantLock();
 
   private static final int ZERO = 0;
 
@@ -300,8 +765,26 @@ public class Cache {
 
   private static final int FAILURE = -1;
 
+  /* see PredictUnlink, no error code */
+  private static final int UNLINK_UNKNOWN = 1;
+
   private final static ReentrantLock cache_mtx_ = new ReentrantLock();
-  private static String cache_dir_;
+
+  /* recent hit/miss/evict decisions, see CacheEventRing */
+  public static final CacheEventRing events_ =
+      new CacheEventRing(EVENT_RING_SIZE);
+
+  /* subtree root path -> what the Proxy knows about that subtree's epoch */
+  private static final HashMap<String, SubtreeRecord> subtree_map_ =
+      new HashMap<>();
+
+  private static final ReentrantLock subtree_mtx_ = new ReentrantLock();
+
+  /* how long a validated subtree vouches for its files, 0 disables it */
+  private static long subtree_window_ms_ = 0;
+
+  /* number of leading path components that form a subtree root */
+  private static int subtree_depth_ = 1;
 
   public Cache() {
     cache_fd_ = INIT_FD;
@@ -309,125 +792,761 @@ public class Cache {
     fd_filename_map_ = new HashMap<>();
     fd_version_map_ = new HashMap<>();
     fd_option_map_ = new HashMap<>();
-    mtx_ = new ReentrantLock();
   }
 
-  public static void UpdateTimestamp(String path, Long timestamp) {
-    timestamp_map_.put(path, timestamp);
+  public static void UpdateTimestamp(String path, Long timestamp) {
+    timestamp_map_.put(path, timestamp);
+  }
+
+  /* no version of 'path' is cached anymore */
+  public static void ForgetTimestamp(String path) {
+    timestamp_map_.remove(path);
+  }
+
+  public static long GetTimestamp(String path) {
+    return timestamp_map_.getOrDefault(path, CACHE_NO_EXIST);
+  }
+
+  public void SetCacheCapacity(Long capacity) {
+    tiers_.get(TOP_TIER).capacity_ = capacity;
+  }
+
+  /* let writers that outgrow the full cache continue in 'spill_dir', whose
+     spilled copies may take up to 'capacity' bytes together */
+  public void SetSpillDirectory(String spill_dir, long capacity) {
+    spill_dir_ = spill_dir;
+    spill_capacity_ = capacity;
+  }
+
+  /* compress versions colder than 'age_ms' under space pressure */
+  public void SetColdCompression(long age_ms) { compress_age_ms_ = age_ms; }
+
+  /* add a slower storage tier below all existing ones */
+  public void AddCacheTier(String cache_dir, Long capacity) {
+    tiers_.add(new CacheTier(cache_dir, capacity));
+  }
+
+  /* enable whole-subtree validation for read opens, see ValidateBySubtree */
+  public void SetSubtreeValidation(long window_ms, int depth) {
+    subtree_window_ms_ = window_ms;
+    subtree_depth_ = depth;
+  }
+
+  /* serve the event ring on a loopback port, return the port bound */
+  public int ServeEvents(int port) throws IOException {
+    return events_.Serve(port);
+  }
+
+  public long GetCacheOccupancy() {
+    long occupancy = ZERO;
+    for (CacheTier tier : tiers_) {
+      occupancy += tier.occupancy_;
+    }
+    return occupancy;
+  }
+
+  /*
+     register/update a whole filepath into the LRU cache
+     size update should be done separately
+   */
+  public static void HitFileInLRUCache(Version file_version) {
+    // try remove first to update its freshness position
+    RemoveFileFromLRUCache(file_version);
+    file_version.last_hit_ms_ = System.currentTimeMillis();
+    lru_.add(file_version);
+  }
+
+  public static void RemoveFileFromLRUCache(Version file_version) {
+    lru_.remove(file_version);
+  }
+
+  public static void IncreaseCacheOccupancy(int tier, Long size) {
+    tiers_.get(tier).occupancy_ += size;
+  }
+
+  public static void DecreaseCacheOccupancy(int tier, Long size) {
+    tiers_.get(tier).occupancy_ -= size;
+  }
+
+  /* Reserve a certain space from cache
+     Upon success, 'size' space will be reserved for the caller to use and
+     return True If no space is available, it will try evict a few other entries
+     if possible
+
+     However, if all entries are in use, or not space available possible
+     (resever ~100GB file) It returns False
+   */
+  public static boolean ReserveCacheSpace(Long size, boolean should_lock) {
+    if (should_lock) {
+      CacheEvents.Lock(cache_mtx_, "cache_mtx_", null);
+    }
+    try {
+      return ReserveTierSpace(TOP_TIER, size);
+    } finally {
+      if (should_lock) {
+        cache_mtx_.unlock();
+      }
+    }
+  }
+
+  /* Reserve space in one specific tier, making room by demoting or evicting
+     its LRU entries. Return False if nothing more can leave this tier
+   */
+  private static boolean ReserveTierSpace(int tier, long size) {
+    CacheTier cache_tier = tiers_.get(tier);
+    while (cache_tier.Remain() < size) {
+      if (!EvictOneCacheEntry(tier)) {
+        return false;
+      }
+    }
+    IncreaseCacheOccupancy(tier, size);
+    return true;
+  }
+
+  /* Reserve space for spilled writer copies, False if the spill directory
+     is full too */
+  private static boolean ReserveSpillSpace(long size) {
+    while (true) {
+      long used = spill_occupancy_.get();
+      if (used + size > spill_capacity_) {
+        return false;
+      }
+      if (spill_occupancy_.compareAndSet(used, used + size)) {
+        return true;
+      }
+    }
+  }
+
+  /**
+   * Make room for writer 'fd' to grow by 'size' bytes, spilling its copy out
+   * of the cache if the cache cannot make room and a spill directory is set
+   * return the handle to keep writing through, a new one right after a
+   * spill, or null if there is no room anywhere
+   */
+  public RandomAccessFile GrowWriter(int fd, RandomAccessFile handle,
+                                     long size) throws IOException {
+    if (!spilled_fds_.contains(fd)) {
+      if (ReserveCacheSpace(size, false)) {
+        return handle;
+      }
+      if (spill_dir_ == null) {
+        return null;
+      }
+      handle = SpillWriter(fd, handle);
+      if (handle == null) {
+        return null;
+      }
+    }
+    return ReserveSpillSpace(size) ? handle : null;
+  }
+
+  /* move the copy of writer 'fd' into the spill directory and release its
+     cache space, return the handle on the moved copy, null if it is full.
+     A rename keeps 'handle' valid, across filesystems the copy is made
+     without mtx_ since only this writer changes it */
+  private RandomAccessFile SpillWriter(int fd, RandomAccessFile handle)
+      throws IOException {
+    String path;
+    Version writer_version;
+    CacheEvents.Lock(mtx_, "mtx_", null);
+    try {
+      path = fd_filename_map_.get(fd);
+      writer_version =
+          record_map_.get(path).version_map_.get(fd_version_map_.get(fd));
+    } finally {
+      mtx_.unlock();
+    }
+    // referenced by this writer, so no other thread moves or evicts it
+    String cache_path = FormatPath(writer_version);
+    String spill_path = FormatPath(spill_dir_, writer_version.ToFileName());
+    long size = handle.length();
+    if (!ReserveSpillSpace(size)) {
+      return null;
+    }
+    new File(spill_path).getParentFile().mkdirs();
+    boolean renamed = true;
+    CacheEvents.Lock(mtx_, "mtx_", null);
+    try {
+      Files.move(Paths.get(cache_path), Paths.get(spill_path),
+                 StandardCopyOption.ATOMIC_MOVE);
+      SwapInSpilled(fd, writer_version, handle, size);
+    } catch (IOException e) {
+      // e.g. another filesystem, copied below
+      renamed = false;
+    } finally {
+      mtx_.unlock();
+    }
+    if (renamed) {
+      events_.Record(CacheEventRing.SPILL, path, size);
+      return handle;
+    }
+    RandomAccessFile spilled = CopyToSpill(cache_path, spill_path, handle);
+    if (spilled == null) {
+      spill_occupancy_.addAndGet(-size);
+      return null;
+    }
+    CacheEvents.Lock(mtx_, "mtx_", null);
+    try {
+      SwapInSpilled(fd, writer_version, spilled, DeleteFile(cache_path));
+    } finally {
+      mtx_.unlock();
+    }
+    handle.close();
+    WriterStream stream = streams_.get(fd);
+    if (stream != null) {
+      stream.Reopen(spill_path);
+    }
+    events_.Record(CacheEventRing.SPILL, path, size);
+    return spilled;
+  }
+
+  /* writer 'fd' continues on its spilled copy through 'handle', 'freed'
+     bytes of its tier are released. Call under mtx_ */
+  private void SwapInSpilled(int fd, Version writer_version,
+                             RandomAccessFile handle, long freed) {
+    writer_version.spilled_ = true;
+    lru_.remove(writer_version);
+    DecreaseCacheOccupancy(writer_version.tier_, freed);
+    fd_handle_map_.put(fd, handle);
+    spilled_fds_.add(fd);
+  }
+
+  /* copy a writer's copy to 'spill_path', return a handle on it positioned
+     like 'handle', null if that failed */
+  private static RandomAccessFile CopyToSpill(String cache_path,
+                                              String spill_path,
+                                              RandomAccessFile handle) {
+    try {
+      Files.copy(Paths.get(cache_path), Paths.get(spill_path),
+                 StandardCopyOption.REPLACE_EXISTING);
+      RandomAccessFile spilled = new RandomAccessFile(spill_path, WRITER_MODE);
+      spilled.seek(handle.getFilePointer());
+      return spilled;
+    } catch (IOException e) {
+      e.printStackTrace();
+      DeleteFile(spill_path);
+      return null;
+    }
+  }
+
+  /* bring a closed spilled copy back into the cache if it has room now
+     return False if it stays spilled */
+  public static boolean Unspill(Version file_version) {
+    String spill_path = FormatPath(file_version);
+    long size = new File(spill_path).length();
+    if (!ReserveCacheSpace(size, false)) {
+      return false;
+    }
+    file_version.spilled_ = false;
+    file_version.tier_ = TOP_TIER;
+    String cache_path = FormatPath(file_version);
+    try {
+      new File(cache_path).getParentFile().mkdirs();
+      Files.move(Paths.get(spill_path), Paths.get(cache_path),
+                 StandardCopyOption.REPLACE_EXISTING);
+    } catch (IOException e) {
+      e.printStackTrace();
+      DecreaseCacheOccupancy(file_version.tier_, size);
+      file_version.spilled_ = true;
+      return false;
+    }
+    spill_occupancy_.addAndGet(-size);
+    HitFileInLRUCache(file_version);
+    return true;
+  }
+
+  /* Move an unreferenced version's file into another tier
+     return False if the target tier cannot make room for it
+   */
+  private static boolean MoveCacheEntry(Version file_version, int target) {
+    if (file_version.inflater_ != null) {
+      // half inflated, not worth moving around
+      return false;
+    }
+    String suffix = file_version.compressed_ ? ZIP_SUFFIX : "";
+    String src_path = FormatPath(file_version) + suffix;
+    long size = new File(src_path).length();
+    if (!ReserveTierSpace(target, size)) {
+      return false;
+    }
+    String dest_path =
+        FormatPath(tiers_.get(target).dir_, file_version.ToFileName()) + suffix;
+    try {
+      new File(dest_path).getParentFile().mkdirs();
+      Files.move(Paths.get(src_path), Paths.get(dest_path),
+                 StandardCopyOption.REPLACE_EXISTING);
+    } catch (IOException e) {
+      e.printStackTrace();
+      DecreaseCacheOccupancy(target, size);
+      return false;
+    }
+    DecreaseCacheOccupancy(file_version.tier_, size);
+    if (target > file_version.tier_) {
+      Evicted(file_version, size, CacheEvents.DEMOTE);
+    }
+    file_version.tier_ = target;
+    file_version.hit_count_ = ZERO;
+    return true;
+  }
+
+  /* A reader open of a version that sits in a lower tier
+     promote it one tier up once it is hit repeatedly
+   */
+  public static void PromoteOnHit(Version file_version) {
+    file_version.hit_count_++;
+    if (file_version.tier_ == TOP_TIER ||
+        file_version.hit_count_ < PROMOTE_HITS ||
+        file_version.GetRefCount() > FileRecord.NON_REFERENCE) {
+      return;
+    }
+    // protect it from being evicted while the upper tier makes room
+    file_version.PlusRefCount();
+    MoveCacheEntry(file_version, file_version.tier_ - 1);
+    file_version.MinusRefCount();
+  }
+
+  /* the size of a version's content once it is not compressed */
+  public static long PlainSize(Version file_version) {
+    if (file_version.compressed_) {
+      return file_version.plain_size_;
+    }
+    return new File(FormatPath(file_version)).length();
+  }
+
+  /* where the compressed content of a version is stored */
+  public static String ZippedPath(Version file_version) {
+    return FormatPath(file_version) + ZIP_SUFFIX;
+  }
+
+  /* Compress a cold version in place on the compressor thread. The gzip
+     runs without mtx_ into a temp file that is swapped in under mtx_, only
+     if the version is still cached, unreferenced and in 'tier'
+   */
+  private static void CompressCacheEntry(Version file_version, int tier,
+                                         String plain_path) {
+    String zipped_temp = null;
+    try {
+      zipped_temp = Files.createTempFile(Paths.get(plain_path).getParent(),
+                                         ZIP_TEMP_PREFIX, null).toString();
+      try (FileInputStream in = new FileInputStream(plain_path);
+           GZIPOutputStream out =
+               new GZIPOutputStream(new FileOutputStream(zipped_temp))) {
+        byte[] buf = new byte[FileChunk.CHUNK_SIZE];
+        int reads;
+        while ((reads = in.read(buf)) > 0) {
+          out.write(buf, 0, reads);
+        }
+      }
+      CacheEvents.Lock(mtx_, "mtx_", null);
+      try {
+        SwapInCompressed(file_version, tier, plain_path, zipped_temp);
+      } finally {
+        mtx_.unlock();
+      }
+    } catch (IOException e) {
+      e.printStackTrace();
+      CacheEvents.Lock(mtx_, "mtx_", null);
+      try {
+        file_version.compressing_ = false;
+        file_version.incompressible_ = true;
+      } finally {
+        mtx_.unlock();
+      }
+    } finally {
+      if (zipped_temp != null) {
+        DeleteFile(zipped_temp);
+      }
+    }
+  }
+
+  /* replace the plain file of a version by its gzip'ed copy 'zipped_temp'
+     if that is still valid and saves enough. Call under mtx_ */
+  private static void SwapInCompressed(Version file_version, int tier,
+                                       String plain_path, String zipped_temp)
+      throws IOException {
+    file_version.compressing_ = false;
+    if (!lru_.contains(file_version) || file_version.tier_ != tier ||
+        file_version.compressed_ ||
+        file_version.GetRefCount() > FileRecord.NON_REFERENCE) {
+      // evicted, moved or opened meanwhile
+      return;
+    }
+    long plain_size = new File(plain_path).length();
+    long zipped_size = new File(zipped_temp).length();
+    if (zipped_size * PERCENT > plain_size * (PERCENT - MIN_COMPRESS_SAVING)) {
+      file_version.incompressible_ = true;
+      return;
+    }
+    Files.move(Paths.get(zipped_temp), Paths.get(ZippedPath(file_version)),
+               StandardCopyOption.ATOMIC_MOVE);
+    DeleteFile(plain_path);
+    file_version.compressed_ = true;
+    file_version.plain_size_ = plain_size;
+    file_version.zipped_size_ = zipped_size;
+    DecreaseCacheOccupancy(tier, plain_size - zipped_size);
+    Evicted(file_version, plain_size - zipped_size, CacheEvents.COMPRESS);
+  }
+
+  /* A reader opens a compressed version, reserve room for its plain content
+     and let the reader stream it back chunk by chunk
+   */
+  public static boolean StartInflate(Version file_version) throws IOException {
+    // protect it from being evicted while its tier makes room
+    file_version.PlusRefCount();
+    boolean success =
+        ReserveTierSpace(file_version.tier_, file_version.plain_size_);
+    file_version.MinusRefCount();
+    if (success) {
+      file_version.inflater_ = new ColdInflater(file_version);
+    }
+    return success;
+  }
+
+  /* The plain content 'inflater' streamed back is complete, drop the
+     compressed copy */
+  public static void FinishInflate(Version file_version,
+                                   ColdInflater inflater) {
+    CacheEvents.Lock(mtx_, "mtx_", null);
+    try {
+      if (file_version.inflater_ != inflater) {
+        // released meanwhile, ReleaseCacheEntry freed the space already
+        return;
+      }
+      DecreaseCacheOccupancy(file_version.tier_,
+                             DeleteFile(ZippedPath(file_version)));
+      file_version.compressed_ = false;
+      file_version.inflater_ = null;
+    } finally {
+      mtx_.unlock();
+    }
+  }
+
+  /* decompress a whole compressed file into dest_name */
+  public static void InflateFile(String dest_name, String zipped_name)
+      throws IOException {
+    try (GZIPInputStream in =
+             new GZIPInputStream(new FileInputStream(zipped_name))) {
+      Files.copy(in, Paths.get(dest_name), StandardCopyOption.REPLACE_EXISTING);
+    }
+  }
+
+  /* Delete every on-disk file of a version, return the space it accounted */
+  private static long ReleaseCacheEntry(Version file_version) {
+    if (!file_version.compressed_) {
+      return DeleteFile(FormatPath(file_version));
+    }
+    long freed_space = DeleteFile(ZippedPath(file_version));
+    if (file_version.inflater_ != null) {
+      // the whole plain size was reserved when inflating started, unhook it
+      // first so that a reader waiting on it does not read it once closed
+      ColdInflater inflater = file_version.inflater_;
+      file_version.inflater_ = null;
+      try {
+        inflater.Close();
+      } catch (IOException e) {
+        e.printStackTrace();
+      }
+      DeleteFile(FormatPath(file_version));
+      freed_space += file_version.plain_size_;
+    }
+    return freed_space;
+  }
+
+  /* a version left its tier for 'reason', freeing 'size' there */
+  private static void Evicted(Version file_version, long size, String reason) {
+    CacheEvents.Evicted(file_version, size, reason);
+    events_.Record(CacheEventRing.EVICT, file_version.filename_, size, reason);
+  }
+
+  /* Remove a specific file version from both disk and cache entry
+     typically happens when pruning so that no client will ever see a stale
+     cached version of a file
+   */
+  public static void EvictCacheEntry(Version file_version) {
+    lru_.remove(file_version);
+    long freed_space = ReleaseCacheEntry(file_version);
+    if (file_version.spilled_) {
+      spill_occupancy_.addAndGet(-freed_space);
+    } else {
+      DecreaseCacheOccupancy(file_version.tier_, freed_space);
+      Evicted(file_version, freed_space, CacheEvents.PRUNE);
+    }
+    FileRecord record = record_map_.get(file_version.filename_);
+    if (record.GetReaderVersionId() == file_version.version_) {
+      // the reader version is masked off
+      record_map_.get(file_version.filename_)
+          .SetReaderVersionId(FileRecord.NON_EXIST_VERSION);
+      UpdateTimestamp(file_version.ToFileName(), CACHE_NO_EXIST);
+    }
+  }
+
+  /* Try to evict one entry from LRU Cache by LRU policy
+     if no entry can be removed, return False
+   */
+  public static boolean EvictOneCacheEntry() {
+    return EvictOneCacheEntry(TOP_TIER);
+  }
+
+  /* Try to free one entry of a tier by LRU policy, demoting it to the next
+     tier if there is one, otherwise evicting it from the cache
+     if no entry can leave this tier, return False
+   */
+  public static boolean EvictOneCacheEntry(int tier) {
+    if (lru_.isEmpty()) {
+      return false;
+    }
+    if (compress_age_ms_ >= 0) {
+      // shrinking a cold entry is cheaper than losing one, for the next time
+      CompressColdEntry(tier);
+    }
+    Version victim = null;
+    Version compressing = null;
+    for (Version file_version : lru_) {
+      if (file_version.tier_ != tier ||
+          file_version.GetRefCount() > FileRecord.NON_REFERENCE) {
+        // some other clients are using it, cannot evcit yet
+        continue;
+      }
+      if (file_version.compressing_) {
+        // about to shrink, only let it go if nothing else can
+        if (compressing == null) {
+          compressing = file_version;
+        }
+        continue;
+      }
+      victim = file_version;
+      break;
+    }
+    if (victim == null) {
+      victim = compressing;
+    }
+    if (victim == null) {
+      return false;
+    }
+    if (tier + 1 < tiers_.size() && MoveCacheEntry(victim, tier + 1)) {
+      // demoted instead of evicted, still a cache hit later on
+      return true;
+    }
+    int reader_version_id =
+        record_map_.get(victim.filename_).GetReaderVersionId();
+    lru_.remove(victim);
+    if (reader_version_id == victim.version_) {
+      // the reader version is masked off
+      record_map_.get(victim.filename_)
+          .SetReaderVersionId(FileRecord.NON_EXIST_VERSION);
+      UpdateTimestamp(victim.ToFileName(), CACHE_NO_EXIST);
+    }
+    long freed_space = ReleaseCacheEntry(victim);
+    DecreaseCacheOccupancy(tier, freed_space);
+    Evicted(victim, freed_space, CacheEvents.LRU);
+    return true;
+  }
+
+  /* Hand the least recently used version of a tier that has been cold
+     for compress_age_ms_ and is not compressed yet to the compressor thread
+   */
+  private static void CompressColdEntry(int tier) {
+    long cold_before = System.currentTimeMillis() - compress_age_ms_;
+    for (Version file_version : lru_) {
+      if (file_version.last_hit_ms_ > cold_before) {
+        // the LRU order is also the age order, the rest is warmer
+        return;
+      }
+      if (file_version.tier_ != tier || file_version.compressed_ ||
+          file_version.incompressible_ || file_version.compressing_ ||
+          file_version.GetRefCount() > FileRecord.NON_REFERENCE) {
+        continue;
+      }
+      file_version.compressing_ = true;
+      String plain_path = FormatPath(file_version);
+      compressor_.execute(
+          () -> CompressCacheEntry(file_version, tier, plain_path));
+      return;
+    }
+  }
+
+  /* set the cache root directory for disk storage */
+  public void SetCacheDirectory(String cache_dir) {
+    tiers_.get(TOP_TIER).dir_ = cache_dir;
+  }
+
+  /* add the handler to enable communicating with Server */
+  public void AddRemoteFileManager(FileManagerRemote remote_manager) {
+    this.remote_manager_ = remote_manager;
+    hedged_remote_ = new HedgedRemote(remote_manager);
+  }
+
+  /* add a replica serving the same files and timestamps as the Server,
+     late Validate and range download requests get hedged to it */
+  public void AddReplicaFileManager(FileManagerRemote replica_manager) {
+    hedged_remote_.AddReplica(replica_manager);
   }
 
-  public void SetCacheCapacity(Long capacity) { cache_capacity_ = capacity; }
+  public String HedgeStats() { return hedged_remote_.Stats(); }
 
-  public long GetCacheOccupancy() { return cache_occupancy_; }
-
-  /*
-     register/update a whole filepath into the LRU cache
-     size update should be done separately
-   */
-  public static void HitFileInLRUCache(Version file_version) {
-    // try remove first to update its freshness position
-    RemoveFileFromLRUCache(file_version);
-    lru_.add(file_version);
+  /* batch the uploads of files that fit in one chunk, see UploadBatcher */
+  public void SetUploadBatching(long window_ms) {
+    upload_batcher_ =
+        (window_ms > ZERO) ? new UploadBatcher(remote_manager_, window_ms)
+                           : null;
   }
 
-  public static void RemoveFileFromLRUCache(Version file_version) {
-    lru_.remove(file_version);
+  /* stream writers' full chunks to Server every 'interval_ms' while they are
+     still open, see WriterStream */
+  public void SetStreamingUpload(long interval_ms) {
+    if (interval_ms <= ZERO) {
+      return;
+    }
+    streamer_ = Executors.newSingleThreadScheduledExecutor(runnable -> {
+      Thread thread = new Thread(runnable, "writer-stream");
+      thread.setDaemon(true);
+      return thread;
+    });
+    streamer_.scheduleWithFixedDelay(() -> {
+      for (WriterStream stream : streams_.values()) {
+        stream.Step(remote_manager_);
+      }
+    }, interval_ms, interval_ms, TimeUnit.MILLISECONDS);
   }
 
-  public static void IncreaseCacheOccupancy(Long size) {
-    cache_occupancy_ += size;
-  }
+  /* the path a fd was opened with */
+  public String PathOf(int fd) { return fd_filename_map_.get(fd); }
 
-  public static void DecreaseCacheOccupancy(Long size) {
-    cache_occupancy_ -= size;
-  }
+  /* the stream of a writer fd, null if it does not stream */
+  public WriterStream StreamOf(int fd) { return streams_.get(fd); }
 
-  /* Reserve a certain space from cache
-     Upon success, 'size' space will be reserved for the caller to use and
-     return True If no space is available, it will try evict a few other entries
-     if possible
+  /* have Server push new versions of files under any of 'prefixes' */
+  public void Subscribe(ArrayList<String> prefixes) throws RemoteException {
+    if (push_receiver_ == null) {
+      // the same receiver again, so that Server merges a repeated subscribe
+      push_receiver_ = new PushReceiver(this);
+    }
+    remote_manager_.Subscribe(push_receiver_, prefixes);
+  }
 
-     However, if all entries are in use, or not space available possible
-     (resever ~100GB file) It returns False
+  /**
+   * Install a version Server pushed, unless the cache has it or a newer one
+   * The rest of a large file is downloaded into a private temp file without
+   * the cache lock, which is only taken to check again and rename it in
    */
-  public static boolean ReserveCacheSpace(Long size, boolean should_lock) {
-    if (should_lock) {
-      cache_mtx_.lock();
+  public void InstallPushed(String path, long timestamp, FileChunk chunk) {
+    if (delete_queue_ != null && delete_queue_.IfTombstone(path)) {
+      // unlinked here, Server just did not learn about it yet
+      return;
     }
+    if (!IfNewer(path, timestamp)) {
+      return;
+    }
+    String temp_path = null;
     try {
-      long remain = cache_capacity_ - cache_occupancy_;
-      if (remain >= size) {
-        IncreaseCacheOccupancy(size);
-        return true;
+      temp_path = Files.createTempFile(Paths.get(tiers_.get(TOP_TIER).dir_),
+                                       PUSH_PREFIX, null).toString();
+      long size = FetchPushed(path, chunk, timestamp, temp_path);
+      if (size < 0) {
+        return;
       }
-      // current remain space is not enough, need to evict
-      while (EvictOneCacheEntry()) {
-        remain = cache_capacity_ - cache_occupancy_;
-        if (remain >= size) {
-          IncreaseCacheOccupancy(size);
-          return true;
+      CacheEvents.Lock(mtx_, "mtx_", null);
+      try {
+        if (timestamp_map_.getOrDefault(path, CACHE_NO_EXIST) >= timestamp) {
+          // an open downloaded this version or a newer one meanwhile
+          return;
         }
+        if (!ReserveCacheSpace(size, false)) {
+          events_.Record(CacheEventRing.ENOMEM, path, size,
+                         CacheEventRing.DOWNLOAD);
+          return;
+        }
+        Version version = NewVersion(path);
+        FileRecord record = record_map_.get(path);
+        String cache_path = FormatPath(version);
+        try {
+          new File(cache_path).getParentFile().mkdirs();
+          Files.move(Paths.get(temp_path), Paths.get(cache_path),
+                     StandardCopyOption.REPLACE_EXISTING);
+        } catch (IOException e) {
+          DecreaseCacheOccupancy(version.tier_, size);
+          version.MinusRefCount();
+          EvictCacheEntry(version);
+          record.version_map_.remove(version.version_);
+          throw e;
+        }
+        version.MinusRefCount();
+        UpdateTimestamp(path, timestamp);
+        record.SetReaderVersionId(version.version_);
+      } finally {
+        mtx_.unlock();
       }
-      return false;
+    } catch (IOException e) {
+      // e.g. replaced again meanwhile, the next open validates as usual
+      e.printStackTrace();
     } finally {
-      if (should_lock) {
-        cache_mtx_.unlock();
+      if (temp_path != null) {
+        DeleteFile(temp_path);
       }
     }
   }
 
-  /* Remove a specific file version from both disk and cache entry
-     typically happens when pruning so that no client will ever see a stale
-     cached version of a file
-   */
-  public static void EvictCacheEntry(Version file_version) {
-    String full_path = Cache.FormatPath(file_version.ToFileName());
-    lru_.remove(file_version);
-    DecreaseCacheOccupancy(DeleteFile(full_path));
-    FileRecord record = record_map_.get(file_version.filename_);
-    if (record.GetReaderVersionId() == file_version.version_) {
-      // the reader version is masked off
-      record_map_.get(file_version.filename_)
-          .SetReaderVersionId(FileRecord.NON_EXIST_VERSION);
-      UpdateTimestamp(file_version.ToFileName(), CACHE_NO_EXIST);
+  /* if 'timestamp' is newer than the cached version of 'path' */
+  private boolean IfNewer(String path, long timestamp) {
+    CacheEvents.Lock(mtx_, "mtx_", null);
+    try {
+      return timestamp_map_.getOrDefault(path, CACHE_NO_EXIST) < timestamp;
+    } finally {
+      mtx_.unlock();
     }
   }
 
-  /* Try to evict one entry from LRU Cache by LRU policy
-     if no entry can be removed, return False
-   */
-  public static boolean EvictOneCacheEntry() {
-    if (lru_.isEmpty()) {
-      return false;
-    }
-    for (Version file_version : lru_) {
-      if (file_version.GetRefCount() > FileRecord.NON_REFERENCE) {
-        // some other clients are using it, cannot evcit yet
-        continue;
+  /* download a pushed version starting with 'chunk' into 'temp_path'
+     return its size, -1 if it can never fit into the cache */
+  private long FetchPushed(String path, FileChunk chunk, long timestamp,
+                           String temp_path) throws IOException {
+    long capacity = tiers_.get(TOP_TIER).capacity_;
+    try (RandomAccessFile file = new RandomAccessFile(temp_path, WRITER_MODE)) {
+      long offset = ZERO;
+      while (true) {
+        if (!chunk.IfIntact()) {
+          // corrupted on the wire, fetch the same range again
+          chunk = ResumeDownload(path, SessionOf(chunk), timestamp, offset,
+                                 remote_manager_);
+        }
+        if (chunk == null) {
+          throw new IOException("download of pushed " + path + " broke off");
+        }
+        if (offset + chunk.data.length > capacity) {
+          events_.Record(CacheEventRing.ENOMEM, path,
+                         offset + chunk.data.length, CacheEventRing.DOWNLOAD);
+          if (SessionOf(chunk) != FileChunk.NO_SESSION) {
+            remote_manager_.CancelChunk(chunk.chunk_id);
+          }
+          return -1;
+        }
+        file.write(chunk.data);
+        offset += chunk.data.length;
+        if (chunk.end_of_file) {
+          return offset;
+        }
+        chunk = DownloadNextChunk(path, chunk.chunk_id, timestamp, offset,
+                                  remote_manager_);
       }
-      String full_path = Cache.FormatPath(file_version.ToFileName());
-      int reader_version_id =
-          record_map_.get(file_version.filename_).GetReaderVersionId();
-      lru_.remove(file_version);
-      if (reader_version_id == file_version.version_) {
-        // the reader version is masked off
-        record_map_.get(file_version.filename_)
-            .SetReaderVersionId(FileRecord.NON_EXIST_VERSION);
-        UpdateTimestamp(file_version.ToFileName(), CACHE_NO_EXIST);
-      }
-      long freed_space = DeleteFile(full_path);
-      DecreaseCacheOccupancy(freed_space);
-      return true;
     }
-    return false;
   }
 
-  /* set the cache root directory for disk storage */
-  public void SetCacheDirectory(String cache_dir) { cache_dir_ = cache_dir; }
+  /* let unlink return once the file is deleted locally, see DeleteQueue */
+  public void SetAsyncUnlink(boolean async_unlink) {
+    delete_queue_ = async_unlink ? new DeleteQueue(remote_manager_) : null;
+  }
 
-  /* add the handler to enable communicating with Server */
-  public void AddRemoteFileManager(FileManagerRemote remote_manager) {
-    this.remote_manager_ = remote_manager;
+  /* wait until a pending async unlink of 'path' reached Server, so that
+     what is sent about 'path' next is ordered after it */
+  private static void AwaitDelete(String path) throws IOException {
+    if (delete_queue_ == null) {
+      return;
+    }
+    try {
+      delete_queue_.Await(path);
+    } catch (InterruptedException e) {
+      throw new IOException("interrupted waiting for unlink of " + path);
+    }
   }
 
   /**
@@ -468,15 +1587,19 @@ public class Cache {
       return_val = record.GetReaderFile();
     } else {
       return_val = record.GetWriterFile();
-      if (return_val.version_ == FileHandling.Errors.ENOMEM) {
-        // no available space to make a writer copy
-        return new OpenReturnVal(null, FileHandling.Errors.ENOMEM, false);
-      }
+    }
+    if (return_val.version_ == FileHandling.Errors.ENOMEM) {
+      // no available space to make a writer copy or inflate a cold version
+      return new OpenReturnVal(null, FileHandling.Errors.ENOMEM, false);
     }
     RandomAccessFile file_handle = return_val.file_handle_;
     int version = return_val.version_;
     // register for bookkeeping
     int fd = Register(path, file_handle, version, option);
+    if (streamer_ != null && option != FileHandling.OpenOption.READ) {
+      streams_.put(fd, new WriterStream(
+                           path, FormatPath(record.version_map_.get(version))));
+    }
     return new OpenReturnVal(file_handle, fd, false);
   }
 
@@ -489,81 +1612,165 @@ public class Cache {
     FileHandling.OpenOption option = fd_option_map_.get(fd);
     String filename = fd_filename_map_.get(fd);
     FileRecord record = record_map_.get(filename);
+    WriterStream stream = streams_.remove(fd);
     file_handle.close();
-    // need to physically close this file
-    // before make it visible to other threads
-    mtx_.lock();
-    if (option == FileHandling.OpenOption.READ) {
-      record.CloseReaderFile(version_id);
-    } else {
-      record.CloseWriterFile(version_id);
-    }
-    mtx_.unlock();
+    // the fd is gone whether or not the upload below succeeds
     fd_handle_map_.remove(fd);
     fd_version_map_.remove(fd);
     fd_option_map_.remove(fd);
     fd_filename_map_.remove(fd);
+    spilled_fds_.remove(fd);
+    // need to physically close this file
+    // before make it visible to other threads
+    if (option == FileHandling.OpenOption.READ) {
+      CacheEvents.Lock(mtx_, "mtx_", null);
+      try {
+        record.CloseReaderFile(version_id);
+      } finally {
+        mtx_.unlock();
+      }
+      return;
+    }
+    Version writer_version;
+    CacheEvents.Lock(mtx_, "mtx_", null);
+    try {
+      writer_version = record.version_map_.get(version_id);
+    } finally {
+      mtx_.unlock();
+    }
+    // upload without the cache lock, so that closes of different files
+    // overlap (and can share a batch). The writer still holds a reference,
+    // so its version cannot be evicted or moved meanwhile
+    long server_timestamp;
+    try (RandomAccessFile file = new RandomAccessFile(
+             FormatPath(writer_version), READER_MODE)) {
+      server_timestamp = UploadFile(filename, file, stream);
+    } catch (IOException e) {
+      CacheEvents.Lock(mtx_, "mtx_", null);
+      try {
+        record.DropWriterFile(version_id);
+      } finally {
+        mtx_.unlock();
+      }
+      throw e;
+    }
+    CacheEvents.Lock(mtx_, "mtx_", null);
+    try {
+      record.CloseWriterFile(version_id, server_timestamp);
+    } finally {
+      mtx_.unlock();
+    }
   }
 
   /* map the logical file path to the cache root directory file path */
   public static String FormatPath(String path) {
-    return Paths.get(cache_dir_ + Slash + path).normalize().toString();
+    return FormatPath(tiers_.get(TOP_TIER).dir_, path);
+  }
+
+  /* map a file version to its path inside the tier currently holding it */
+  public static String FormatPath(Version file_version) {
+    String dir = file_version.spilled_ ? spill_dir_
+                                       : tiers_.get(file_version.tier_).dir_;
+    return FormatPath(dir, file_version.ToFileName());
+  }
+
+  private static String FormatPath(String cache_dir, String path) {
+    return Paths.get(cache_dir + Slash + path).normalize().toString();
+  }
+
+  /* a new version of 'path' about to be filled from Server, referenced so
+     that it cannot be evicted meanwhile. An idle stale reader version is
+     evicted right away since a new one is on its way. Call under mtx_ */
+  private static Version NewVersion(String path) {
+    FileRecord record = record_map_.get(path);
+    if (record == null) {
+      record = new FileRecord(path, FileRecord.NON_EXIST_VERSION,
+                              FileRecord.NON_EXIST_VERSION);
+      record_map_.put(path, record);
+    } else {
+      // check if there is an available reader version for this file
+      // if so, actively evict it since we know it's stale and are downloading
+      // a new version
+      if (record.GetReaderVersionId() >= FileRecord.INITIAL_VERSION) {
+        Version curr_reader_version = record.GetReaderVersion();
+        if (curr_reader_version.GetRefCount() == FileRecord.INITIAL_VERSION) {
+          Cache.EvictCacheEntry(curr_reader_version);
+          record.version_map_.remove(curr_reader_version.version_);
+          record.SetReaderVersionId(FileRecord.NON_EXIST_VERSION);
+        }
+      }
+    }
+    int version_id = record.IncrementLatestVersionId();
+    Version version = new Version(path, version_id);
+    record.version_map_.put(version_id, version);
+    version.PlusRefCount(); // act as a client temporarily, no evict on this
+                            // version
+    HitFileInLRUCache(version);
+    return version;
   }
 
   /* save a file transferred from server into local cache directory */
-  private boolean SaveData(String path, FileChunk chunk,
-                           Long server_timestamp) {
+  private boolean SaveData(String path, FileChunk chunk, Long server_timestamp,
+                           FileManagerRemote session_manager)
+      throws IOException {
     try {
+      Version version = NewVersion(path);
       FileRecord record = record_map_.get(path);
-      if (record == null) {
-        record = new FileRecord(path, FileRecord.NON_EXIST_VERSION,
-                                FileRecord.NON_EXIST_VERSION);
-        record_map_.put(path, record);
-      } else {
-        // check if there is an available reader version for this file
-        // if so, actively evict it since we know it's stale and are downloading
-        // a new version
-        if (record.GetReaderVersionId() >= FileRecord.INITIAL_VERSION) {
-          Version curr_reader_version = record.GetReaderVersion();
-          if (curr_reader_version.GetRefCount() == FileRecord.INITIAL_VERSION) {
-            Cache.EvictCacheEntry(curr_reader_version);
-            record.version_map_.remove(curr_reader_version.version_);
-            record.SetReaderVersionId(FileRecord.NON_EXIST_VERSION);
-          }
-        }
-      }
-      int version_id = record.IncrementLatestVersionId();
-      Version version = new Version(path, version_id);
-      record.version_map_.put(version_id, version);
-      version.PlusRefCount(); // act as a client temporarily, no evict on this
-                              // version
-      HitFileInLRUCache(version);
+      int version_id = version.version_;
 
-      String cache_path = FormatPath(version.ToFileName());
+      String cache_path = FormatPath(version);
       File directory =
           new File(new File(cache_path).getParentFile().getAbsolutePath());
       directory.mkdirs();
       RandomAccessFile file = new RandomAccessFile(cache_path, WRITER_MODE);
       file.setLength(ZERO); // clear off content
+      long offset = ZERO;
       while (true) {
+        if (!chunk.IfIntact()) {
+          // corrupted on the wire, fetch the same range again
+          chunk = ResumeDownload(path, SessionOf(chunk), server_timestamp,
+                                 offset, session_manager);
+        }
+        if (chunk == null) {
+          // the download broke off for good, drop the partial version
+          file.close();
+          version.MinusRefCount();
+          EvictCacheEntry(version);
+          record.version_map_.remove(version_id);
+          throw new IOException("download of " + path + " broke off");
+        }
         // while downloading this chunk, reserve space from Cache
         boolean success = ReserveCacheSpace((long)chunk.data.length, false);
         if (!success) {
           // cannot store this big file into cache space
+          events_.Record(CacheEventRing.ENOMEM, path,
+                         offset + chunk.data.length, CacheEventRing.DOWNLOAD);
           version.MinusRefCount();
           EvictCacheEntry(version); // deallocate space
           record.version_map_.remove(version_id);
-          if (!chunk.end_of_file) {
+          if (SessionOf(chunk) != FileChunk.NO_SESSION) {
             // server side holds a reader lock for you, cancel it
-            remote_manager_.CancelChunk(chunk.chunk_id);
+            session_manager.CancelChunk(chunk.chunk_id);
           }
           return false;
         }
         file.write(chunk.data);
+        offset += chunk.data.length;
         if (chunk.end_of_file) {
           break;
         } else {
-          chunk = remote_manager_.DownloadChunk(chunk.chunk_id);
+          CacheEvents.ChunkTransferEvent transfer =
+              new CacheEvents.ChunkTransferEvent();
+          transfer.begin();
+          chunk = DownloadNextChunk(path, chunk.chunk_id, server_timestamp,
+                                    offset, session_manager);
+          transfer.end();
+          if (transfer.shouldCommit() && chunk != null) {
+            transfer.path = path;
+            transfer.direction = CacheEvents.DOWNLOAD;
+            transfer.bytes = chunk.data.length;
+            transfer.commit();
+          }
         }
       }
       version.MinusRefCount(); // finish writing into this file
@@ -574,12 +1781,263 @@ public class Cache {
       record.SetReaderVersionId(
           version_id); // make this version available to clients
       return true;
+    } catch (IOException e) {
+      // could not download it even after resuming, let open report EIO
+      throw e;
     } catch (Exception e) {
       e.printStackTrace();
     }
     return true;
   }
 
+  /* the chunked session a downloaded chunk belongs to, if it still holds one */
+  private static int SessionOf(FileChunk chunk) {
+    return chunk.end_of_file ? FileChunk.NO_SESSION : chunk.chunk_id;
+  }
+
+  /**
+   * Fetch the chunk starting at 'offset' through the chunked session, and
+   * resume with range downloads of the same version if the session broke
+   * return null if that version is gone from Server or retries ran out
+   * 'session_manager' is the endpoint that opened the chunked session
+   */
+  private FileChunk DownloadNextChunk(String path, int chunk_id,
+                                      long timestamp, long offset,
+                                      FileManagerRemote session_manager) {
+    if (chunk_id != FileChunk.NO_SESSION) {
+      try {
+        FileChunk chunk = session_manager.DownloadChunk(chunk_id);
+        if (chunk.offset == offset && chunk.IfIntact()) {
+          return chunk;
+        }
+      } catch (Exception e) {
+        e.printStackTrace();
+      }
+    }
+    return ResumeDownload(path, chunk_id, timestamp, offset, session_manager);
+  }
+
+  /**
+   * Give up a broken chunked session and download the rest of the same
+   * version range by range from 'offset', each chunk checked on arrival
+   * all ranges come from 'session_manager', the endpoint of the first chunk
+   * return null if that version is gone from Server or retries ran out
+   */
+  private FileChunk ResumeDownload(String path, int chunk_id, long timestamp,
+                                   long offset,
+                                   FileManagerRemote session_manager) {
+    if (chunk_id != FileChunk.NO_SESSION) {
+      try {
+        // hand back the reader lock this session holds on Server
+        session_manager.CancelChunk(chunk_id);
+      } catch (RemoteException e) {
+        e.printStackTrace();
+      }
+    }
+    for (int attempt = 0; attempt < FileChunk.MAX_RETRY; attempt++) {
+      try {
+        // never hedged, 'timestamp' is only a version on the endpoint that
+        // answered the first chunk
+        FileChunk chunk =
+            session_manager.DownloadRange(path, timestamp, offset);
+        if (chunk == null || chunk.IfIntact()) {
+          // null means a newer version replaced it meanwhile
+          return chunk;
+        }
+      } catch (Exception e) {
+        e.printStackTrace();
+      }
+    }
+    return null;
+  }
+
+  /**
+   * Upload a whole local file as the new version of 'path' chunk by chunk
+   * a chunk that fails is resumed from the offset Server acknowledged last,
+   * the upload only starts over if Server lost the session altogether
+   * return the timestamp Server assigned to the new version
+   */
+  public static long UploadFile(String path, RandomAccessFile file)
+      throws IOException {
+    return UploadFile(path, file, null);
+  }
+
+  /**
+   * Same as above, but continue the upload session 'stream' already staged
+   * the head of the file in, if it is intact
+   */
+  public static long UploadFile(String path, RandomAccessFile file,
+                                WriterStream stream) throws IOException {
+    AwaitDelete(path);
+    int chunk_id = FileChunk.NO_SESSION;
+    long offset = ZERO;
+    try {
+      if (stream != null && stream.Finish(remote_manager_)) {
+        // only the tail and the commit are left
+        chunk_id = stream.SessionId();
+        offset = stream.Acked();
+      }
+    } catch (InterruptedException e) {
+      throw new IOException("interrupted finishing stream of " + path);
+    }
+    if (chunk_id == FileChunk.NO_SESSION && upload_batcher_ != null &&
+        file.length() <= FileChunk.CHUNK_SIZE) {
+      Long timestamp;
+      try {
+        timestamp = upload_batcher_.Submit(
+            path, ReadChunk(file, FileChunk.NO_SESSION, ZERO));
+      } catch (InterruptedException e) {
+        throw new IOException("interrupted uploading " + path);
+      }
+      if (timestamp != null) {
+        return timestamp;
+      }
+      // the batch failed for this file, upload it on its own below
+    }
+    int failures = 0;
+    while (true) {
+      FileChunk chunk = ReadChunk(file, chunk_id, offset);
+      CacheEvents.ChunkTransferEvent transfer =
+          new CacheEvents.ChunkTransferEvent();
+      try {
+        transfer.begin();
+        Long timestamp = null;
+        if (chunk_id == FileChunk.NO_SESSION) {
+          Long[] tuple = remote_manager_.Upload(path, chunk);
+          timestamp = tuple[FileRecord.TIMESTAMP_INDEX];
+          chunk_id = tuple[FileRecord.CHUNK_INDEX].intValue();
+        } else {
+          timestamp = remote_manager_.UploadChunk(chunk);
+        }
+        transfer.end();
+        if (transfer.shouldCommit()) {
+          transfer.path = path;
+          transfer.direction = CacheEvents.UPLOAD;
+          transfer.bytes = chunk.data.length;
+          transfer.commit();
+        }
+        if (chunk.end_of_file) {
+          return timestamp;
+        }
+        offset += chunk.data.length;
+        failures = 0;
+      } catch (IOException e) {
+        // RemoteException is an IOException as well
+        if (++failures > FileChunk.MAX_RETRY) {
+          throw e;
+        }
+        e.printStackTrace();
+        long acked = UploadOffsetOf(chunk_id);
+        if (acked < ZERO) {
+          // Server does not know this session, start over
+          chunk_id = FileChunk.NO_SESSION;
+          offset = ZERO;
+        } else {
+          offset = acked;
+        }
+      }
+    }
+  }
+
+  /* how far Server got with an upload session, negative if unknown */
+  private static long UploadOffsetOf(int chunk_id) {
+    if (chunk_id == FileChunk.NO_SESSION) {
+      return FAILURE;
+    }
+    try {
+      return remote_manager_.UploadOffset(chunk_id);
+    } catch (RemoteException e) {
+      e.printStackTrace();
+      return FAILURE;
+    }
+  }
+
+  /* read the chunk of a local file that starts at 'offset' for uploading */
+  public static FileChunk ReadChunk(RandomAccessFile file, int chunk_id,
+                                    long offset) throws IOException {
+    long file_remain_size = Math.max(file.length() - offset, ZERO);
+    int chunk_size =
+        (int)Math.min(file_remain_size, (long)FileChunk.CHUNK_SIZE);
+    byte[] data = new byte[chunk_size];
+    file.seek(offset);
+    file.readFully(data);
+    boolean is_end = (file_remain_size <= FileChunk.CHUNK_SIZE);
+    return new FileChunk(data, is_end, chunk_id, offset);
+  }
+
+  /* the subtree root a file belongs to, at most subtree_depth_ levels deep */
+  private static String SubtreeOf(String path) {
+    String[] components = path.split(Slash);
+    // the last component is the file itself
+    int depth = Math.min(subtree_depth_, components.length - 1);
+    return String.join(Slash, Arrays.copyOf(components, depth));
+  }
+
+  /* the subtree epoch to confirm a file at, read before validating the file */
+  private static long SubtreeEpochOf(String path) {
+    subtree_mtx_.lock();
+    try {
+      SubtreeRecord record = subtree_map_.computeIfAbsent(
+          SubtreeOf(path), k -> new SubtreeRecord());
+      return record.epoch_;
+    } finally {
+      subtree_mtx_.unlock();
+    }
+  }
+
+  /* record the outcome of a per-file validation in the file's subtree */
+  private static void ConfirmSubtreeFile(String path, long epoch,
+                                         boolean fresh) {
+    subtree_mtx_.lock();
+    try {
+      SubtreeRecord record = subtree_map_.get(SubtreeOf(path));
+      if (fresh) {
+        record.ConfirmFile(path, epoch);
+      } else {
+        record.ForgetFile(path);
+      }
+    } finally {
+      subtree_mtx_.unlock();
+    }
+  }
+
+  /**
+   * Check if the cached copy of a file can be used without a per-file Validate
+   * A recently validated subtree vouches for it without any RPC, otherwise the
+   * whole subtree is re-validated with one RPC and only files that changed
+   * under it fall back to per-file validation
+   */
+  private boolean ValidateBySubtree(String path) throws RemoteException {
+    String subtree = SubtreeOf(path);
+    SubtreeRecord record;
+    long since;
+    subtree_mtx_.lock();
+    try {
+      record = subtree_map_.computeIfAbsent(subtree, k -> new SubtreeRecord());
+      long elapsed = System.currentTimeMillis() - record.validated_at_;
+      if (record.epoch_ >= 0 && elapsed < subtree_window_ms_) {
+        return record.IfTrusted(path);
+      }
+      since = record.epoch_;
+    } finally {
+      subtree_mtx_.unlock();
+    }
+    SubtreeResult result = remote_manager_.ValidateSubtree(subtree, since);
+    subtree_mtx_.lock();
+    try {
+      record.Advance(since, result);
+      return record.IfTrusted(path);
+    } finally {
+      subtree_mtx_.unlock();
+    }
+  }
+
+  /* an open decided as 'kind', with the size of the version it gets */
+  private static void RecordOpen(String kind, String path) {
+    events_.Record(kind, path,
+                   PlainSize(record_map_.get(path).GetReaderVersion()));
+  }
+
   /**
    * Proxy delegate the open functionality to cache
    * and cache make local disk operations based on check-on-use results from the
@@ -588,12 +2046,70 @@ public class Cache {
    */
   public OpenReturnVal open(String path, FileHandling.OpenOption option) {
     boolean locked = false;
+    boolean by_subtree = (subtree_window_ms_ > ZERO &&
+                          option == FileHandling.OpenOption.READ);
     try {
+      if (delete_queue_ != null && delete_queue_.IfTombstone(path)) {
+        if (option == FileHandling.OpenOption.READ ||
+            option == FileHandling.OpenOption.WRITE) {
+          // deleted by this proxy, whether or not Server knows yet
+          return new OpenReturnVal(null, FileHandling.Errors.ENOENT, false);
+        }
+        // a create must reach Server after the delete it follows
+        AwaitDelete(path);
+      }
+      long subtree_epoch = SubtreeRecord.UNKNOWN_EPOCH;
+      if (by_subtree) {
+        if (timestamp_map_.containsKey(path) && ValidateBySubtree(path)) {
+          // the cached copy is vouched for by its subtree, no Validate needed
+          CacheEvents.Lock(mtx_, "mtx_", null);
+          locked = true;
+          FileRecord record = record_map_.get(path);
+          if (record != null &&
+              record.GetReaderVersionId() >= FileRecord.INITIAL_VERSION) {
+            RecordOpen(CacheEventRing.HIT, path);
+            return GetAndRegisterFile(record, path, option);
+          }
+          mtx_.unlock();
+          locked = false;
+        }
+        subtree_epoch = SubtreeEpochOf(path);
+      }
       long cache_file_timestamp =
           timestamp_map_.getOrDefault(path, CACHE_NO_EXIST);
       /* send validation request to server */
-      ValidateResult validate_result = remote_manager_.Validate(
-          new ValidateParam(path, option, cache_file_timestamp));
+      ValidateParam param =
+          new ValidateParam(path, option, cache_file_timestamp);
+      FileManagerRemote session_manager = remote_manager_;
+      ValidateResult validate_result;
+      CacheEvents.ValidateEvent validate_event =
+          new CacheEvents.ValidateEvent();
+      validate_event.begin();
+      if (option == FileHandling.OpenOption.READ) {
+        // read-only validation changes nothing on Server, hedge it if late
+        HedgedRemote.Answer<ValidateResult> answer = hedged_remote_.Call(
+            VALIDATE_OP, manager -> manager.Validate(param),
+            (manager, late_result) -> {
+              FileChunk late_chunk = late_result.chunk;
+              if (late_chunk != null && !late_chunk.end_of_file) {
+                // the slower endpoint opened a download session for nothing
+                manager.CancelChunk(late_chunk.chunk_id);
+              }
+            });
+        validate_result = answer.value;
+        session_manager = answer.manager;
+      } else {
+        validate_result = remote_manager_.Validate(param);
+      }
+      validate_event.end();
+      if (validate_event.shouldCommit()) {
+        validate_event.path = path;
+        validate_event.result =
+            (validate_result.error_code < SUCCESS) ? CacheEvents.FAILED
+            : (validate_result.chunk == null)      ? CacheEvents.HIT
+                                                   : CacheEvents.STALE;
+        validate_event.commit();
+      }
       int error_code = validate_result.error_code;
       boolean if_directory = validate_result.is_directory;
       if (error_code == FileHandling.Errors.ENOENT) {
@@ -605,16 +2121,20 @@ public class Cache {
         }
       }
       if (error_code < SUCCESS) { // server already checks error for proxy
+        if (by_subtree) {
+          ConfirmSubtreeFile(path, subtree_epoch, false);
+        }
         return new OpenReturnVal(null, error_code, if_directory);
       }
       if (if_directory) {
         // the dummy read directory command
         return new OpenReturnVal(null, cache_fd_++, if_directory);
       }
-      mtx_.lock();
+      CacheEvents.Lock(mtx_, "mtx_", null);
       locked = true;
       long server_file_timestamp = validate_result.timestamp;
       FileChunk file_chunk = validate_result.chunk;
+      String decision = CacheEventRing.HIT;
       if (server_file_timestamp >= Server.SERVER_NO_EXIST &&
           file_chunk != null) {
         if (timestamp_map_.getOrDefault(path, CACHE_NO_EXIST) ==
@@ -622,16 +2142,20 @@ public class Cache {
           // someone else already downloaded for us meanwhile
           if (!file_chunk.end_of_file) {
             // server is holding a lock for this file, no need
-            remote_manager_.CancelChunk(file_chunk.chunk_id);
+            session_manager.CancelChunk(file_chunk.chunk_id);
           }
         } else {
           // new content is updated from the server side, save it
           // iteratively ask for more chunks from server until EOF
-          boolean success = SaveData(path, file_chunk, server_file_timestamp);
+          boolean success = SaveData(path, file_chunk, server_file_timestamp,
+                                     session_manager);
           if (!success) {
             return new OpenReturnVal(null, FileHandling.Errors.ENOMEM,
                                      if_directory);
           }
+          decision = (cache_file_timestamp == CACHE_NO_EXIST)
+                         ? CacheEventRing.COLD
+                         : CacheEventRing.STALE;
         }
       }
       // create new entry in the record map if necessary
@@ -641,6 +2165,15 @@ public class Cache {
                                 FileRecord.NON_EXIST_VERSION);
         record_map_.put(path, record);
       }
+      if (by_subtree) {
+        ConfirmSubtreeFile(path, subtree_epoch,
+                           record.GetReaderVersionId() >=
+                               FileRecord.INITIAL_VERSION);
+      }
+      if (record.GetReaderVersionId() >= FileRecord.INITIAL_VERSION) {
+        // a create of a new file has no version to hit or miss yet
+        RecordOpen(decision, path);
+      }
       return GetAndRegisterFile(record, path, option);
     } catch (FileSystemException | FileNotFoundException e) {
       // already check for filenotfound above, assume it is permission problem
@@ -671,6 +2204,10 @@ public class Cache {
     try {
       DeregisterFile(fd); // include upload file to server and cache pruning
       return SUCCESS;
+    } catch (IOException e) {
+      // the new version could not be uploaded even after resuming
+      e.printStackTrace();
+      return EIO;
     } catch (Exception e) {
       e.printStackTrace();
     }
@@ -682,26 +2219,27 @@ public class Cache {
    */
   public int unlink(String path) {
     try {
+      if (delete_queue_ != null) {
+        if (delete_queue_.IfTombstone(path)) {
+          // already unlinked by this proxy
+          return FileHandling.Errors.ENOENT;
+        }
+        int code = PredictUnlink(path);
+        if (code == SUCCESS) {
+          // apply locally now, Server learns about it in the background
+          DropCachedFile(path);
+          delete_queue_.Enqueue(path);
+          return SUCCESS;
+        }
+        if (code != UNLINK_UNKNOWN) {
+          return code;
+        }
+        // let Server decide right away
+      }
       int code = remote_manager_.Delete(path);
       if (code == SUCCESS) {
         // delete on server side is successful
-        mtx_.lock();
-        FileRecord record = record_map_.get(path);
-        if (record != null) {
-          record.SetReaderVersionId(FileRecord.NON_EXIST_VERSION);
-          timestamp_map_.remove(path);
-          ArrayList<Version> evict_candidates = new ArrayList<>();
-          for (Version v : record.version_map_.values()) {
-            if (v.GetRefCount() == FileRecord.NON_REFERENCE) {
-              // no one is currently using this version and its whole deleted
-              evict_candidates.add(v);
-            }
-          }
-          for (Version v : evict_candidates) {
-            EvictCacheEntry(v);
-          }
-        }
-        mtx_.unlock();
+        DropCachedFile(path);
       }
       return code;
     } catch (SecurityException e) {
@@ -712,4 +2250,54 @@ public class Cache {
     }
     return EIO; // indicate any other form of error
   }
+
+  /* How an unlink of 'path' will end on Server: SUCCESS if a version of it
+     is cached or Server still has it as a regular file, ENOENT or EISDIR if
+     Server says so, UNLINK_UNKNOWN otherwise. Only a SUCCESS may be queued.
+     A CREATE_NEW Validate never carries the file's data back */
+  private int PredictUnlink(String path) throws RemoteException {
+    CacheEvents.Lock(mtx_, "mtx_", null);
+    try {
+      if (timestamp_map_.getOrDefault(path, CACHE_NO_EXIST) >= ZERO) {
+        return SUCCESS;
+      }
+    } finally {
+      mtx_.unlock();
+    }
+    ValidateResult result = remote_manager_.Validate(new ValidateParam(
+        path, FileHandling.OpenOption.CREATE_NEW, CACHE_NO_EXIST));
+    if (result.error_code == SUCCESS) {
+      // free to be created, so nothing to delete
+      return FileHandling.Errors.ENOENT;
+    }
+    if (result.error_code != FileHandling.Errors.EEXIST) {
+      return UNLINK_UNKNOWN;
+    }
+    return result.is_directory ? FileHandling.Errors.EISDIR : SUCCESS;
+  }
+
+  /* hide a deleted file from clients and evict its unreferenced versions */
+  private void DropCachedFile(String path) {
+    CacheEvents.Lock(mtx_, "mtx_", null);
+    try {
+      FileRecord record = record_map_.get(path);
+      if (record == null) {
+        return;
+      }
+      record.SetReaderVersionId(FileRecord.NON_EXIST_VERSION);
+      timestamp_map_.remove(path);
+      ArrayList<Version> evict_candidates = new ArrayList<>();
+      for (Version v : record.version_map_.values()) {
+        if (v.GetRefCount() == FileRecord.NON_REFERENCE) {
+          // no one is currently using this version and its whole deleted
+          evict_candidates.add(v);
+        }
+      }
+      for (Version v : evict_candidates) {
+        EvictCacheEntry(v);
+      }
+    } finally {
+      mtx_.unlock();
+    }
+  }
 }
\ No newline at end of file
@@ -0,0 +1,130 @@
+/**
+ * file: CacheEventRing.java
+ * author: Yukun Jiang
+ * date: Mar 19
+ *
+ * In-memory ring of the Proxy cache's recent decisions, to see why the hit
+ * rate drops: which opens hit, were stale or cold, which versions were
+ * evicted and why, where space reservation failed, which writers spilled
+ * out of the full cache and which got their version installed
+ *
+ * Recording is lock-free: a writer claims a sequence number with one atomic
+ * add and publishes an immutable event into its slot, overwriting the oldest
+ * one. Readers copy whatever slots still hold the sequence they expect, so a
+ * snapshot taken while writers lap it only misses the overwritten events.
+ * Served as TSV on a loopback port, for tools/event_dump
+ *   curl http://127.0.0.1:<events_port>/events
+ * */
+
+import com.sun.net.httpserver.HttpServer;
+import java.io.IOException;
+import java.io.OutputStream;
+import java.net.InetAddress;
+import java.net.InetSocketAddress;
+import java.nio.charset.StandardCharsets;
+import java.util.concurrent.atomic.AtomicLong;
+import java.util.concurrent.atomic.AtomicReferenceArray;
+
+public class CacheEventRing {
+  public static final String HIT = "hit";
+  public static final String STALE = "stale";
+  public static final String COLD = "cold";
+  public static final String EVICT = "evict";
+  public static final String ENOMEM = "enomem";
+  public static final String INSTALL = "install";
+  public static final String SPILL = "spill";
+
+  /* where a reservation failed, in the ENOMEM detail */
+  public static final String DOWNLOAD = "download";
+  public static final String WRITER_COPY = "writer copy";
+  public static final String INFLATE = "inflate";
+  public static final String WRITE = "write";
+
+  private static final class Event {
+    public final long seq;
+    public final long time_ms;
+    public final String kind;
+    public final String path;
+    public final long size;
+    /* eviction reason or where ENOMEM came from, may be empty */
+    public final String detail;
+
+    public Event(long seq, String kind, String path, long size,
+                 String detail) {
+      this.seq = seq;
+      this.time_ms = System.currentTimeMillis();
+      this.kind = kind;
+      this.path = path;
+      this.size = size;
+      this.detail = detail;
+    }
+  }
+
+  private static final String EVENTS_PATH = "/events";
+
+  private final int mask_;
+
+  private final AtomicReferenceArray<Event> slots_;
+
+  private final AtomicLong next_seq_ = new AtomicLong();
+
+  private HttpServer http_server_ = null;
+
+  /* keep the last 'capacity' events, rounded up to a power of two */
+  public CacheEventRing(int capacity) {
+    int size = Integer.highestOneBit(Math.max(capacity - 1, 1)) << 1;
+    mask_ = size - 1;
+    slots_ = new AtomicReferenceArray<>(size);
+  }
+
+  public void Record(String kind, String path, long size) {
+    Record(kind, path, size, "");
+  }
+
+  public void Record(String kind, String path, long size, String detail) {
+    long seq = next_seq_.getAndIncrement();
+    slots_.set((int)seq & mask_, new Event(seq, kind, path, size, detail));
+  }
+
+  /* every event still in the ring, oldest first, one per line as
+     "time_ms kind size detail path" separated by tabs */
+  public String Dump() {
+    long end = next_seq_.get();
+    long begin = Math.max(end - slots_.length(), 0);
+    StringBuilder tsv = new StringBuilder();
+    for (long seq = begin; seq < end; seq++) {
+      Event event = slots_.get((int)seq & mask_);
+      if (event == null || event.seq != seq) {
+        // not published yet, or lapped by a newer one meanwhile
+        continue;
+      }
+      tsv.append(event.time_ms)
+          .append('\t')
+          .append(event.kind)
+          .append('\t')
+          .append(event.size)
+          .append('\t')
+          .append(event.detail)
+          .append('\t')
+          .append(event.path)
+          .append('\n');
+    }
+    return tsv.toString();
+  }
+
+  /* serve Dump() on the loopback interface, port 0 picks a free one */
+  public int Serve(int port) throws IOException {
+    http_server_ = HttpServer.create(
+        new InetSocketAddress(InetAddress.getLoopbackAddress(), port), 0);
+    http_server_.createContext(EVENTS_PATH, exchange -> {
+      byte[] body = Dump().getBytes(StandardCharsets.UTF_8);
+      exchange.getResponseHeaders().set("Content-Type", "text/plain");
+      exchange.sendResponseHeaders(200, body.length);
+      try (OutputStream out = exchange.getResponseBody()) {
+        out.write(body);
+      }
+    });
+    http_server_.start();
+    return http_server_.getAddress().getPort();
+  }
+}
@@ -0,0 +1,118 @@
+/**
+ * file: CacheEvents.java
+ * author: Yukun Jiang
+ * date: Mar 10
+ *
+ * Custom Java Flight Recorder events of the Proxy and the Server, so that a
+ * standard JFR recording shows file operations next to GC, allocation and
+ * lock stalls, e.g.
+ *   java -XX:StartFlightRecording=filename=proxy.jfr Proxy ...
+ *
+ * Every call site follows the same pattern: begin/end around the work, and
+ * fill in the fields only if shouldCommit(). With the events disabled, the
+ * JIT drops the whole event object, so the cost is negligible
+ * */
+
+import java.util.concurrent.locks.Lock;
+import jdk.jfr.Category;
+import jdk.jfr.DataAmount;
+import jdk.jfr.Description;
+import jdk.jfr.Event;
+import jdk.jfr.Label;
+import jdk.jfr.Name;
+
+public class CacheEvents {
+  public static final String HIT = "hit";
+  public static final String STALE = "stale";
+  public static final String FAILED = "failed";
+
+  public static final String DOWNLOAD = "download";
+  public static final String UPLOAD = "upload";
+
+  public static final String LRU = "lru";
+  public static final String DEMOTE = "demote";
+  public static final String COMPRESS = "compress";
+  public static final String PRUNE = "prune";
+
+  @Name("filecache.Validate")
+  @Label("Validate")
+  @Category({"File Cache", "Proxy"})
+  @Description("Check-on-use of a cached file against Server")
+  static class ValidateEvent extends Event {
+    @Label("Path") String path;
+    @Label("Result") @Description("hit, stale or failed") String result;
+  }
+
+  @Name("filecache.ChunkTransfer")
+  @Label("Chunk Transfer")
+  @Category({"File Cache", "Proxy"})
+  @Description("One chunk downloaded from or uploaded to Server")
+  static class ChunkTransferEvent extends Event {
+    @Label("Path") String path;
+    @Label("Direction") String direction;
+    @Label("Bytes") @DataAmount long bytes;
+  }
+
+  @Name("filecache.LockWait")
+  @Label("Lock Wait")
+  @Category({"File Cache"})
+  @Description("Time blocked on a contended Proxy or Server lock")
+  static class LockWaitEvent extends Event {
+    @Label("Lock") String lock;
+    @Label("Path") @Description("the file of a Server file lock") String path;
+  }
+
+  @Name("filecache.Eviction")
+  @Label("Eviction")
+  @Category({"File Cache", "Proxy"})
+  @Description("A cached version leaving its tier, or shrinking")
+  static class EvictionEvent extends Event {
+    @Label("Victim") String victim;
+    @Label("Size") @DataAmount long size;
+    @Label("Reason") @Description("lru, demote, compress or prune")
+    String reason;
+  }
+
+  @Name("filecache.WriterCopy")
+  @Label("Writer Copy")
+  @Category({"File Cache", "Proxy"})
+  @Description("Private copy of the reader version for a new writer")
+  static class WriterCopyEvent extends Event {
+    @Label("Path") String path;
+    @Label("Bytes") @DataAmount long bytes;
+  }
+
+  /* an acquire faster than this did not have to wait for anyone */
+  private static final long CONTENDED_NS = 10_000;
+
+  /* take 'lock', recording how long it blocked if it was contended. Always
+     a plain lock(), a tryLock() on a read lock would barge ahead of queued
+     writers and could starve them */
+  public static void Lock(Lock lock, String name, String path) {
+    LockWaitEvent event = new LockWaitEvent();
+    if (!event.isEnabled()) {
+      lock.lock();
+      return;
+    }
+    long begin_ns = System.nanoTime();
+    event.begin();
+    lock.lock();
+    event.end();
+    if (System.nanoTime() - begin_ns >= CONTENDED_NS && event.shouldCommit()) {
+      event.lock = name;
+      event.path = path;
+      event.commit();
+    }
+  }
+
+  /* an eviction that already happened, its duration does not matter */
+  public static void Evicted(Version victim, long size, String reason) {
+    EvictionEvent event = new EvictionEvent();
+    if (event.shouldCommit()) {
+      event.victim = victim.ToFileName();
+      event.size = size;
+      event.reason = reason;
+      event.commit();
+    }
+  }
+}
@@ -0,0 +1,107 @@
+/**
+ * file: DeleteQueue.java
+ * author: Yukun Jiang
+ * date: Mar 08
+ *
+ * Background queue of unlinks the Proxy already applied locally
+ *
+ * A queued path is a tombstone: the Proxy treats it as deleted although
+ * Server may not know yet. A background thread sends everything queued in
+ * batches of up to MAX_BATCH paths per DeleteBatch RPC, and a path stays a
+ * tombstone until Server has answered for it. Anything that would recreate
+ * a tombstoned path on Server must Await it first, so that the delete is
+ * always applied before the create
+ * */
+
+import java.rmi.RemoteException;
+import java.util.ArrayList;
+import java.util.HashSet;
+import java.util.Iterator;
+import java.util.LinkedHashSet;
+
+public class DeleteQueue implements Runnable {
+  private static final int MAX_BATCH = 1024;
+
+  private static final int SUCCESS = 0;
+
+  private final FileManagerRemote remote_manager_;
+
+  /* not sent yet, in unlink order */
+  private final LinkedHashSet<String> queued_ = new LinkedHashSet<>();
+
+  /* sent, waiting for Server's answer */
+  private final HashSet<String> in_flight_ = new HashSet<>();
+
+  public DeleteQueue(FileManagerRemote remote_manager) {
+    remote_manager_ = remote_manager;
+    Thread sender = new Thread(this, "delete-queue");
+    sender.setDaemon(true);
+    sender.start();
+  }
+
+  public synchronized void Enqueue(String path) {
+    queued_.add(path);
+    notifyAll();
+  }
+
+  /* if the path is deleted locally but maybe not on Server yet */
+  public synchronized boolean IfTombstone(String path) {
+    return queued_.contains(path) || in_flight_.contains(path);
+  }
+
+  /* block until Server has answered the pending delete of this path */
+  public synchronized void Await(String path) throws InterruptedException {
+    while (IfTombstone(path)) {
+      wait();
+    }
+  }
+
+  @Override
+  public void run() {
+    while (true) {
+      ArrayList<String> batch;
+      try {
+        batch = NextBatch();
+      } catch (InterruptedException e) {
+        return;
+      }
+      int[] codes = null;
+      for (int attempt = 0; attempt < FileChunk.MAX_RETRY && codes == null;
+           attempt++) {
+        try {
+          codes = remote_manager_.DeleteBatch(batch);
+        } catch (RemoteException e) {
+          e.printStackTrace();
+        }
+      }
+      for (int i = 0; i < batch.size(); i++) {
+        if (codes == null || codes[i] != SUCCESS) {
+          // the client was already told it succeeded, all we can do is log
+          System.out.printf("async unlink of %s failed with %d\n",
+                            batch.get(i), (codes == null) ? -1 : codes[i]);
+        }
+      }
+      synchronized (this) {
+        in_flight_.removeAll(batch);
+        notifyAll();
+      }
+    }
+  }
+
+  /* wait for work, then move up to MAX_BATCH queued paths to in flight */
+  private synchronized ArrayList<String> NextBatch()
+      throws InterruptedException {
+    while (queued_.isEmpty()) {
+      wait();
+    }
+    ArrayList<String> batch = new ArrayList<>();
+    Iterator<String> it = queued_.iterator();
+    while (it.hasNext() && batch.size() < MAX_BATCH) {
+      String path = it.next();
+      it.remove();
+      in_flight_.add(path);
+      batch.add(path);
+    }
+    return batch;
+  }
+}
@@ -8,6 +8,7 @@
  * */
 
 import java.io.Serializable;
+import java.util.zip.CRC32;
 
 /**
  * File Chunk used when uploading/downloading a large file from Server
@@ -17,17 +18,50 @@ public class FileChunk implements Serializable {
   /* 200KB tunable chunk size by default */
   public static Integer CHUNK_SIZE = 200 * 1024;
 
+  /* chunk_id of a chunk that does not belong to a chunked session */
+  public static final int NO_SESSION = -1;
+
+  /* consecutive failures before a transfer gives up resuming */
+  public static final int MAX_RETRY = 3;
+
   byte[] data = null;
   boolean end_of_file;
 
   Integer chunk_id;
+
+  /* where this chunk starts in the whole file, so a transfer can resume */
+  long offset;
+
+  /* CRC32 of data, checked by the receiver */
+  long checksum;
+
   FileChunk(byte[] data, boolean end_of_file, int chunk_id) {
+    this(data, end_of_file, chunk_id, 0);
+  }
+
+  FileChunk(byte[] data, boolean end_of_file, int chunk_id, long offset) {
     this.data = data;
     this.end_of_file = end_of_file;
     this.chunk_id = chunk_id;
+    this.offset = offset;
+    this.checksum = Checksum(data);
+  }
+
+  void SetData(byte[] data) {
+    this.data = data;
+    this.checksum = Checksum(data);
   }
 
-  void SetData(byte[] data) { this.data = data; }
+  /* if the data arrived the same as it was sent */
+  boolean IfIntact() { return data != null && checksum == Checksum(data); }
+
+  private static long Checksum(byte[] data) {
+    CRC32 crc = new CRC32();
+    if (data != null) {
+      crc.update(data);
+    }
+    return crc.getValue();
+  }
 
   void SetEndOfFile(boolean end_of_file) { this.end_of_file = end_of_file; }
 
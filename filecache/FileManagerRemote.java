@@ -13,6 +13,7 @@ import java.io.Serializable;
 import java.rmi.Remote;
 import java.rmi.RemoteException;
 import java.rmi.server.ServerNotActiveException;
+import java.util.ArrayList;
 
 /*
   The interface shared between Proxy and Server
@@ -23,15 +24,32 @@ public interface FileManagerRemote extends Remote {
 
   public ValidateResult Validate(ValidateParam param) throws RemoteException;
 
+  public SubtreeResult ValidateSubtree(String path, long since)
+      throws RemoteException;
+
   public FileChunk DownloadChunk(Integer chunk_id)
       throws RemoteException, IOException;
 
+  public FileChunk DownloadRange(String path, long timestamp, long offset)
+      throws RemoteException, IOException;
+
   public Long[] Upload(String path, FileChunk chunk)
       throws RemoteException, IOException;
 
-  public void UploadChunk(FileChunk chunk) throws RemoteException, IOException;
+  public Long UploadChunk(FileChunk chunk) throws RemoteException, IOException;
+
+  public long[] UploadBatch(ArrayList<String> paths,
+                            ArrayList<FileChunk> chunks)
+      throws RemoteException, IOException;
+
+  public long UploadOffset(Integer chunk_id) throws RemoteException;
 
   public void CancelChunk(Integer chunk_id) throws RemoteException;
 
   public int Delete(String path) throws RemoteException;
+
+  public int[] DeleteBatch(ArrayList<String> paths) throws RemoteException;
+
+  public void Subscribe(PushReceiverRemote receiver, ArrayList<String> prefixes)
+      throws RemoteException;
 }
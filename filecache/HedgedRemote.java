@@ -0,0 +1,222 @@
+/**
+ * file: HedgedRemote.java
+ * author: Yukun Jiang
+ * date: Mar 07
+ *
+ * Hedged requests against a set of Server endpoints serving the same files
+ *
+ * An idempotent request goes to the primary endpoint first. Once it has been
+ * outstanding longer than the p95 latency observed for that kind of request,
+ * a duplicate goes to the next replica, and whichever answers first is used.
+ * The late answer is handed to a release callback, so that anything it holds
+ * on its Server (e.g. a chunked download session) is given back
+ *
+ * Each Server counts timestamps on its own, so replicas must share one
+ * version source, e.g. be the same Server behind another address. Requests
+ * that continue a version, such as the ranges of one download, are sent
+ * only to the endpoint Answer names and never hedged
+ * */
+
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.Map;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.TimeoutException;
+import java.util.concurrent.atomic.AtomicInteger;
+import java.util.concurrent.atomic.AtomicLong;
+
+public class HedgedRemote {
+  /* one request against one endpoint */
+  public interface RemoteCall<T> {
+    T Call(FileManagerRemote manager) throws Exception;
+  }
+
+  /* give back whatever a late answer holds on the endpoint that sent it */
+  public interface Release<T> {
+    void Release(FileManagerRemote manager, T value) throws Exception;
+  }
+
+  /* the answer used, and the endpoint follow-up requests must go to */
+  public static class Answer<T> {
+    public final T value;
+    public final FileManagerRemote manager;
+
+    public Answer(T value, FileManagerRemote manager) {
+      this.value = value;
+      this.manager = manager;
+    }
+  }
+
+  /* latency window and hedge counters of one kind of request */
+  private static class LatencyTracker {
+    private static final int WINDOW = 256;
+
+    /* no hedging until this many latencies are known */
+    private static final int MIN_SAMPLES = 20;
+
+    /* the p95 is recomputed once every this many samples */
+    private static final int REFRESH = 16;
+
+    private static final double PERCENTILE = 0.95;
+
+    private final long[] samples_ns_ = new long[WINDOW];
+    private int count_ = 0;
+    private long p95_ns_ = 0;
+
+    public final AtomicLong calls_ = new AtomicLong();
+    public final AtomicLong hedges_ = new AtomicLong();
+    public final AtomicLong hedge_wins_ = new AtomicLong();
+
+    public synchronized void Record(long latency_ns) {
+      samples_ns_[count_ % WINDOW] = latency_ns;
+      count_++;
+      if (count_ >= MIN_SAMPLES && count_ % REFRESH == 0) {
+        long[] sorted = Arrays.copyOf(samples_ns_, Math.min(count_, WINDOW));
+        Arrays.sort(sorted);
+        p95_ns_ = sorted[(int)(sorted.length * PERCENTILE)];
+      }
+    }
+
+    /* 0 until enough latencies are known */
+    public synchronized long P95() { return p95_ns_; }
+  }
+
+  /* never hedge sooner than this, a duplicate costs the Server work too */
+  private static final long MIN_HEDGE_DELAY_NS =
+      TimeUnit.MILLISECONDS.toNanos(1);
+
+  private static final double PERCENT = 100.0;
+
+  private final FileManagerRemote primary_;
+  private final ArrayList<FileManagerRemote> replicas_ = new ArrayList<>();
+  private final AtomicInteger next_replica_ = new AtomicInteger();
+  private final Map<String, LatencyTracker> trackers_ =
+      new ConcurrentHashMap<>();
+
+  /* a request waiting for its hedge keeps running here */
+  private final ExecutorService executor_ =
+      Executors.newCachedThreadPool(runnable -> {
+        Thread thread = new Thread(runnable, "hedge");
+        thread.setDaemon(true);
+        return thread;
+      });
+
+  public HedgedRemote(FileManagerRemote primary) { primary_ = primary; }
+
+  /* must all be added before the first request */
+  public void AddReplica(FileManagerRemote replica) { replicas_.add(replica); }
+
+  public boolean IfHedging() { return !replicas_.isEmpty(); }
+
+  /**
+   * Issue an idempotent request, hedged to a replica if it runs late
+   * 'op' names the kind of request, each kind has its own p95
+   * 'release' may be null if a late answer holds nothing on its Server
+   */
+  @SuppressWarnings("unchecked")
+  public <T> Answer<T> Call(String op, RemoteCall<T> call, Release<T> release)
+      throws Exception {
+    if (replicas_.isEmpty()) {
+      return new Answer<>(call.Call(primary_), primary_);
+    }
+    LatencyTracker tracker =
+        trackers_.computeIfAbsent(op, key -> new LatencyTracker());
+    tracker.calls_.incrementAndGet();
+    long delay_ns = tracker.P95();
+    long start = System.nanoTime();
+    if (delay_ns == 0) {
+      // no idea what is late yet, just learn
+      Answer<T> answer = new Answer<>(call.Call(primary_), primary_);
+      tracker.Record(System.nanoTime() - start);
+      return answer;
+    }
+    CompletableFuture<Answer<T>> first = Submit(call, primary_);
+    // a late primary answer still counts, or the p95 would only ever shrink
+    first.whenComplete(
+        (answer, e) -> tracker.Record(System.nanoTime() - start));
+    try {
+      return first.get(Math.max(delay_ns, MIN_HEDGE_DELAY_NS),
+                       TimeUnit.NANOSECONDS);
+    } catch (TimeoutException e) {
+      // outstanding past the p95, hedge it
+    } catch (ExecutionException e) {
+      throw Unwrap(e);
+    }
+    tracker.hedges_.incrementAndGet();
+    FileManagerRemote replica = replicas_.get(
+        Math.floorMod(next_replica_.getAndIncrement(), replicas_.size()));
+    CompletableFuture<Answer<T>> second = Submit(call, replica);
+    Answer<T> winner;
+    try {
+      winner = (Answer<T>)CompletableFuture.anyOf(first, second).get();
+    } catch (ExecutionException e) {
+      // the faster one failed, the other one may still succeed
+      winner = Await(first.isCompletedExceptionally() ? second : first);
+    }
+    if (winner.manager == replica) {
+      tracker.hedge_wins_.incrementAndGet();
+    }
+    CompletableFuture<Answer<T>> loser =
+        (winner.manager == replica) ? first : second;
+    if (release != null) {
+      loser.thenAccept(answer -> {
+        try {
+          release.Release(answer.manager, answer.value);
+        } catch (Exception e) {
+          e.printStackTrace();
+        }
+      });
+    }
+    return winner;
+  }
+
+  /* one line per kind of request: hedge rate and how often the hedge won */
+  public String Stats() {
+    StringBuilder stats = new StringBuilder();
+    for (Map.Entry<String, LatencyTracker> entry : trackers_.entrySet()) {
+      LatencyTracker tracker = entry.getValue();
+      long calls = tracker.calls_.get();
+      long hedges = tracker.hedges_.get();
+      long wins = tracker.hedge_wins_.get();
+      stats.append(String.format(
+          "%s: calls=%d hedged=%d (%.2f%%) hedge_wins=%d (%.2f%%) p95=%.3fms\n",
+          entry.getKey(), calls, hedges,
+          (calls > 0) ? hedges * PERCENT / calls : 0, wins,
+          (hedges > 0) ? wins * PERCENT / hedges : 0, tracker.P95() / 1e6));
+    }
+    return stats.toString();
+  }
+
+  private <T> CompletableFuture<Answer<T>> Submit(RemoteCall<T> call,
+                                                  FileManagerRemote manager) {
+    CompletableFuture<Answer<T>> future = new CompletableFuture<>();
+    executor_.execute(() -> {
+      try {
+        future.complete(new Answer<>(call.Call(manager), manager));
+      } catch (Exception e) {
+        future.completeExceptionally(e);
+      }
+    });
+    return future;
+  }
+
+  private static <T> Answer<T> Await(CompletableFuture<Answer<T>> future)
+      throws Exception {
+    try {
+      return future.get();
+    } catch (ExecutionException e) {
+      throw Unwrap(e);
+    }
+  }
+
+  /* rethrow what the remote call itself threw, e.g. a RemoteException */
+  private static Exception Unwrap(ExecutionException e) {
+    Throwable cause = e.getCause();
+    return (cause instanceof Exception) ? (Exception)cause : e;
+  }
+}
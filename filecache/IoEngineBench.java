@@ -0,0 +1,156 @@
+/**
+ * file: IoEngineBench.java
+ * author: Yukun Jiang
+ * date: Mar 15
+ *
+ * This is a benchmark of the io_uring engine against the RandomAccessFile
+ * path Server uses otherwise, on concurrent whole-chunk reads of random
+ * offsets of files kept open, the way concurrent chunked downloads hit the
+ * disk
+ *
+ * Each thread count runs both paths for the same time over the same files,
+ * and reports reads per second and MB/s. Run it through 'make io_bench' so
+ * that the native library is built and on java.library.path
+ *
+ * usage: java IoEngineBench [num_files] [chunks_per_file] [seconds] [threads..]
+ * */
+
+import java.io.File;
+import java.io.IOException;
+import java.io.RandomAccessFile;
+import java.nio.ByteBuffer;
+import java.util.ArrayList;
+import java.util.Random;
+import java.util.concurrent.atomic.AtomicLong;
+
+public class IoEngineBench {
+  private static final String ROOT = "io_bench_root";
+
+  private static final int DEFAULT_NUM_FILES = 64;
+
+  private static final int DEFAULT_CHUNKS_PER_FILE = 16;
+
+  private static final int DEFAULT_SECONDS = 5;
+
+  private static final int[] DEFAULT_THREADS = {1, 4, 16, 64};
+
+  private interface ChunkReader {
+    int Read(RandomAccessFile file, long offset, int length)
+        throws IOException;
+  }
+
+  private static String FilePath(int i) { return ROOT + "/f" + i + ".bin"; }
+
+  /* the files every thread reads from, opened once like download sessions */
+  private static RandomAccessFile[] files_;
+
+  private static void BuildFiles(int num_files, int chunks_per_file)
+      throws IOException {
+    new File(ROOT).mkdirs();
+    byte[] chunk = new byte[FileChunk.CHUNK_SIZE];
+    new Random(15440).nextBytes(chunk);
+    for (int i = 0; i < num_files; i++) {
+      try (RandomAccessFile f = new RandomAccessFile(FilePath(i), "rw")) {
+        for (int c = 0; c < chunks_per_file; c++) {
+          f.write(chunk);
+        }
+      }
+    }
+    files_ = new RandomAccessFile[num_files];
+    for (int i = 0; i < num_files; i++) {
+      files_[i] = new RandomAccessFile(FilePath(i), "r");
+    }
+  }
+
+  /* a positional read without the engine, safe on a shared file */
+  private static int JavaRead(RandomAccessFile file, long offset, int length)
+      throws IOException {
+    ByteBuffer data = ByteBuffer.allocate(length);
+    int n;
+    do {
+      n = file.getChannel().read(data, offset + data.position());
+    } while (n > 0 && data.hasRemaining());
+    return data.position();
+  }
+
+  private static void Run(String name, ChunkReader reader, int threads,
+                          int num_files, int chunks_per_file, int seconds)
+      throws InterruptedException {
+    AtomicLong reads = new AtomicLong();
+    AtomicLong bytes = new AtomicLong();
+    long deadline = System.nanoTime() + seconds * 1_000_000_000L;
+    ArrayList<Thread> workers = new ArrayList<>();
+    for (int t = 0; t < threads; t++) {
+      long seed = t;
+      Thread worker = new Thread(() -> {
+        Random random = new Random(seed);
+        try {
+          while (System.nanoTime() < deadline) {
+            RandomAccessFile file = files_[random.nextInt(num_files)];
+            long offset =
+                (long)random.nextInt(chunks_per_file) * FileChunk.CHUNK_SIZE;
+            bytes.addAndGet(reader.Read(file, offset, FileChunk.CHUNK_SIZE));
+            reads.incrementAndGet();
+          }
+        } catch (IOException e) {
+          e.printStackTrace();
+        }
+      });
+      workers.add(worker);
+      worker.start();
+    }
+    for (Thread worker : workers) {
+      worker.join();
+    }
+    System.out.printf("%-8s threads=%-4d reads/s=%-10.0f MB/s=%.1f\n", name,
+                      threads, reads.get() / (double)seconds,
+                      bytes.get() / (double)seconds / (1 << 20));
+  }
+
+  private static void DeleteFiles(int num_files) throws IOException {
+    for (int i = 0; i < num_files; i++) {
+      if (files_ != null) {
+        files_[i].close();
+      }
+      new File(FilePath(i)).delete();
+    }
+    new File(ROOT).delete();
+  }
+
+  public static void main(String[] args) throws Exception {
+    int num_files =
+        (args.length > 0) ? Integer.parseInt(args[0]) : DEFAULT_NUM_FILES;
+    int chunks_per_file =
+        (args.length > 1) ? Integer.parseInt(args[1]) : DEFAULT_CHUNKS_PER_FILE;
+    int seconds =
+        (args.length > 2) ? Integer.parseInt(args[2]) : DEFAULT_SECONDS;
+    int[] threads = DEFAULT_THREADS;
+    if (args.length > 3) {
+      threads = new int[args.length - 3];
+      for (int i = 3; i < args.length; i++) {
+        threads[i - 3] = Integer.parseInt(args[i]);
+      }
+    }
+    UringEngine engine = UringEngine.Create();
+    if (engine == null) {
+      System.out.println("io_uring not available, only the Java path runs");
+    }
+    BuildFiles(num_files, chunks_per_file);
+    System.out.printf("%d files of %d chunks, %d s per run\n", num_files,
+                      chunks_per_file, seconds);
+    try {
+      for (int t : threads) {
+        Run("java", IoEngineBench::JavaRead, t, num_files, chunks_per_file,
+            seconds);
+        if (engine != null) {
+          Run("uring",
+              (file, offset, length) ->
+                  engine.Read(file, offset, length).length,
+              t, num_files, chunks_per_file, seconds);
+        }
+      }
+    } finally {
+      DeleteFiles(num_files);
+    }
+  }
+}
@@ -0,0 +1,260 @@
+/**
+ * file: LockProfiler.java
+ * author: Yukun Jiang
+ * date: Mar 18
+ *
+ * Contention profile of Server's per-file locks, cheap enough to stay on
+ *
+ * An uncontended acquire only bumps the global counters and histograms. A
+ * path gets its own wait and hold histograms, queue length and counters the
+ * first time someone has to wait for it, up to MAX_PATHS of them, so memory
+ * does not grow with the number of files. The longest holds are kept with
+ * the operation that held the lock. Dump(true) starts a new window for the
+ * per-path stats and the longest holds, the global counters keep running
+ * */
+
+import java.util.ArrayList;
+import java.util.HashMap;
+import java.util.Map;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.atomic.AtomicInteger;
+import java.util.concurrent.atomic.AtomicLongArray;
+import java.util.concurrent.atomic.LongAdder;
+
+public class LockProfiler {
+  /* log2 buckets of microseconds: <1us, <2us, <4us, .., the last is open */
+  private static final class Histogram {
+    private static final int BUCKETS = 26;
+
+    private final AtomicLongArray counts_ = new AtomicLongArray(BUCKETS);
+
+    public void Add(long ns) {
+      long us = ns / 1000;
+      int bucket = 64 - Long.numberOfLeadingZeros(us);
+      counts_.incrementAndGet(Math.min(bucket, BUCKETS - 1));
+    }
+
+    /* {"<1": n, "<2": n, ..} in microseconds, empty buckets left out */
+    public void AppendJson(StringBuilder json) {
+      json.append('{');
+      String separator = "";
+      for (int bucket = 0; bucket < BUCKETS; bucket++) {
+        long count = counts_.get(bucket);
+        if (count == 0) {
+          continue;
+        }
+        String bound = (bucket == BUCKETS - 1) ? ">=" + (1L << (bucket - 1))
+                                               : "<" + (1L << bucket);
+        json.append(separator)
+            .append('"')
+            .append(bound)
+            .append("\": ")
+            .append(count);
+        separator = ", ";
+      }
+      json.append('}');
+    }
+  }
+
+  /* one path that has been contended */
+  private static final class PathStats {
+    public final LongAdder acquires = new LongAdder();
+    public final LongAdder contended = new LongAdder();
+    public final LongAdder wait_ns = new LongAdder();
+    public final LongAdder hold_ns = new LongAdder();
+    public final Histogram wait = new Histogram();
+    public final Histogram hold = new Histogram();
+    /* threads blocked on the lock right now, and the most ever */
+    public final AtomicInteger queue = new AtomicInteger();
+    public final AtomicInteger max_queue = new AtomicInteger();
+  }
+
+  /* one of the longest holds */
+  private static final class Hold {
+    public final String path;
+    public final String op;
+    public final boolean write;
+    public final long hold_ns;
+    public final long released_ms = System.currentTimeMillis();
+
+    public Hold(String path, String op, boolean write, long hold_ns) {
+      this.path = path;
+      this.op = op;
+      this.write = write;
+      this.hold_ns = hold_ns;
+    }
+  }
+
+  private static final int MAX_PATHS = 4096;
+
+  private static final int TOP_PATHS = 20;
+
+  private static final int LONGEST_HOLDS = 16;
+
+  private final LongAdder acquires_ = new LongAdder();
+
+  private final LongAdder contended_ = new LongAdder();
+
+  /* contended acquires of paths that found MAX_PATHS already tracked */
+  private final LongAdder untracked_ = new LongAdder();
+
+  private final Histogram wait_ = new Histogram();
+
+  private final Histogram hold_ = new Histogram();
+
+  private volatile ConcurrentHashMap<String, PathStats> paths_ =
+      new ConcurrentHashMap<>();
+
+  /* sorted longest first, guarded by itself */
+  private final ArrayList<Hold> longest_ = new ArrayList<>();
+
+  /* the shortest hold in longest_ once it is full, to skip short ones fast */
+  private volatile long hold_floor_ns_ = 0;
+
+  /* the caller is about to block on the lock of 'path' */
+  public void Waiting(String path) {
+    PathStats stats = paths_.get(path);
+    if (stats == null) {
+      if (paths_.size() >= MAX_PATHS) {
+        untracked_.increment();
+        return;
+      }
+      stats = paths_.computeIfAbsent(path, k -> new PathStats());
+    }
+    int queue = stats.queue.incrementAndGet();
+    stats.max_queue.accumulateAndGet(queue, Math::max);
+  }
+
+  /* the lock of 'path' was granted after 'wait_ns', 'contended' if the
+     caller went through Waiting first */
+  public void Granted(String path, long wait_ns, boolean contended) {
+    acquires_.increment();
+    wait_.Add(wait_ns);
+    if (contended) {
+      contended_.increment();
+    }
+    PathStats stats = paths_.get(path);
+    if (stats == null) {
+      return;
+    }
+    stats.acquires.increment();
+    stats.wait_ns.add(wait_ns);
+    stats.wait.Add(wait_ns);
+    if (contended) {
+      stats.contended.increment();
+      // a window reset in between leaves a fresh queue at zero
+      stats.queue.updateAndGet(queue -> Math.max(queue - 1, 0));
+    }
+  }
+
+  /* the lock of 'path' was released by 'op' after 'hold_ns' */
+  public void Released(String path, String op, boolean write, long hold_ns) {
+    hold_.Add(hold_ns);
+    PathStats stats = paths_.get(path);
+    if (stats != null) {
+      stats.hold_ns.add(hold_ns);
+      stats.hold.Add(hold_ns);
+    }
+    if (hold_ns <= hold_floor_ns_) {
+      return;
+    }
+    synchronized (longest_) {
+      int i = 0;
+      while (i < longest_.size() && longest_.get(i).hold_ns >= hold_ns) {
+        i++;
+      }
+      if (i == LONGEST_HOLDS) {
+        return;
+      }
+      longest_.add(i, new Hold(path, op, write, hold_ns));
+      if (longest_.size() > LONGEST_HOLDS) {
+        longest_.remove(LONGEST_HOLDS);
+      }
+      if (longest_.size() == LONGEST_HOLDS) {
+        hold_floor_ns_ = longest_.get(LONGEST_HOLDS - 1).hold_ns;
+      }
+    }
+  }
+
+  /* the profile as one JSON object, then a new window if 'reset' */
+  public String Dump(boolean reset) {
+    ConcurrentHashMap<String, PathStats> paths = paths_;
+    ArrayList<Hold> longest;
+    synchronized (longest_) {
+      longest = new ArrayList<>(longest_);
+      if (reset) {
+        paths_ = new ConcurrentHashMap<>();
+        longest_.clear();
+        hold_floor_ns_ = 0;
+      }
+    }
+    StringBuilder json = new StringBuilder("{\n");
+    json.append("  \"acquires\": ")
+        .append(acquires_.sum())
+        .append(", \"contended\": ")
+        .append(contended_.sum())
+        .append(", \"tracked_paths\": ")
+        .append(paths.size())
+        .append(", \"untracked_contended\": ")
+        .append(untracked_.sum())
+        .append(",\n  \"wait_us\": ");
+    wait_.AppendJson(json);
+    json.append(",\n  \"hold_us\": ");
+    hold_.AppendJson(json);
+    json.append(",\n  \"top_contended\": [");
+    // sort on a snapshot, the sums keep moving meanwhile
+    HashMap<String, Long> wait_sums = new HashMap<>();
+    for (Map.Entry<String, PathStats> entry : paths.entrySet()) {
+      wait_sums.put(entry.getKey(), entry.getValue().wait_ns.sum());
+    }
+    ArrayList<Map.Entry<String, PathStats>> top =
+        new ArrayList<>(paths.entrySet());
+    top.sort((a, b) -> Long.compare(wait_sums.get(b.getKey()),
+                                    wait_sums.get(a.getKey())));
+    String separator = "\n";
+    for (Map.Entry<String, PathStats> entry :
+         top.subList(0, Math.min(TOP_PATHS, top.size()))) {
+      PathStats stats = entry.getValue();
+      json.append(separator)
+          .append("    {\"path\": ")
+          .append(ServerStats.Quote(entry.getKey()))
+          .append(", \"acquires\": ")
+          .append(stats.acquires.sum())
+          .append(", \"contended\": ")
+          .append(stats.contended.sum())
+          .append(", \"wait_us\": ")
+          .append(stats.wait_ns.sum() / 1000)
+          .append(", \"hold_us\": ")
+          .append(stats.hold_ns.sum() / 1000)
+          .append(", \"queue\": ")
+          .append(stats.queue.get())
+          .append(", \"max_queue\": ")
+          .append(stats.max_queue.get())
+          .append(",\n     \"wait_histogram\": ");
+      stats.wait.AppendJson(json);
+      json.append(", \"hold_histogram\": ");
+      stats.hold.AppendJson(json);
+      json.append('}');
+      separator = ",\n";
+    }
+    json.append("\n  ],\n  \"longest_holds\": [");
+    separator = "\n";
+    long now_ms = System.currentTimeMillis();
+    for (Hold hold : longest) {
+      json.append(separator)
+          .append("    {\"path\": ")
+          .append(ServerStats.Quote(hold.path))
+          .append(", \"op\": ")
+          .append(ServerStats.Quote(hold.op))
+          .append(", \"mode\": ")
+          .append(hold.write ? "\"write\"" : "\"read\"")
+          .append(", \"hold_us\": ")
+          .append(hold.hold_ns / 1000)
+          .append(", \"ago_ms\": ")
+          .append(now_ms - hold.released_ms)
+          .append('}');
+      separator = ",\n";
+    }
+    return json.append("\n  ]\n}\n").toString();
+  }
+}
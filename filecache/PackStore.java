@@ -0,0 +1,361 @@
+/**
+ * file: PackStore.java
+ * author: Yukun Jiang
+ * date: Mar 14
+ *
+ * Optional Server storage engine for small files: instead of one inode each,
+ * their contents are appended to large segment files and found through an
+ * in-memory index, so that serving one is a single pread from a hot segment.
+ * Large files stay plain files in the server root
+ *
+ * Segment record: [magic][path length][data length or TOMBSTONE][path][data]
+ * [crc32 of everything before]. On startup the segments are replayed in id
+ * order to rebuild the index, a torn record at the tail is cut off. Only the
+ * newest segment is appended to, older ones whose records are mostly dead are
+ * compacted in the background by copying their live records forward
+ *
+ * All appends and index changes happen under the store's monitor, so the
+ * order of records on disk is the order of index changes. Put and Remove
+ * return only once their record is on disk, since Server acknowledges the
+ * commit right after. Reads only look the
+ * path up and pread, retrying if compaction closed the segment under them
+ * */
+
+import java.io.File;
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.channels.ClosedChannelException;
+import java.nio.channels.FileChannel;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.StandardOpenOption;
+import java.util.ArrayList;
+import java.util.Map;
+import java.util.TreeMap;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.Executors;
+import java.util.concurrent.ScheduledExecutorService;
+import java.util.concurrent.TimeUnit;
+import java.util.zip.CRC32;
+
+public class PackStore {
+  private static final class Segment {
+    public final long id;
+    public final File file;
+    public final FileChannel channel;
+    public long size = 0;
+    /* bytes of the records the index still points to */
+    public long live_bytes = 0;
+
+    public Segment(long id, File file) throws IOException {
+      this.id = id;
+      this.file = file;
+      this.channel = FileChannel.open(
+          file.toPath(), StandardOpenOption.CREATE, StandardOpenOption.READ,
+          StandardOpenOption.WRITE);
+    }
+  }
+
+  /* where the newest content of a packed file is */
+  private static final class Entry {
+    public final Segment segment;
+    public final long record_offset;
+    public final int record_length;
+    public final long data_offset;
+    public final int data_length;
+
+    public Entry(Segment segment, long record_offset, int record_length,
+                 long data_offset, int data_length) {
+      this.segment = segment;
+      this.record_offset = record_offset;
+      this.record_length = record_length;
+      this.data_offset = data_offset;
+      this.data_length = data_length;
+    }
+  }
+
+  private static final int MAGIC = 0x50414b31;
+
+  private static final int TOMBSTONE = -1;
+
+  private static final int HEADER_SIZE = 12;
+
+  private static final int TRAILER_SIZE = 4;
+
+  private static final String SEGMENT_PREFIX = "segment-";
+
+  private static final long SEGMENT_BYTES = 64L << 20;
+
+  /* a sealed segment is compacted once this share of it is dead */
+  private static final double COMPACT_DEAD_RATIO = 0.5;
+
+  private static final long COMPACT_INTERVAL_MS = 1000;
+
+  private final File dir_;
+
+  private final int max_file_bytes_;
+
+  private final ConcurrentHashMap<String, Entry> index_ =
+      new ConcurrentHashMap<>();
+
+  /* id -> segment, guarded by this */
+  private final TreeMap<Long, Segment> segments_ = new TreeMap<>();
+
+  private Segment active_;
+
+  private final ScheduledExecutorService compactor_ =
+      Executors.newSingleThreadScheduledExecutor(runnable -> {
+        Thread thread = new Thread(runnable, "pack-compactor");
+        thread.setDaemon(true);
+        return thread;
+      });
+
+  /* open the segments under 'dir', files up to 'max_file_bytes' get packed */
+  public PackStore(String dir, int max_file_bytes) throws IOException {
+    dir_ = new File(dir);
+    dir_.mkdirs();
+    max_file_bytes_ = Math.min(max_file_bytes, FileChunk.CHUNK_SIZE);
+    TreeMap<Long, File> files = new TreeMap<>();
+    File[] listed = dir_.listFiles();
+    if (listed == null) {
+      throw new IOException("cannot list pack directory " + dir);
+    }
+    for (File f : listed) {
+      String name = f.getName();
+      if (name.startsWith(SEGMENT_PREFIX)) {
+        files.put(Long.parseLong(name.substring(SEGMENT_PREFIX.length())), f);
+      }
+    }
+    for (Map.Entry<Long, File> file : files.entrySet()) {
+      Segment segment = new Segment(file.getKey(), file.getValue());
+      segments_.put(segment.id, segment);
+      Replay(segment);
+    }
+    // keep appending to the newest segment if it has room left
+    Map.Entry<Long, Segment> newest = segments_.lastEntry();
+    active_ = (newest != null && newest.getValue().size < SEGMENT_BYTES)
+                  ? newest.getValue()
+                  : NewSegment();
+    compactor_.scheduleWithFixedDelay(this::Compact, COMPACT_INTERVAL_MS,
+                                      COMPACT_INTERVAL_MS,
+                                      TimeUnit.MILLISECONDS);
+  }
+
+  public boolean IfPackable(long size) { return size <= max_file_bytes_; }
+
+  public boolean Contains(String path) { return index_.containsKey(path); }
+
+  /* size of a packed file, -1 if not packed */
+  public long Size(String path) {
+    Entry entry = index_.get(path);
+    return (entry == null) ? -1 : entry.data_length;
+  }
+
+  /* every packed path right now */
+  public ArrayList<String> Paths() { return new ArrayList<>(index_.keySet()); }
+
+  /* the new content of 'path', replacing any older one */
+  public synchronized void Put(String path, byte[] data) throws IOException {
+    Kill(index_.put(path, Append(path, data)));
+    active_.channel.force(false);
+  }
+
+  /* 'path' is deleted or became a plain file */
+  public synchronized void Remove(String path) throws IOException {
+    if (index_.containsKey(path)) {
+      Append(path, null);
+      Kill(index_.remove(path));
+      active_.channel.force(false);
+    }
+  }
+
+  /* up to 'length' bytes of 'path' from 'offset', null if not packed */
+  public byte[] Read(String path, long offset, int length) throws IOException {
+    while (true) {
+      Entry entry = index_.get(path);
+      if (entry == null) {
+        return null;
+      }
+      long remain = Math.max(entry.data_length - offset, 0);
+      ByteBuffer buffer = ByteBuffer.allocate((int)Math.min(remain, length));
+      try {
+        ReadFully(entry.segment.channel, buffer, entry.data_offset + offset);
+        return buffer.array();
+      } catch (ClosedChannelException e) {
+        if (index_.get(path) == entry) {
+          throw e;
+        }
+        // compaction moved it meanwhile, look it up again
+      }
+    }
+  }
+
+  /* append one record to the active segment, a null 'data' is a tombstone */
+  private Entry Append(String path, byte[] data) throws IOException {
+    byte[] name = path.getBytes(StandardCharsets.UTF_8);
+    int data_length = (data == null) ? 0 : data.length;
+    int record_length = HEADER_SIZE + name.length + data_length + TRAILER_SIZE;
+    if (active_.size > 0 && active_.size + record_length > SEGMENT_BYTES) {
+      // forcing the new active segment then covers every record before
+      active_.channel.force(false);
+      active_ = NewSegment();
+    }
+    ByteBuffer record = ByteBuffer.allocate(record_length);
+    record.putInt(MAGIC);
+    record.putInt(name.length);
+    record.putInt((data == null) ? TOMBSTONE : data.length);
+    record.put(name);
+    if (data != null) {
+      record.put(data);
+    }
+    CRC32 crc = new CRC32();
+    crc.update(record.array(), 0, record.position());
+    record.putInt((int)crc.getValue());
+    record.flip();
+    long offset = active_.size;
+    while (record.hasRemaining()) {
+      active_.channel.write(record, offset + record.position());
+    }
+    active_.size += record_length;
+    if (data == null) {
+      return null;
+    }
+    active_.live_bytes += record_length;
+    return new Entry(active_, offset, record_length,
+                     offset + HEADER_SIZE + name.length, data.length);
+  }
+
+  /* the record an index change replaced is dead now */
+  private void Kill(Entry entry) {
+    if (entry != null) {
+      entry.segment.live_bytes -= entry.record_length;
+    }
+  }
+
+  private Segment NewSegment() throws IOException {
+    long id = segments_.isEmpty() ? 0 : segments_.lastKey() + 1;
+    String name = SEGMENT_PREFIX + String.format("%08d", id);
+    Segment segment = new Segment(id, new File(dir_, name));
+    segments_.put(id, segment);
+    return segment;
+  }
+
+  /* rebuild the index from one segment, cutting off a torn tail */
+  private void Replay(Segment segment) throws IOException {
+    long length = segment.channel.size();
+    long offset = 0;
+    ByteBuffer header = ByteBuffer.allocate(HEADER_SIZE);
+    while (offset + HEADER_SIZE + TRAILER_SIZE <= length) {
+      header.clear();
+      ReadFully(segment.channel, header, offset);
+      header.flip();
+      int magic = header.getInt();
+      int name_length = header.getInt();
+      int data_length = header.getInt();
+      int body_length = name_length + Math.max(data_length, 0);
+      if (magic != MAGIC || name_length <= 0 || data_length < TOMBSTONE ||
+          offset + HEADER_SIZE + body_length + TRAILER_SIZE > length) {
+        break;
+      }
+      ByteBuffer record =
+          ByteBuffer.allocate(HEADER_SIZE + body_length + TRAILER_SIZE);
+      ReadFully(segment.channel, record, offset);
+      CRC32 crc = new CRC32();
+      crc.update(record.array(), 0, HEADER_SIZE + body_length);
+      if (record.getInt(HEADER_SIZE + body_length) != (int)crc.getValue()) {
+        break;
+      }
+      String path = new String(record.array(), HEADER_SIZE, name_length,
+                               StandardCharsets.UTF_8);
+      int record_length = record.capacity();
+      if (data_length == TOMBSTONE) {
+        Kill(index_.remove(path));
+      } else {
+        segment.live_bytes += record_length;
+        Kill(index_.put(path,
+                        new Entry(segment, offset, record_length,
+                                  offset + HEADER_SIZE + name_length,
+                                  data_length)));
+      }
+      offset += record_length;
+    }
+    if (offset < length) {
+      // torn by a crash in the middle of an append
+      segment.channel.truncate(offset);
+    }
+    segment.size = offset;
+  }
+
+  /* compact the oldest sealed segment that is mostly dead, if any */
+  private void Compact() {
+    Segment victim = null;
+    synchronized (this) {
+      for (Segment segment : segments_.values()) {
+        if (segment != active_ && segment.size > 0 &&
+            segment.size - segment.live_bytes >=
+                COMPACT_DEAD_RATIO * segment.size) {
+          victim = segment;
+          break;
+        }
+      }
+    }
+    if (victim == null) {
+      return;
+    }
+    try {
+      CompactSegment(victim);
+    } catch (IOException e) {
+      e.printStackTrace();
+    }
+  }
+
+  /* copy the live records of 'victim' forward, then delete it */
+  private void CompactSegment(Segment victim) throws IOException {
+    long offset = 0;
+    ByteBuffer header = ByteBuffer.allocate(HEADER_SIZE);
+    while (offset < victim.size) {
+      header.clear();
+      ReadFully(victim.channel, header, offset);
+      header.flip();
+      header.getInt();
+      int name_length = header.getInt();
+      int data_length = header.getInt();
+      int body_length = name_length + Math.max(data_length, 0);
+      ByteBuffer body = ByteBuffer.allocate(body_length);
+      ReadFully(victim.channel, body, offset + HEADER_SIZE);
+      String path = new String(body.array(), 0, name_length,
+                               StandardCharsets.UTF_8);
+      synchronized (this) {
+        Entry entry = index_.get(path);
+        if (data_length != TOMBSTONE) {
+          if (entry != null && entry.segment == victim &&
+              entry.record_offset == offset) {
+            byte[] data = new byte[data_length];
+            System.arraycopy(body.array(), name_length, data, 0, data_length);
+            Kill(index_.put(path, Append(path, data)));
+          }
+        } else if (entry == null && segments_.firstKey() < victim.id) {
+          // an older segment may still hold what this tombstone deletes
+          Append(path, null);
+        }
+      }
+      offset += HEADER_SIZE + body_length + TRAILER_SIZE;
+    }
+    synchronized (this) {
+      // the copies must be on disk before their originals go
+      active_.channel.force(false);
+      segments_.remove(victim.id);
+    }
+    victim.channel.close();
+    victim.file.delete();
+  }
+
+  private static void ReadFully(FileChannel channel, ByteBuffer buffer,
+                                long position) throws IOException {
+    while (buffer.hasRemaining()) {
+      int n = channel.read(buffer, position + buffer.position());
+      if (n < 0) {
+        throw new IOException("unexpected end of pack segment");
+      }
+    }
+  }
+}
@@ -13,10 +13,10 @@
 import java.io.*;
 import java.nio.file.Paths;
 import java.rmi.Naming;
-import java.rmi.NotBoundException;
-import java.rmi.server.ServerNotActiveException;
+import java.util.ArrayList;
 import java.util.HashMap;
 import java.util.HashSet;
+import java.util.concurrent.CompletableFuture;
 
 /*
  The main driver for the Remote File Proxy
@@ -38,6 +38,17 @@ class Proxy {
 
   private static final int SUCCESS = 0;
 
+  /* optional tuning knobs are passed as -Dfilecache.<name>=<value> */
+  private static final String OPTION_PREFIX = "filecache.";
+
+  private static long GetLongOption(String name, long default_value) {
+    return Long.getLong(OPTION_PREFIX + name, default_value);
+  }
+
+  private static String GetStringOption(String name, String default_value) {
+    return System.getProperty(OPTION_PREFIX + name, default_value);
+  }
+
   private static class FileHandler implements FileHandling {
     private static final int EIO = -5;
     private final HashMap<Integer, RandomAccessFile> fd_filehandle_map_;
@@ -119,14 +130,26 @@ class Proxy {
                             file_handle.length();
         if (advance_size > 0) {
           // exceed the current size of file, need to reserve space from cache
-          // disk
-          boolean success = Cache.ReserveCacheSpace(advance_size, false);
-          if (!success) {
+          // disk, or move the writer's copy out of a full cache
+          RandomAccessFile grown =
+              cache.GrowWriter(fd, file_handle, advance_size);
+          if (grown == null) {
             // exceed storage limit
+            Cache.events_.Record(CacheEventRing.ENOMEM, cache.PathOf(fd),
+                                 advance_size, CacheEventRing.WRITE);
             return Errors.ENOMEM;
           }
+          // read and lseek of this fd go to the spilled copy from now on
+          file_handle = grown;
+          fd_filehandle_map_.put(fd, grown);
+        }
+        WriterStream stream = cache.StreamOf(fd);
+        if (stream != null) {
+          // may be streaming the written chunks to Server in the background
+          stream.Write(file_handle, buf);
+        } else {
+          file_handle.write(buf);
         }
-        file_handle.write(buf);
         return buf.length;
       } catch (Exception e) {
         e.printStackTrace();
@@ -213,26 +236,118 @@ class Proxy {
     }
   }
 
-  private static class FileHandlingFactory implements FileHandlingMaking {
+  /* package-private so that ProxyBench can drive FileHandlers directly */
+  static class FileHandlingFactory implements FileHandlingMaking {
     public FileHandling newclient() { return new FileHandler(); }
   }
 
-  public static void main(String[] args)
-      throws IOException, NotBoundException, ServerNotActiveException {
-    System.out.printf("Proxy Starts with port=%s and pin=%s\n",
-                      System.getenv("proxyport15440"),
-                      System.getenv("pin15440"));
+  /* what the first requests load, initialized while Proxy connects */
+  private static final String[] WARM_CLASSES = {
+      "Proxy$FileHandler", "FileChunk", "ValidateParam", "ValidateResult",
+      "CacheEvents$ValidateEvent", "CacheEvents$ChunkTransferEvent"};
+
+  /**
+   * Connect to Server and set up the shared cache from the command line
+   * "server_address server_port cache_dir cache_capacity" and the options,
+   * timing each step on 'timer'. Used by main and by ProxyBench
+   */
+  static void Init(String[] args, StartupTimer timer) throws Exception {
     String server_address = args[0];
     String server_port = args[1];
     String cache_dir = args[2];
     Long cache_capacity = Long.parseLong(args[3]);
     String server_lookup = Slash + Slash + server_address + Colon +
                            server_port + Slash + FileManagerRemote.SERVER_NAME;
-    FileManagerRemote remote_manager =
-        (FileManagerRemote)Naming.lookup(server_lookup);
-    Proxy.cache.SetCacheDirectory(cache_dir);
-    Proxy.cache.SetCacheCapacity(cache_capacity);
-    Proxy.cache.AddRemoteFileManager(remote_manager);
-    (new RPCreceiver(new FileHandlingFactory())).run();
+    // the lookups, the cache setup and the warm-up do not depend on each other
+    CompletableFuture<FileManagerRemote> connect =
+        timer.Async("connect", () -> {
+          FileManagerRemote manager =
+              (FileManagerRemote)Naming.lookup(server_lookup);
+          // the lookup only asks the registry, open the connection to Server
+          manager.UploadOffset(-1);
+          return manager;
+        });
+    // replicas of the Server, as "address:port,address:port"
+    String replicas = GetStringOption("replicas", "");
+    CompletableFuture<ArrayList<FileManagerRemote>> replica_connect =
+        timer.Async("replicas", () -> {
+          ArrayList<FileManagerRemote> managers = new ArrayList<>();
+          for (String replica : replicas.split(",")) {
+            if (!replica.isEmpty()) {
+              managers.add((FileManagerRemote)Naming.lookup(
+                  Slash + Slash + replica + Slash +
+                  FileManagerRemote.SERVER_NAME));
+            }
+          }
+          return managers;
+        });
+    CompletableFuture<Void> warm_up = timer.Async("warmup", () -> {
+      for (String name : WARM_CLASSES) {
+        Class.forName(name);
+      }
+      return null;
+    });
+    timer.Time("cache", () -> {
+      Proxy.cache.SetCacheDirectory(cache_dir);
+      Proxy.cache.SetCacheCapacity(cache_capacity);
+      // slower tiers below the cache directory, as "dir:capacity,dir:capacity"
+      String tiers = GetStringOption("tiers", "");
+      for (String tier : tiers.split(",")) {
+        int split = tier.lastIndexOf(Colon);
+        if (split > 0) {
+          Proxy.cache.AddCacheTier(tier.substring(0, split),
+                                   Long.parseLong(tier.substring(split + 1)));
+        }
+      }
+      return null;
+    });
+    Proxy.cache.AddRemoteFileManager(StartupTimer.Await(connect));
+    for (FileManagerRemote replica : StartupTimer.Await(replica_connect)) {
+      Proxy.cache.AddReplicaFileManager(replica);
+    }
+    if (!replicas.isEmpty()) {
+      Runtime.getRuntime().addShutdownHook(new Thread(
+          () -> System.out.print("Proxy hedging:\n" + cache.HedgeStats())));
+    }
+    ArrayList<String> subscriptions = new ArrayList<>();
+    for (String prefix : GetStringOption("subscribe", "").split(",")) {
+      if (!prefix.isEmpty()) {
+        subscriptions.add(Paths.get(prefix).normalize().toString());
+      }
+    }
+    if (!subscriptions.isEmpty()) {
+      Proxy.cache.Subscribe(subscriptions);
+    }
+    Proxy.cache.SetUploadBatching(GetLongOption("upload_batch_ms", 0));
+    Proxy.cache.SetStreamingUpload(GetLongOption("stream_interval_ms", 0));
+    Proxy.cache.SetAsyncUnlink(GetLongOption("async_unlink", 0) != 0);
+    Proxy.cache.SetColdCompression(GetLongOption("compress_age_ms", -1));
+    String spill_dir = GetStringOption("spill_dir", "");
+    if (!spill_dir.isEmpty()) {
+      Proxy.cache.SetSpillDirectory(
+          spill_dir, GetLongOption("spill_bytes", Long.MAX_VALUE));
+    }
+    Proxy.cache.SetSubtreeValidation(
+        GetLongOption("subtree_window_ms", 0),
+        (int)GetLongOption("subtree_depth", 1));
+    long events_port = GetLongOption("events_port", -1);
+    if (events_port >= 0) {
+      System.err.println("cache events on http://127.0.0.1:" +
+                         Proxy.cache.ServeEvents((int)events_port) +
+                         "/events");
+    }
+    StartupTimer.Await(warm_up);
+  }
+
+  public static void main(String[] args) throws Exception {
+    StartupTimer timer = new StartupTimer("Proxy");
+    System.out.printf("Proxy Starts with port=%s and pin=%s\n",
+                      System.getenv("proxyport15440"),
+                      System.getenv("pin15440"));
+    Init(args, timer);
+    RPCreceiver receiver = new RPCreceiver(new FileHandlingFactory());
+    timer.Report();
+    StartupTimer.ExitIfTraining();
+    receiver.run();
   }
 }
@@ -0,0 +1,184 @@
+/**
+ * file: ProxyBench.java
+ * author: Yukun Jiang
+ * date: Mar 17
+ *
+ * This is a standalone version of the LatencyTest and MoonShot workloads
+ * built into RPCreceiver, for any number of clients. Each client is its own
+ * FileHandler from Proxy.FileHandlingFactory on its own thread, driven
+ * directly instead of through the C library, so the reported time is
+ * Proxy-internal latency without the interposition and RPCreceiver overhead
+ *
+ * Scenarios, chosen by -Dfilecache.bench_scenario:
+ *   latency   every client opens, reads through and closes each file
+ *   moonshot  the same, while client 0 writes a new version of the first
+ *             file each iteration, as MoonShot2 does next to MoonShot1
+ *
+ * Per phase (open, read, close, and write/close of the writer) it prints the
+ * sample count, mean, p50, p99 and max in microseconds. 'file' is the whole
+ * open-read-close of one file. The first open of a file includes fetching it
+ * from Server, which shows in the max
+ *
+ * Other knobs: -Dfilecache.bench_clients (1), bench_iterations (100),
+ * bench_files (smallfile,mediumfile, as seen by clients) and
+ * bench_buffer (read size in bytes, 65536). The Proxy options apply as well
+ *
+ * usage: java ProxyBench server_address server_port cache_dir cache_capacity
+ * */
+
+import java.util.ArrayList;
+import java.util.Collections;
+import java.util.HashMap;
+import java.util.Map;
+import java.util.TreeMap;
+import java.util.concurrent.atomic.AtomicLong;
+
+public class ProxyBench {
+  private static final String LATENCY = "latency";
+
+  private static final String MOONSHOT = "moonshot";
+
+  private static final int WRITER = 0;
+
+  /* one client's samples, phase -> ns */
+  private static class Samples {
+    public final HashMap<String, ArrayList<Long>> phase_ns = new HashMap<>();
+
+    public void Add(String phase, long begin_ns) {
+      phase_ns.computeIfAbsent(phase, k -> new ArrayList<>())
+          .add(System.nanoTime() - begin_ns);
+    }
+  }
+
+  private static String scenario_;
+  private static int iterations_;
+  private static String[] files_;
+  private static int buffer_bytes_;
+  private static final AtomicLong errors_ = new AtomicLong();
+
+  /* open, read through and close 'path' as a reader */
+  private static void ReadFile(FileHandling client, String path,
+                               byte[] buffer, Samples samples) {
+    long file_begin = System.nanoTime();
+    long begin = System.nanoTime();
+    int fd = client.open(path, FileHandling.OpenOption.READ);
+    samples.Add("open", begin);
+    if (fd < 0) {
+      errors_.incrementAndGet();
+      return;
+    }
+    begin = System.nanoTime();
+    long n;
+    do {
+      n = client.read(fd, buffer);
+    } while (n > 0);
+    samples.Add("read", begin);
+    if (n < 0) {
+      errors_.incrementAndGet();
+    }
+    begin = System.nanoTime();
+    client.close(fd);
+    samples.Add("close", begin);
+    samples.Add("file", file_begin);
+  }
+
+  /* write version 'i' of 'path', the new version is sent to Server on close */
+  private static void WriteFile(FileHandling client, String path, int i,
+                                Samples samples) {
+    long begin = System.nanoTime();
+    int fd = client.open(path, FileHandling.OpenOption.WRITE);
+    samples.Add("open_write", begin);
+    if (fd < 0) {
+      errors_.incrementAndGet();
+      return;
+    }
+    begin = System.nanoTime();
+    if (client.write(fd, ("version" + i + "\n").getBytes()) < 0) {
+      errors_.incrementAndGet();
+    }
+    samples.Add("write", begin);
+    begin = System.nanoTime();
+    client.close(fd);
+    samples.Add("close_write", begin);
+  }
+
+  private static void RunClient(int id, FileHandling client, Samples samples) {
+    byte[] buffer = new byte[buffer_bytes_];
+    for (int i = 0; i < iterations_; i++) {
+      if (scenario_.equals(MOONSHOT) && id == WRITER) {
+        WriteFile(client, files_[0], i, samples);
+        continue;
+      }
+      for (String path : files_) {
+        ReadFile(client, path, buffer, samples);
+      }
+    }
+    client.clientdone();
+  }
+
+  private static double Us(long ns) { return ns / 1000.0; }
+
+  private static void Report(ArrayList<Samples> all, long wall_ns) {
+    TreeMap<String, ArrayList<Long>> merged = new TreeMap<>();
+    for (Samples samples : all) {
+      for (Map.Entry<String, ArrayList<Long>> phase :
+           samples.phase_ns.entrySet()) {
+        merged.computeIfAbsent(phase.getKey(), k -> new ArrayList<>())
+            .addAll(phase.getValue());
+      }
+    }
+    System.out.printf("%s: %d clients x %d iterations in %.1f ms, %d errors\n",
+                      scenario_, all.size(), iterations_, wall_ns / 1e6,
+                      errors_.get());
+    System.out.printf("%-12s %8s %10s %10s %10s %10s\n", "phase", "n",
+                      "mean_us", "p50_us", "p99_us", "max_us");
+    for (Map.Entry<String, ArrayList<Long>> phase : merged.entrySet()) {
+      ArrayList<Long> ns = phase.getValue();
+      Collections.sort(ns);
+      long sum = 0;
+      for (long sample : ns) {
+        sum += sample;
+      }
+      System.out.printf("%-12s %8d %10.1f %10.1f %10.1f %10.1f\n",
+                        phase.getKey(), ns.size(), Us(sum / ns.size()),
+                        Us(ns.get(ns.size() / 2)),
+                        Us(ns.get((int)(ns.size() * 0.99))),
+                        Us(ns.get(ns.size() - 1)));
+    }
+  }
+
+  public static void main(String[] args) throws Exception {
+    scenario_ = System.getProperty("filecache.bench_scenario", LATENCY);
+    if (!scenario_.equals(LATENCY) && !scenario_.equals(MOONSHOT)) {
+      System.err.println("unknown scenario " + scenario_);
+      System.exit(1);
+    }
+    int clients = Long.getLong("filecache.bench_clients", 1).intValue();
+    iterations_ = Long.getLong("filecache.bench_iterations", 100).intValue();
+    files_ = System.getProperty("filecache.bench_files", "smallfile,mediumfile")
+                 .split(",");
+    buffer_bytes_ = Long.getLong("filecache.bench_buffer", 65536).intValue();
+    Proxy.Init(args, new StartupTimer("ProxyBench"));
+
+    Proxy.FileHandlingFactory factory = new Proxy.FileHandlingFactory();
+    ArrayList<Samples> all = new ArrayList<>();
+    ArrayList<Thread> threads = new ArrayList<>();
+    for (int id = 0; id < clients; id++) {
+      int client_id = id;
+      FileHandling client = factory.newclient();
+      Samples samples = new Samples();
+      all.add(samples);
+      threads.add(new Thread(() -> RunClient(client_id, client, samples)));
+    }
+    long begin = System.nanoTime();
+    for (Thread thread : threads) {
+      thread.start();
+    }
+    for (Thread thread : threads) {
+      thread.join();
+    }
+    Report(all, System.nanoTime() - begin);
+    // RMI and background cache threads would keep the JVM up
+    System.exit(errors_.get() == 0 ? 0 : 1);
+  }
+}
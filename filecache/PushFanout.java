@@ -0,0 +1,138 @@
+/**
+ * file: PushFanout.java
+ * author: Yukun Jiang
+ * date: Mar 12
+ *
+ * Pushes the new versions of hot files to the proxies subscribed to them, in
+ * the background after a commit, so that their next open is a local hit
+ * instead of a burst of Validate + download from every proxy at once
+ *
+ * Each subscriber has its own queue of pending paths, where a newer commit of
+ * a path replaces the older one still waiting, and is drained no faster than
+ * the per-proxy rate limit. A proxy that subscribes again, e.g. after a
+ * reconnect, keeps its one queue and adds its prefixes to it. A subscriber
+ * whose push fails is dropped, the proxy then simply validates on open as
+ * before
+ * */
+
+import java.io.IOException;
+import java.rmi.RemoteException;
+import java.util.ArrayList;
+import java.util.Iterator;
+import java.util.LinkedHashMap;
+import java.util.Map;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.CopyOnWriteArrayList;
+import java.util.concurrent.Executors;
+import java.util.concurrent.ScheduledExecutorService;
+import java.util.concurrent.TimeUnit;
+
+public class PushFanout {
+  /* read the first range of 'path' at 'timestamp', null if replaced since */
+  public interface RangeLoader {
+    FileChunk Load(String path, long timestamp) throws IOException;
+  }
+
+  private class Subscriber implements Runnable {
+    public final PushReceiverRemote receiver;
+    public final CopyOnWriteArrayList<String> prefixes =
+        new CopyOnWriteArrayList<>();
+    /* proxy path -> newest committed timestamp not pushed yet */
+    private final LinkedHashMap<String, Long> pending_ = new LinkedHashMap<>();
+    private boolean scheduled_ = false;
+    private long next_push_ns_ = 0;
+
+    public Subscriber(PushReceiverRemote receiver) {
+      this.receiver = receiver;
+    }
+
+    public boolean IfSubscribed(String path) {
+      for (String prefix : prefixes) {
+        if (path.startsWith(prefix)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    public synchronized void Enqueue(String path, long timestamp) {
+      pending_.remove(path);
+      pending_.put(path, timestamp);
+      if (!scheduled_) {
+        scheduled_ = true;
+        long delay = Math.max(next_push_ns_ - System.nanoTime(), 0);
+        pusher_.schedule(this, delay, TimeUnit.NANOSECONDS);
+      }
+    }
+
+    /* push the oldest pending path, then wait out the rate limit */
+    @Override
+    public void run() {
+      Map.Entry<String, Long> next;
+      synchronized (this) {
+        Iterator<Map.Entry<String, Long>> it = pending_.entrySet().iterator();
+        next = it.next();
+        it.remove();
+      }
+      try {
+        FileChunk chunk = loader_.Load(next.getKey(), next.getValue());
+        if (chunk != null) {
+          receiver.Push(next.getKey(), next.getValue(), chunk);
+        }
+      } catch (RemoteException e) {
+        // the proxy is gone, it validates on open if it ever comes back
+        subscribers_.remove(receiver, this);
+        return;
+      } catch (IOException e) {
+        e.printStackTrace();
+      }
+      synchronized (this) {
+        next_push_ns_ = System.nanoTime() + interval_ns_;
+        if (pending_.isEmpty()) {
+          scheduled_ = false;
+        } else {
+          pusher_.schedule(this, interval_ns_, TimeUnit.NANOSECONDS);
+        }
+      }
+    }
+  }
+
+  private static final int PUSH_THREADS = 4;
+
+  private final RangeLoader loader_;
+
+  /* least time between two pushes to the same proxy */
+  private final long interval_ns_;
+
+  /* by receiver, whose stubs are equal when they refer to the same object */
+  private final ConcurrentHashMap<PushReceiverRemote, Subscriber>
+      subscribers_ = new ConcurrentHashMap<>();
+
+  private final ScheduledExecutorService pusher_ =
+      Executors.newScheduledThreadPool(PUSH_THREADS, runnable -> {
+        Thread thread = new Thread(runnable, "push-fanout");
+        thread.setDaemon(true);
+        return thread;
+      });
+
+  public PushFanout(RangeLoader loader, long pushes_per_second) {
+    loader_ = loader;
+    interval_ns_ = TimeUnit.SECONDS.toNanos(1) / Math.max(pushes_per_second, 1);
+  }
+
+  /* 'prefixes' are proxy-side paths, an empty prefix subscribes to all */
+  public void Subscribe(PushReceiverRemote receiver,
+                        ArrayList<String> prefixes) {
+    subscribers_.computeIfAbsent(receiver, k -> new Subscriber(receiver))
+        .prefixes.addAllAbsent(prefixes);
+  }
+
+  /* a new version of the proxy-side 'path' committed at 'timestamp' */
+  public void Committed(String path, long timestamp) {
+    for (Subscriber subscriber : subscribers_.values()) {
+      if (subscriber.IfSubscribed(path)) {
+        subscriber.Enqueue(path, timestamp);
+      }
+    }
+  }
+}
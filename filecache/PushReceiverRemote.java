@@ -0,0 +1,21 @@
+/**
+ * file: PushReceiverRemote.java
+ * author: Yukun Jiang
+ * date: Mar 12
+ *
+ * The callback a Proxy exports to Server when it subscribes to paths, so
+ * that Server pushes new versions of them without being asked
+ * */
+
+import java.rmi.Remote;
+import java.rmi.RemoteException;
+
+public interface PushReceiverRemote extends Remote {
+  /**
+   * A new version of 'path' committed on Server at 'timestamp'
+   * 'chunk' is its first range, with no session held on Server, the receiver
+   * downloads the rest range by range if it is not the end of file
+   */
+  public void Push(String path, long timestamp, FileChunk chunk)
+      throws RemoteException;
+}
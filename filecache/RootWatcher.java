@@ -0,0 +1,227 @@
+/**
+ * file: RootWatcher.java
+ * author: Yukun Jiang
+ * date: Mar 13
+ *
+ * Watches the Server root for files changed behind Server's back, e.g. by
+ * deploy tools, and has Server reconcile only the paths that changed instead
+ * of a full rescan on restart. Server's own commits are told apart by the
+ * file fingerprint it records, so they are not counted twice
+ *
+ * The kernel queue is bounded: if events overflow, the changes are unknown
+ * and the watcher falls back to a background rescan of the whole root,
+ * paced in batches so that it does not starve the RPCs
+ * */
+
+import java.io.File;
+import java.io.IOException;
+import java.nio.file.ClosedWatchServiceException;
+import java.nio.file.FileSystems;
+import java.nio.file.FileVisitResult;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.nio.file.Paths;
+import java.nio.file.SimpleFileVisitor;
+import java.nio.file.StandardWatchEventKinds;
+import java.nio.file.WatchEvent;
+import java.nio.file.WatchKey;
+import java.nio.file.WatchService;
+import java.nio.file.attribute.BasicFileAttributes;
+import java.util.ArrayList;
+import java.util.HashMap;
+import java.util.HashSet;
+
+public class RootWatcher implements Runnable {
+  /* what the watcher needs from Server, on server-side paths */
+  public interface Reconciler {
+    /* bring the version of 'path' in line with the file on disk */
+    void Reconcile(String path);
+
+    /* every file Server currently has a version for */
+    ArrayList<String> KnownFiles();
+  }
+
+  /* files reconciled by a rescan before it pauses */
+  private static final int RESCAN_BATCH = 512;
+
+  private static final long RESCAN_PAUSE_MS = 10;
+
+  private final Path root_;
+  private final Reconciler reconciler_;
+  private final WatchService watch_service_;
+  private final HashMap<WatchKey, Path> key_to_dir_ = new HashMap<>();
+  private final HashSet<Path> watched_dirs_ = new HashSet<>();
+
+  public RootWatcher(String root_dir, Reconciler reconciler)
+      throws IOException {
+    root_ = Paths.get(root_dir);
+    reconciler_ = reconciler;
+    watch_service_ = FileSystems.getDefault().newWatchService();
+    RegisterTree(root_);
+  }
+
+  /* watch in the background on a daemon thread */
+  public void Start() {
+    Thread thread = new Thread(this, "root-watcher");
+    thread.setDaemon(true);
+    thread.start();
+  }
+
+  @Override
+  public void run() {
+    while (true) {
+      WatchKey key;
+      try {
+        key = watch_service_.take();
+      } catch (InterruptedException | ClosedWatchServiceException e) {
+        return;
+      }
+      Path dir = key_to_dir_.get(key);
+      boolean overflow = false;
+      for (WatchEvent<?> event : key.pollEvents()) {
+        if (event.kind() == StandardWatchEventKinds.OVERFLOW) {
+          overflow = true;
+          continue;
+        }
+        if (dir != null) {
+          Changed(dir.resolve((Path)event.context()));
+        }
+      }
+      if (!key.reset()) {
+        // the directory is gone, its files were reported as deleted
+        key_to_dir_.remove(key);
+      }
+      if (overflow) {
+        Rescan();
+      }
+    }
+  }
+
+  /* one path under a watched directory was created, modified or deleted */
+  private void Changed(Path path) {
+    if (IfHidden(path)) {
+      // staging files of uploads in flight, and what the scan skips
+      return;
+    }
+    if (Files.isDirectory(path)) {
+      // its files may have appeared before it was watched
+      RegisterTree(path);
+      ReconcileTree(path, null);
+    } else if (watched_dirs_.remove(path)) {
+      // a directory moved or deleted as a whole, with no event per file
+      String prefix = Key(path) + File.separator;
+      for (String known : reconciler_.KnownFiles()) {
+        if (known.startsWith(prefix)) {
+          reconciler_.Reconcile(known);
+        }
+      }
+    } else {
+      reconciler_.Reconcile(Key(path));
+    }
+  }
+
+  /* the changes are unknown, reconcile every file on disk or known to Server
+   */
+  private void Rescan() {
+    RegisterTree(root_);
+    HashSet<String> seen = new HashSet<>();
+    ReconcileTree(root_, seen);
+    int reconciled = 0;
+    for (String path : reconciler_.KnownFiles()) {
+      if (!seen.contains(path)) {
+        // deleted while nobody was watching
+        reconciler_.Reconcile(path);
+        Pace(++reconciled);
+      }
+    }
+  }
+
+  /* reconcile every file under 'dir', adding each to 'seen' if given */
+  private void ReconcileTree(Path dir, HashSet<String> seen) {
+    int[] reconciled = {0};
+    try {
+      Files.walkFileTree(dir, new SimpleFileVisitor<Path>() {
+        @Override
+        public FileVisitResult preVisitDirectory(Path d,
+                                                 BasicFileAttributes attrs) {
+          return (!d.equals(root_) && IfHidden(d))
+              ? FileVisitResult.SKIP_SUBTREE
+              : FileVisitResult.CONTINUE;
+        }
+
+        @Override
+        public FileVisitResult visitFile(Path file, BasicFileAttributes attrs) {
+          if (attrs.isRegularFile() && !IfHidden(file)) {
+            String path = Key(file);
+            reconciler_.Reconcile(path);
+            if (seen != null) {
+              seen.add(path);
+            }
+            Pace(++reconciled[0]);
+          }
+          return FileVisitResult.CONTINUE;
+        }
+
+        @Override
+        public FileVisitResult visitFileFailed(Path file, IOException e) {
+          // vanished meanwhile, its delete event follows
+          return FileVisitResult.CONTINUE;
+        }
+      });
+    } catch (IOException e) {
+      e.printStackTrace();
+    }
+  }
+
+  /* watch 'dir' and every directory below it */
+  private void RegisterTree(Path dir) {
+    try {
+      Files.walkFileTree(dir, new SimpleFileVisitor<Path>() {
+        @Override
+        public FileVisitResult preVisitDirectory(Path d,
+                                                 BasicFileAttributes attrs)
+            throws IOException {
+          if (!d.equals(root_) && IfHidden(d)) {
+            return FileVisitResult.SKIP_SUBTREE;
+          }
+          WatchKey key = d.register(watch_service_,
+                                    StandardWatchEventKinds.ENTRY_CREATE,
+                                    StandardWatchEventKinds.ENTRY_DELETE,
+                                    StandardWatchEventKinds.ENTRY_MODIFY);
+          key_to_dir_.put(key, d);
+          watched_dirs_.add(d);
+          return FileVisitResult.CONTINUE;
+        }
+
+        @Override
+        public FileVisitResult visitFileFailed(Path file, IOException e) {
+          return FileVisitResult.CONTINUE;
+        }
+      });
+    } catch (IOException e) {
+      e.printStackTrace();
+    }
+  }
+
+  /* yield to the RPCs every RESCAN_BATCH files */
+  private static void Pace(int reconciled) {
+    if (reconciled % RESCAN_BATCH != 0) {
+      return;
+    }
+    try {
+      Thread.sleep(RESCAN_PAUSE_MS);
+    } catch (InterruptedException e) {
+      Thread.currentThread().interrupt();
+    }
+  }
+
+  /* the same format as Server.FormatPath */
+  private static String Key(Path path) {
+    return path.normalize().toString();
+  }
+
+  private static boolean IfHidden(Path path) {
+    Path name = path.getFileName();
+    return name != null && name.toString().startsWith(".");
+  }
+}
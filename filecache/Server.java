@@ -10,16 +10,29 @@
 import java.io.File;
 import java.io.IOException;
 import java.io.RandomAccessFile;
-import java.net.MalformedURLException;
+import java.nio.file.Files;
+import java.nio.file.Path;
 import java.nio.file.Paths;
+import java.nio.file.StandardCopyOption;
+import java.nio.file.attribute.BasicFileAttributes;
 import java.rmi.Naming;
 import java.rmi.RemoteException;
 import java.rmi.registry.*;
 import java.rmi.server.UnicastRemoteObject;
+import java.util.ArrayList;
 import java.util.HashMap;
-import java.util.concurrent.locks.ReadWriteLock;
+import java.util.LinkedHashMap;
+import java.util.Map;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.Executors;
+import java.util.concurrent.ScheduledExecutorService;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicInteger;
+import java.util.concurrent.atomic.AtomicLong;
 import java.util.concurrent.locks.ReentrantLock;
 import java.util.concurrent.locks.ReentrantReadWriteLock;
+import java.util.regex.Pattern;
 
 /* Remote File Server meeting session-semantics and check-on-use cache
  * consistent policy */
@@ -34,7 +47,7 @@ public class Server extends UnicastRemoteObject implements FileManagerRemote {
     private final int SUCCESS = 0;
     @Override
     public boolean IfExist(String path) {
-      return new File(path).exists();
+      return IfPacked(path) || new File(path).exists();
     }
 
     @Override
@@ -44,17 +57,17 @@ public class Server extends UnicastRemoteObject implements FileManagerRemote {
 
     @Override
     public boolean IfRegularFile(String path) {
-      return new File(path).isFile();
+      return IfPacked(path) || new File(path).isFile();
     }
 
     @Override
     public boolean IfCanRead(String path) {
-      return new File(path).canRead();
+      return IfPacked(path) || new File(path).canRead();
     }
 
     @Override
     public boolean IfCanWrite(String path) {
-      return new File(path).canWrite();
+      return IfPacked(path) || new File(path).canWrite();
     }
 
     /* server do checking for proxy, so that don't waste bandwidth transferring
@@ -132,40 +145,63 @@ public class Server extends UnicastRemoteObject implements FileManagerRemote {
     @Override
     public ValidateResult Validate(String path, FileHandling.OpenOption option,
                                    long timestamp) {
-      GrabLock(path, LOCK_MODE.READ); // lock in reader mode
+      // lock in reader mode
+      long grabbed_ns = GrabLock(path, LOCK_MODE.READ, VALIDATE_SITE);
       long server_file_timestamp =
           file_to_timestamp_map_.getOrDefault(path, SERVER_NO_EXIST);
       int error_code = ErrorCheck(path, option);
       ValidateResult res = new ValidateResult(error_code, IfDirectory(path),
                                               server_file_timestamp);
+      if (error_code == SUCCESS && server_file_timestamp != SERVER_NO_EXIST &&
+          !res.is_directory) {
+        // still under the reader lock, so no commit can slip in between
+        file_to_meta_map_.put(path, new FileMeta(server_file_timestamp,
+                                                 IfCanRead(path),
+                                                 IfCanWrite(path)));
+      }
       if (error_code == SUCCESS && server_file_timestamp != SERVER_NO_EXIST &&
           timestamp != server_file_timestamp) {
         // the server shall provide updated version to proxy
-        FileChunk chunk = LoadFile(path);
+        FileChunk chunk = LoadFile(path, grabbed_ns);
         res.CarryChunk(chunk);
       } else {
-        ReleaseLock(path, LOCK_MODE.READ);
+        ReleaseLock(path, LOCK_MODE.READ, VALIDATE_SITE, grabbed_ns);
       }
       return res;
     }
 
     /* Load a local file to be sent in chunk-by-chunk fashion */
-    public FileChunk LoadFile(String path) {
+    public FileChunk LoadFile(String path, long grabbed_ns) {
       try {
-        Integer chunk_id = file_chunk_id++;
+        Integer chunk_id = file_chunk_id.getAndIncrement();
+        if (IfPacked(path)) {
+          // one pread from its segment, a packed file is always one chunk
+          byte[] data = pack_store_.Read(ProxyPathOf(path), ZERO,
+                                         FileChunk.CHUNK_SIZE);
+          ReleaseLock(path, LOCK_MODE.READ, VALIDATE_SITE, grabbed_ns);
+          return new FileChunk(data, true, chunk_id);
+        }
         RandomAccessFile f = new RandomAccessFile(path, READER_MODE);
         Integer whole_file_size = (int)f.length();
         Integer max_chunk_size = FileChunk.CHUNK_SIZE;
         Integer chunk_size = Math.min(whole_file_size, max_chunk_size);
-        byte[] data = new byte[chunk_size];
-        f.read(data);
+        byte[] data;
+        if (io_engine_ != null) {
+          data = io_engine_.Read(f, ZERO, chunk_size);
+          f.seek(data.length);
+        } else {
+          data = new byte[chunk_size];
+          f.read(data);
+        }
         boolean is_end = (max_chunk_size >= whole_file_size);
         if (!is_end) {
-          file_download_chunk_map_.put(chunk_id, f);
           chunk_id_to_file_.put(chunk_id, path);
+          chunk_id_to_grabbed_ns_.put(chunk_id, grabbed_ns);
+          // published last, CancelChunk finds the rest once it sees this
+          file_download_chunk_map_.put(chunk_id, f);
         } else {
           f.close();
-          ReleaseLock(path, LOCK_MODE.READ);
+          ReleaseLock(path, LOCK_MODE.READ, VALIDATE_SITE, grabbed_ns);
         }
         return new FileChunk(data, is_end, chunk_id);
       } catch (Exception e) {
@@ -178,8 +214,10 @@ public class Server extends UnicastRemoteObject implements FileManagerRemote {
   /*
     grab the lock for a specific file in either reader/writer mode
     any modification on the file_to_lock_ map needs global synchronization
+    'site' names the hot path for the stats, return when the lock was granted
    */
-  private void GrabLock(String path, LOCK_MODE mode) {
+  private long GrabLock(String path, LOCK_MODE mode, String site) {
+    long begin_ns = System.nanoTime();
     if (!file_to_lock_.containsKey(path)) {
       mtx_.lock();
       try {
@@ -190,18 +228,38 @@ public class Server extends UnicastRemoteObject implements FileManagerRemote {
         mtx_.unlock();
       }
     }
+    ReentrantReadWriteLock rw_lock = file_to_lock_.get(path);
+    boolean contended;
     if (mode == LOCK_MODE.READ) {
-      file_to_lock_.get(path).readLock().lock();
+      // no tryLock(), it would barge ahead of queued writers and could starve
+      // commits. A reader blocks behind a writer holding or waiting for it
+      contended = rw_lock.isWriteLocked() || rw_lock.hasQueuedThreads();
+      if (contended) {
+        lock_profiler_.Waiting(path);
+      }
+      CacheEvents.Lock(rw_lock.readLock(), "file read", path);
     } else {
-      file_to_lock_.get(path).writeLock().lock();
+      contended = !rw_lock.writeLock().tryLock();
+      if (contended) {
+        lock_profiler_.Waiting(path);
+        CacheEvents.Lock(rw_lock.writeLock(), "file write", path);
+      }
     }
+    long grabbed_ns = System.nanoTime();
+    stats_.LockWaited(site, grabbed_ns - begin_ns);
+    lock_profiler_.Granted(path, grabbed_ns - begin_ns, contended);
+    return grabbed_ns;
   }
 
   /*
-    grab the lock for a specific file in either reader/writer mode
-    any modification on the file_to_lock_ map needs global synchronization
+    release the lock for a specific file in either reader/writer mode
+    'grabbed_ns' is what GrabLock returned, to account the hold time
    */
-  private void ReleaseLock(String path, LOCK_MODE mode) {
+  private void ReleaseLock(String path, LOCK_MODE mode, String site,
+                           long grabbed_ns) {
+    long hold_ns = System.nanoTime() - grabbed_ns;
+    stats_.LockHeld(site, hold_ns);
+    lock_profiler_.Released(path, site, mode == LOCK_MODE.WRITE, hold_ns);
     if (mode == LOCK_MODE.READ) {
       file_to_lock_.get(path).readLock().unlock();
     } else {
@@ -213,16 +271,98 @@ public class Server extends UnicastRemoteObject implements FileManagerRemote {
 
   private final ReentrantLock mtx_;
 
-  private final HashMap<String, ReadWriteLock> file_to_lock_;
+  private final HashMap<String, ReentrantReadWriteLock> file_to_lock_;
+
+  /* who waits for and holds which file lock, see LockProfiler */
+  private final LockProfiler lock_profiler_;
+
+  private final ConcurrentHashMap<Integer, String> chunk_id_to_file_;
+
+  /* download session -> when its file lock was granted */
+  private final ConcurrentHashMap<Integer, Long> chunk_id_to_grabbed_ns_;
+
+  /* commits of different paths run concurrently, each under its own lock */
+  private final ConcurrentHashMap<String, Long> file_to_timestamp_map_;
+
+  /* what the last full Validate of a file saw, so that up-to-date proxies are
+     answered without the file lock. Immutable, replaced as a whole */
+  private static final class FileMeta {
+    public final long timestamp;
+    public final boolean can_read;
+    public final boolean can_write;
+    public final long checked_ns = System.nanoTime();
+
+    public FileMeta(long timestamp, boolean can_read, boolean can_write) {
+      this.timestamp = timestamp;
+      this.can_read = can_read;
+      this.can_write = can_write;
+    }
+  }
+
+  private final ConcurrentHashMap<String, FileMeta> file_to_meta_map_;
+
+  /* batched chunk I/O through io_uring, null to use RandomAccessFile */
+  private UringEngine io_engine_ = null;
+
+  /* small files packed into segments, keyed by proxy-side path, null if off */
+  private PackStore pack_store_ = null;
+
+  private static final long DEFAULT_PACK_MAX_BYTES = 16 * 1024;
+
+  /* how long FastValidate trusts the permissions a full check saw, which
+     can change on disk without a new version unless RootWatcher reports it */
+  private volatile long meta_ttl_ns_ = TimeUnit.SECONDS.toNanos(1);
+
+  /* what each file on disk looked like when Server last versioned it, so
+     that RootWatcher tells changes made behind Server's back */
+  private final ConcurrentHashMap<String, String> file_to_fingerprint_map_;
+  private final AtomicInteger file_chunk_id = new AtomicInteger();
+  private final ConcurrentHashMap<Integer, RandomAccessFile>
+      file_download_chunk_map_;
+
+  /* upload sessions run without any file lock until they commit */
+  private final ConcurrentHashMap<Integer, RandomAccessFile>
+      file_upload_chunk_map_;
+
+  /* bytes of each upload session acknowledged so far, to resume from */
+  private final ConcurrentHashMap<Integer, Long> upload_offset_map_;
+
+  /* recently committed upload sessions -> timestamp they committed at
+   * so that a retried final chunk whose reply got lost is answered again
+   * guarded by itself */
+  private final LinkedHashMap<Integer, Long> committed_upload_map_;
+
+  private static final int MAX_COMMITTED_UPLOADS = 1024;
+
+  private static final String STAGING_SUFFIX = ".upload";
+
+  /* staging files as named by StagingPath, left over if Server stopped */
+  private static final Pattern STAGING_NAME =
+      Pattern.compile("\\..*" + Pattern.quote(STAGING_SUFFIX) + "\\d+");
+
+  /* upload session -> wall clock time in ms of its last chunk */
+  private final ConcurrentHashMap<Integer, Long> upload_touched_ms_map_;
+
+  /* upload sessions idle for this long are dropped with their staged data,
+     e.g. their proxy died, 0 keeps them forever */
+  private static final long DEFAULT_UPLOAD_IDLE_MS =
+      TimeUnit.MINUTES.toMillis(10);
 
-  private final HashMap<Integer, String> chunk_id_to_file_;
+  private final ScheduledExecutorService upload_reaper_ =
+      Executors.newSingleThreadScheduledExecutor(runnable -> {
+        Thread thread = new Thread(runnable, "upload-reaper");
+        thread.setDaemon(true);
+        return thread;
+      });
 
-  private final HashMap<String, Long> file_to_timestamp_map_;
-  private Integer file_chunk_id = 0;
-  private final HashMap<Integer, RandomAccessFile> file_download_chunk_map_;
+  /* newest modification epoch of every directory's whole subtree */
+  private final HashMap<String, Long> dir_to_epoch_map_;
 
-  private final HashMap<Integer, RandomAccessFile> file_upload_chunk_map_;
-  private long timestamp_ = 0;
+  /* per-directory epoch of each direct child, file or sub-directory */
+  private final HashMap<String, HashMap<String, Long>> dir_to_child_epoch_map_;
+
+  private final ReentrantLock epoch_mtx_;
+  private final AtomicLong timestamp_ = new AtomicLong();
   public final String READER_MODE = "r";
   public final String WRITER_MODE = "rw";
   private static final String Slash = "/";
@@ -231,6 +371,9 @@ public class Server extends UnicastRemoteObject implements FileManagerRemote {
 
   private final String root_dir_;
 
+  /* the root directory in the same format as FormatPath */
+  private final String root_key_;
+
   private final static int SUCCESS = 0;
   private static final int TIMESTAMP_INDEX = 0;
 
@@ -240,18 +383,74 @@ public class Server extends UnicastRemoteObject implements FileManagerRemote {
 
   private static final int TUPLE_SIZE = 2;
 
+  /* hot paths taking a file lock, as named in the stats */
+  private static final String VALIDATE_SITE = "validate";
+
+  private static final String DOWNLOAD_RANGE_SITE = "download range";
+
+  private static final String COMMIT_SITE = "commit";
+
+  private static final String DELETE_SITE = "delete";
+
+  private static final String WATCH_SITE = "watch";
+
   private final FileChecker checker_;
+
+  private final ServerStats stats_;
+
+  private final PushFanout pusher_;
+
+  private static final long DEFAULT_PUSH_RATE = 100;
   public Server(String root_dir) throws RemoteException {
     super(0);
     mtx_ = new ReentrantLock();
     file_to_lock_ = new HashMap<>();
-    chunk_id_to_file_ = new HashMap<>();
-    file_to_timestamp_map_ = new HashMap<>();
-    file_download_chunk_map_ = new HashMap<>();
-    file_upload_chunk_map_ = new HashMap<>();
+    chunk_id_to_file_ = new ConcurrentHashMap<>();
+    chunk_id_to_grabbed_ns_ = new ConcurrentHashMap<>();
+    file_to_timestamp_map_ = new ConcurrentHashMap<>();
+    file_to_fingerprint_map_ = new ConcurrentHashMap<>();
+    file_to_meta_map_ = new ConcurrentHashMap<>();
+    file_download_chunk_map_ = new ConcurrentHashMap<>();
+    file_upload_chunk_map_ = new ConcurrentHashMap<>();
+    upload_offset_map_ = new ConcurrentHashMap<>();
+    upload_touched_ms_map_ = new ConcurrentHashMap<>();
+    committed_upload_map_ = new LinkedHashMap<Integer, Long>() {
+      @Override
+      protected boolean removeEldestEntry(Map.Entry<Integer, Long> eldest) {
+        if (size() > MAX_COMMITTED_UPLOADS) {
+          upload_offset_map_.remove(eldest.getKey());
+          return true;
+        }
+        return false;
+      }
+    };
+    dir_to_epoch_map_ = new HashMap<>();
+    dir_to_child_epoch_map_ = new HashMap<>();
+    epoch_mtx_ = new ReentrantLock();
     root_dir_ = root_dir;
+    root_key_ = FormatPath("");
     checker_ = new ServerFileChecker();
+    stats_ = new ServerStats();
+    lock_profiler_ = new LockProfiler();
+    stats_.SetLockProfiler(lock_profiler_);
+    stats_.SetSessionCounters(() -> file_download_chunk_map_.size(),
+                              () -> file_upload_chunk_map_.size());
+    pusher_ = new PushFanout(
+        (path, timestamp) -> ReadRange(FormatPath(path), timestamp, ZERO),
+        Long.getLong("filecache.push_rate", DEFAULT_PUSH_RATE));
     InitScanVersion();
+    long upload_idle_ms =
+        Long.getLong("filecache.upload_idle_ms", DEFAULT_UPLOAD_IDLE_MS);
+    if (upload_idle_ms > ZERO) {
+      upload_reaper_.scheduleWithFixedDelay(
+          () -> DropIdleUploads(upload_idle_ms), upload_idle_ms,
+          upload_idle_ms / 2 + 1, TimeUnit.MILLISECONDS);
+    }
+  }
+
+  /* serve the load stats on a loopback port, return the port bound */
+  public int ServeStats(int port) throws IOException {
+    return stats_.Serve(port);
   }
 
   /*
@@ -267,7 +466,121 @@ public class Server extends UnicastRemoteObject implements FileManagerRemote {
     }
     FileHandling.OpenOption option = param.option;
     long validation_timestamp = param.proxy_timestamp;
-    return checker_.Validate(path, option, validation_timestamp);
+    stats_.Access(path);
+    ValidateResult res = FastValidate(path, option, validation_timestamp);
+    if (res != null) {
+      // most Validates end here, they count like any other request
+      stats_.Request(ZERO, ZERO);
+      return res;
+    }
+    res = checker_.Validate(path, option, validation_timestamp);
+    stats_.Request(ZERO, (res.chunk == null) ? ZERO : res.chunk.data.length);
+    return res;
+  }
+
+  /*
+    Answer a Validate from a proxy that is already up-to-date without the
+    file lock or the filesystem, from what the last full check saw
+    return null if it needs the full check: the versions differ, nothing is
+    known about the file, or the open could fail
+   */
+  private ValidateResult FastValidate(String path,
+                                      FileHandling.OpenOption option,
+                                      long timestamp) {
+    FileMeta meta = file_to_meta_map_.get(path);
+    if (meta == null || meta.timestamp != timestamp ||
+        System.nanoTime() - meta.checked_ns > meta_ttl_ns_) {
+      return null;
+    }
+    boolean allowed = false; // CREATE_NEW of an existing file always fails
+    if (option == FileHandling.OpenOption.READ) {
+      allowed = meta.can_read;
+    } else if (option == FileHandling.OpenOption.WRITE) {
+      allowed = meta.can_write;
+    } else if (option == FileHandling.OpenOption.CREATE) {
+      allowed = meta.can_read && meta.can_write;
+    }
+    return allowed ? new ValidateResult(SUCCESS, false, timestamp) : null;
+  }
+
+  /**
+   * RMI: Validate a whole directory subtree in one request
+   * if nothing under it changed since the proxy's epoch, all cached files the
+   * proxy confirmed at that epoch are still fresh. Otherwise the changed files
+   * are listed so that the proxy falls back to per-file validation of them only
+   */
+  @Override
+  public SubtreeResult ValidateSubtree(String path, long since)
+      throws RemoteException {
+    stats_.Request(ZERO, ZERO);
+    String dir = FormatPath(path);
+    if (dir.startsWith(BACKWARD)) {
+      // access out of root directory
+      return new SubtreeResult(SERVER_NO_EXIST);
+    }
+    epoch_mtx_.lock();
+    try {
+      Long epoch = dir_to_epoch_map_.get(dir);
+      if (epoch == null) {
+        // not a known directory, proxy cannot vouch for anything under it
+        return new SubtreeResult(SERVER_NO_EXIST);
+      }
+      SubtreeResult res = new SubtreeResult(epoch);
+      if (since >= ZERO && epoch > since) {
+        CollectChangedChildren(dir, Paths.get(path).normalize().toString(),
+                               since, res.changed);
+      }
+      return res;
+    } finally {
+      epoch_mtx_.unlock();
+    }
+  }
+
+  /*
+    Walk down only the directories whose epoch moved past 'since'
+    and gather the proxy-side path of every changed file
+   */
+  private void CollectChangedChildren(String dir, String proxy_dir, long since,
+                                      ArrayList<String> changed) {
+    HashMap<String, Long> children = dir_to_child_epoch_map_.get(dir);
+    if (children == null) {
+      return;
+    }
+    for (Map.Entry<String, Long> child : children.entrySet()) {
+      if (child.getValue() <= since) {
+        continue;
+      }
+      String name = child.getKey();
+      String child_path = dir.isEmpty() ? name : dir + Slash + name;
+      String proxy_path = proxy_dir.isEmpty() ? name : proxy_dir + Slash + name;
+      if (dir_to_child_epoch_map_.containsKey(child_path)) {
+        CollectChangedChildren(child_path, proxy_path, since, changed);
+      } else {
+        changed.add(proxy_path);
+      }
+    }
+  }
+
+  /*
+    A file is modified at 'epoch', propagate it to every directory
+    up the path chain until the root directory
+   */
+  private void BumpEpoch(String path, long epoch) {
+    epoch_mtx_.lock();
+    try {
+      String child = path;
+      while (!child.equals(root_key_) && !child.isEmpty()) {
+        Path parent_path = Paths.get(child).getParent();
+        String parent = (parent_path == null) ? "" : parent_path.toString();
+        String name = Paths.get(child).getFileName().toString();
+        dir_to_child_epoch_map_.computeIfAbsent(parent, k -> new HashMap<>())
+            .put(name, epoch);
+        dir_to_epoch_map_.merge(parent, epoch, Math::max);
+        child = parent;
+      }
+    } finally {
+      epoch_mtx_.unlock();
+    }
   }
 
   /*
@@ -284,71 +597,464 @@ public class Server extends UnicastRemoteObject implements FileManagerRemote {
     Integer file_remain_length = (int)(total_len - curr_pos);
     Integer max_chunk_size = FileChunk.CHUNK_SIZE;
     Integer chunk_size = Math.min(file_remain_length, max_chunk_size);
-    byte[] data = new byte[chunk_size];
-    f.read(data);
+    byte[] data;
+    if (io_engine_ != null) {
+      data = io_engine_.Read(f, curr_pos, chunk_size);
+      f.seek(curr_pos + data.length);
+    } else {
+      data = new byte[chunk_size];
+      f.read(data);
+    }
     boolean is_end = (max_chunk_size >= file_remain_length);
-    if (is_end) {
-      String full_path = chunk_id_to_file_.get(chunk_id);
-      file_download_chunk_map_.remove(chunk_id);
-      chunk_id_to_file_.remove(chunk_id);
-      ReleaseLock(full_path, LOCK_MODE.READ);
+    stats_.Request(ZERO, chunk_size);
+    if (is_end && file_download_chunk_map_.remove(chunk_id) != null) {
+      // a concurrent CancelChunk did not release it first
+      String full_path = chunk_id_to_file_.remove(chunk_id);
+      f.close();
+      ReleaseLock(full_path, LOCK_MODE.READ, VALIDATE_SITE,
+                  TakeGrabbedNs(chunk_id));
+    }
+    return new FileChunk(data, is_end, chunk_id, curr_pos);
+  }
+
+  /**
+   * RMI: Download one chunk of a specific version of a file from 'offset'
+   * stateless, so that a broken chunked download resumes from where it
+   * stopped instead of starting over. Return null if 'timestamp' is no longer
+   * the newest version of the file
+   */
+  @Override
+  public FileChunk DownloadRange(String path, long timestamp, long offset)
+      throws RemoteException, IOException {
+    stats_.Request(ZERO, ZERO);
+    FileChunk chunk = ReadRange(FormatPath(path), timestamp, offset);
+    if (chunk != null) {
+      stats_.BytesDown(chunk.data.length);
+    }
+    return chunk;
+  }
+
+  /*
+    Read one chunk of the server-side 'path' from 'offset' if its newest
+    version is still 'timestamp', for DownloadRange and pushes
+   */
+  private FileChunk ReadRange(String path, long timestamp, long offset)
+      throws IOException {
+    long grabbed_ns = GrabLock(path, LOCK_MODE.READ, DOWNLOAD_RANGE_SITE);
+    try {
+      if (file_to_timestamp_map_.getOrDefault(path, SERVER_NO_EXIST) !=
+          timestamp) {
+        // a newer version replaced it, the proxy has to start over
+        return null;
+      }
+      if (IfPacked(path)) {
+        String key = ProxyPathOf(path);
+        byte[] data = pack_store_.Read(key, offset, FileChunk.CHUNK_SIZE);
+        boolean is_end = (offset + data.length >= pack_store_.Size(key));
+        return new FileChunk(data, is_end, FileChunk.NO_SESSION, offset);
+      }
+      try (RandomAccessFile f = new RandomAccessFile(path, READER_MODE)) {
+        long file_remain_length = Math.max(f.length() - offset, ZERO);
+        int chunk_size =
+            (int)Math.min(file_remain_length, (long)FileChunk.CHUNK_SIZE);
+        byte[] data;
+        if (io_engine_ != null) {
+          data = io_engine_.Read(f, offset, chunk_size);
+        } else {
+          data = new byte[chunk_size];
+          f.seek(offset);
+          f.readFully(data);
+        }
+        boolean is_end = (FileChunk.CHUNK_SIZE >= file_remain_length);
+        return new FileChunk(data, is_end, FileChunk.NO_SESSION, offset);
+      }
+    } finally {
+      ReleaseLock(path, LOCK_MODE.READ, DOWNLOAD_RANGE_SITE, grabbed_ns);
     }
-    return new FileChunk(data, is_end, chunk_id);
   }
 
   /**
    * RMI: Upload a file to the server side, requested by proxy
    * may subsequentlly call upload_chunk if too big a file
+   *
+   * the new content is staged aside and only replaces the file when the
+   * last chunk arrives, so a broken upload can resume and readers never
+   * see a half-written file
    */
   @Override
   public Long[] Upload(String path, FileChunk chunk)
       throws RemoteException, IOException {
     path = FormatPath(path);
-    GrabLock(path, LOCK_MODE.WRITE);
-    Long chunk_id = (long)file_chunk_id++;
-    RandomAccessFile file = new RandomAccessFile(path, WRITER_MODE);
+    stats_.Request(chunk.data.length, ZERO);
+    stats_.Access(path);
+    if (!chunk.IfIntact()) {
+      throw new IOException("corrupted first chunk of " + path);
+    }
+    Long chunk_id = (long)file_chunk_id.getAndIncrement();
+    String staging_path = StagingPath(path, chunk_id.intValue());
+    RandomAccessFile file = new RandomAccessFile(staging_path, WRITER_MODE);
     // clear the content of the file if existing
     file.setLength(ZERO);
     file.write(chunk.data);
+    Long[] tuple = new Long[TUPLE_SIZE];
+    tuple[CHUNK_INDEX] = chunk_id;
     if (chunk.end_of_file) {
       file.close();
-      ReleaseLock(path, LOCK_MODE.WRITE);
+      tuple[TIMESTAMP_INDEX] = CommitUpload(path, staging_path);
     } else {
-      file_upload_chunk_map_.put(chunk_id.intValue(), file);
       chunk_id_to_file_.put(chunk_id.intValue(), path);
+      upload_offset_map_.put(chunk_id.intValue(), (long)chunk.data.length);
+      upload_touched_ms_map_.put(chunk_id.intValue(),
+                                 System.currentTimeMillis());
+      // published last, the other maps are set once a chunk finds this
+      file_upload_chunk_map_.put(chunk_id.intValue(), file);
+      tuple[TIMESTAMP_INDEX] = SERVER_NO_EXIST;
     }
-    file_to_timestamp_map_.put(path, ++timestamp_);
-    Long[] tuple = new Long[TUPLE_SIZE];
-    tuple[TIMESTAMP_INDEX] = timestamp_;
-    tuple[CHUNK_INDEX] = chunk_id;
     return tuple;
   }
 
+  /**
+   * RMI: Upload several whole small files in one request, each chunk must hold
+   * a complete file. Every file is staged and committed on its own
+   * return the new timestamp of each file, SERVER_NO_EXIST where it failed
+   */
+  @Override
+  public long[] UploadBatch(ArrayList<String> paths,
+                            ArrayList<FileChunk> chunks)
+      throws RemoteException, IOException {
+    long bytes_up = ZERO;
+    for (FileChunk chunk : chunks) {
+      bytes_up += chunk.data.length;
+    }
+    stats_.Request(bytes_up, ZERO);
+    long[] timestamps = new long[paths.size()];
+    for (int i = 0; i < timestamps.length; i++) {
+      timestamps[i] = SERVER_NO_EXIST;
+      String path = FormatPath(paths.get(i));
+      stats_.Access(path);
+      FileChunk chunk = chunks.get(i);
+      if (!chunk.IfIntact() || !chunk.end_of_file) {
+        continue;
+      }
+      String staging_path = StagingPath(path, file_chunk_id.getAndIncrement());
+      try {
+        try (RandomAccessFile file =
+                 new RandomAccessFile(staging_path, WRITER_MODE)) {
+          file.setLength(ZERO);
+          file.write(chunk.data);
+        }
+        timestamps[i] = CommitUpload(path, staging_path);
+      } catch (IOException e) {
+        // only this file fails, its proxy uploads it again on its own
+        e.printStackTrace();
+        new File(staging_path).delete();
+      }
+    }
+    return timestamps;
+  }
+
   /**
    * Upload the specific chunk of a large file from Proxy to Server
+   * return the new timestamp once the last chunk commits the file,
+   * SERVER_NO_EXIST before that
    */
   @Override
-  public void UploadChunk(FileChunk chunk) throws RemoteException, IOException {
-    String full_path = chunk_id_to_file_.get(chunk.chunk_id);
+  public Long UploadChunk(FileChunk chunk) throws RemoteException, IOException {
+    stats_.Request(chunk.data.length, ZERO);
+    if (!chunk.IfIntact()) {
+      throw new IOException("corrupted chunk at offset " + chunk.offset);
+    }
     RandomAccessFile f = file_upload_chunk_map_.get(chunk.chunk_id);
-    f.write(chunk.data);
-    if (chunk.end_of_file) {
+    if (f == null) {
+      Long committed;
+      synchronized (committed_upload_map_) {
+        committed = committed_upload_map_.get(chunk.chunk_id);
+      }
+      if (committed != null && chunk.end_of_file) {
+        // the proxy retries a last chunk whose reply got lost
+        return committed;
+      }
+      throw new IOException("unknown upload session " + chunk.chunk_id);
+    }
+    // one chunk of a session at a time, e.g. two retries of the same one
+    synchronized (f) {
+      Long acked = upload_offset_map_.get(chunk.chunk_id);
+      if (file_upload_chunk_map_.get(chunk.chunk_id) != f || acked == null) {
+        throw new IOException("upload session " + chunk.chunk_id +
+                              " was cancelled or expired");
+      }
+      upload_touched_ms_map_.put(chunk.chunk_id, System.currentTimeMillis());
+      if (chunk.offset != acked) {
+        if (chunk.offset + chunk.data.length <= acked && !chunk.end_of_file) {
+          // a retried chunk that already made it
+          return SERVER_NO_EXIST;
+        }
+        throw new IOException("upload session " + chunk.chunk_id +
+                              " expects offset " + acked);
+      }
+      if (io_engine_ != null) {
+        io_engine_.Write(f, chunk.offset, chunk.data);
+      } else {
+        f.seek(chunk.offset);
+        f.write(chunk.data);
+      }
+      upload_offset_map_.put(chunk.chunk_id, acked + chunk.data.length);
+      if (!chunk.end_of_file) {
+        return SERVER_NO_EXIST;
+      }
       file_upload_chunk_map_.remove(chunk.chunk_id);
-      chunk_id_to_file_.remove(chunk.chunk_id);
-      ReleaseLock(full_path, LOCK_MODE.WRITE); // writer unlock
+      upload_touched_ms_map_.remove(chunk.chunk_id);
+      f.close();
+    }
+    String full_path = chunk_id_to_file_.remove(chunk.chunk_id);
+    long timestamp =
+        CommitUpload(full_path, StagingPath(full_path, chunk.chunk_id));
+    synchronized (committed_upload_map_) {
+      committed_upload_map_.put(chunk.chunk_id, timestamp);
     }
+    return timestamp;
+  }
+
+  /*
+    Drop an upload session that was removed from file_upload_chunk_map_
+    its staged data never becomes visible
+   */
+  private void DropUpload(int chunk_id, RandomAccessFile upload) {
+    // wait for a chunk still being written to it
+    synchronized (upload) {
+      String full_path = chunk_id_to_file_.remove(chunk_id);
+      upload_offset_map_.remove(chunk_id);
+      upload_touched_ms_map_.remove(chunk_id);
+      try {
+        upload.close();
+      } catch (IOException e) {
+        e.printStackTrace();
+      }
+      new File(StagingPath(full_path, chunk_id)).delete();
+    }
+  }
+
+  /* drop upload sessions that got no chunk for 'idle_ms' */
+  private void DropIdleUploads(long idle_ms) {
+    long idle_before = System.currentTimeMillis() - idle_ms;
+    for (Map.Entry<Integer, Long> entry : upload_touched_ms_map_.entrySet()) {
+      if (entry.getValue() > idle_before) {
+        continue;
+      }
+      RandomAccessFile upload = file_upload_chunk_map_.remove(entry.getKey());
+      if (upload != null) {
+        DropUpload(entry.getKey(), upload);
+      }
+    }
+  }
+
+  /**
+   * RMI: How many bytes of an upload session Server has acknowledged
+   * a proxy whose chunk broke resumes from here, SERVER_NO_EXIST if the
+   * session is unknown and the upload has to start over
+   */
+  @Override
+  public long UploadOffset(Integer chunk_id) throws RemoteException {
+    stats_.Request(ZERO, ZERO);
+    return upload_offset_map_.getOrDefault(chunk_id, SERVER_NO_EXIST);
+  }
+
+  /*
+    The hidden file an upload session stages the new content in,
+    next to the target so that committing is an atomic rename
+   */
+  private String StagingPath(String path, int chunk_id) {
+    Path target = Paths.get(path);
+    String name = "." + target.getFileName() + STAGING_SUFFIX + chunk_id;
+    Path parent = target.getParent();
+    return (parent == null) ? name : parent.resolve(name).toString();
+  }
+
+  /*
+    Replace a file by its fully staged new content as a new version
+   */
+  private long CommitUpload(String path, String staging_path)
+      throws IOException {
+    long grabbed_ns = GrabLock(path, LOCK_MODE.WRITE, COMMIT_SITE);
+    long timestamp;
+    try {
+      File staging = new File(staging_path);
+      if (pack_store_ != null && pack_store_.IfPackable(staging.length())) {
+        pack_store_.Put(ProxyPathOf(path),
+                        Files.readAllBytes(staging.toPath()));
+        staging.delete();
+        // the packed copy replaces a plain one
+        Files.deleteIfExists(Paths.get(path));
+        file_to_fingerprint_map_.remove(path);
+      } else {
+        Files.move(Paths.get(staging_path), Paths.get(path),
+                   StandardCopyOption.ATOMIC_MOVE);
+        if (pack_store_ != null) {
+          // grew out of the pack store
+          pack_store_.Remove(ProxyPathOf(path));
+        }
+        file_to_fingerprint_map_.put(path, Fingerprint(path));
+      }
+      timestamp = timestamp_.incrementAndGet();
+      file_to_timestamp_map_.put(path, timestamp);
+      file_to_meta_map_.remove(path);
+      BumpEpoch(path, timestamp);
+    } finally {
+      ReleaseLock(path, LOCK_MODE.WRITE, COMMIT_SITE, grabbed_ns);
+    }
+    pusher_.Committed(ProxyPathOf(path), timestamp);
+    return timestamp;
+  }
+
+  /*
+    Pick up a change RootWatcher saw on the server-side 'path': a file that
+    differs from its fingerprint becomes a new version, a versioned file that
+    is gone is deleted. Server's own commits match their fingerprint
+   */
+  private void Reconcile(String path) {
+    long grabbed_ns = GrabLock(path, LOCK_MODE.WRITE, WATCH_SITE);
+    long timestamp;
+    try {
+      // e.g. a chmod, which leaves the fingerprint as it is
+      file_to_meta_map_.remove(path);
+      if (new File(path).isFile()) {
+        String fingerprint = Fingerprint(path);
+        if (fingerprint.equals(file_to_fingerprint_map_.get(path))) {
+          return;
+        }
+        if (IfPacked(path)) {
+          // a plain file written over a packed one wins
+          pack_store_.Remove(ProxyPathOf(path));
+        }
+        timestamp = timestamp_.incrementAndGet();
+        file_to_timestamp_map_.put(path, timestamp);
+        file_to_fingerprint_map_.put(path, fingerprint);
+        BumpEpoch(path, timestamp);
+      } else {
+        if (!IfPacked(path) && file_to_timestamp_map_.remove(path) != null) {
+          // a packed file has no plain file, e.g. the one it replaced
+          file_to_fingerprint_map_.remove(path);
+          BumpEpoch(path, timestamp_.incrementAndGet());
+        }
+        return;
+      }
+    } catch (IOException e) {
+      e.printStackTrace();
+      return;
+    } finally {
+      ReleaseLock(path, LOCK_MODE.WRITE, WATCH_SITE, grabbed_ns);
+    }
+    pusher_.Committed(ProxyPathOf(path), timestamp);
+  }
+
+  /**
+   * Do chunk reads and writes through io_uring if this machine allows it
+   * return false if it stays on RandomAccessFile. Call before serving
+   */
+  public boolean EnableUring(UringEngine engine) {
+    io_engine_ = engine;
+    return io_engine_ != null;
+  }
+
+  /* if the server-side 'path' lives in the pack store */
+  private boolean IfPacked(String path) {
+    return pack_store_ != null && pack_store_.Contains(ProxyPathOf(path));
+  }
+
+  /**
+   * Keep new small files in the segments of 'store' rather than as plain
+   * files, see PackStore. Call before serving
+   */
+  public void EnablePackStore(PackStore store) throws IOException {
+    pack_store_ = store;
+    for (String key : pack_store_.Paths()) {
+      String path = FormatPath(key);
+      if (new File(path).exists()) {
+        // written as a plain file while Server was down, that one wins
+        pack_store_.Remove(key);
+        continue;
+      }
+      long timestamp = timestamp_.getAndIncrement();
+      file_to_timestamp_map_.put(path, timestamp);
+      BumpEpoch(path, timestamp);
+    }
+  }
+
+  /* size, modification time and inode of a file, empty if it is gone */
+  private static String Fingerprint(String path) {
+    try {
+      BasicFileAttributes attrs =
+          Files.readAttributes(Paths.get(path), BasicFileAttributes.class);
+      return attrs.size() + Slash + attrs.lastModifiedTime() +
+          Slash + attrs.fileKey();
+    } catch (IOException e) {
+      return "";
+    }
+  }
+
+  /* watch the root for changes made behind Server's back, see RootWatcher */
+  public void WatchRoot() throws IOException {
+    // every permission change is reconciled from now on
+    meta_ttl_ns_ = Long.MAX_VALUE;
+    new RootWatcher(root_dir_, new RootWatcher.Reconciler() {
+      @Override
+      public void Reconcile(String path) {
+        Server.this.Reconcile(path);
+      }
+
+      @Override
+      public ArrayList<String> KnownFiles() {
+        return new ArrayList<>(file_to_fingerprint_map_.keySet());
+      }
+    }).Start();
+  }
+
+  /**
+   * RMI: Push the new versions of files under any of 'prefixes' to 'receiver'
+   * from now on, until a push to it fails
+   */
+  @Override
+  public void Subscribe(PushReceiverRemote receiver, ArrayList<String> prefixes)
+      throws RemoteException {
+    stats_.Request(ZERO, ZERO);
+    pusher_.Subscribe(receiver, prefixes);
   }
 
   /*
     When the proxy doesn't have enough space, send the cancel chunk request to
     actively unlock must be a reader lock, writer upload always succeed in terms
     of storage space
+    An upload session streamed by a writer that gave up is cancelled as well,
+    its staged data is dropped and never becomes visible
    */
   @Override
   public void CancelChunk(Integer chunk_id) throws RemoteException {
-    String full_path = chunk_id_to_file_.get(chunk_id);
-    chunk_id_to_file_.remove(chunk_id);
-    ReleaseLock(full_path, LOCK_MODE.READ);
+    stats_.Request(ZERO, ZERO);
+    RandomAccessFile upload = file_upload_chunk_map_.remove(chunk_id);
+    if (upload != null) {
+      DropUpload(chunk_id, upload);
+      return;
+    }
+    RandomAccessFile f = file_download_chunk_map_.remove(chunk_id);
+    if (f == null) {
+      // already finished or cancelled, e.g. a resuming proxy cancels again
+      return;
+    }
+    String full_path = chunk_id_to_file_.remove(chunk_id);
+    try {
+      f.close();
+    } catch (IOException e) {
+      e.printStackTrace();
+    }
+    ReleaseLock(full_path, LOCK_MODE.READ, VALIDATE_SITE,
+                TakeGrabbedNs(chunk_id));
+  }
+
+  /* when the file lock of download session 'chunk_id' was granted, now if
+     that is unknown so that the lock is released all the same */
+  private long TakeGrabbedNs(int chunk_id) {
+    Long grabbed_ns = chunk_id_to_grabbed_ns_.remove(chunk_id);
+    return (grabbed_ns != null) ? grabbed_ns : System.nanoTime();
   }
 
   /**
@@ -356,23 +1062,46 @@ public class Server extends UnicastRemoteObject implements FileManagerRemote {
    */
   @Override
   public int Delete(String path) throws RemoteException {
+    stats_.Request(ZERO, ZERO);
+    return DeleteFile(path);
+  }
+
+  /*
+    Delete one file for Delete or DeleteBatch
+   */
+  private int DeleteFile(String path) {
     path = FormatPath(path);
-    GrabLock(path, LOCK_MODE.WRITE);
+    stats_.Access(path);
+    long grabbed_ns = GrabLock(path, LOCK_MODE.WRITE, DELETE_SITE);
     try {
       File f = new File(path);
       if (!checker_.IfExist(path)) {
-        ReleaseLock(path, LOCK_MODE.WRITE);
+        ReleaseLock(path, LOCK_MODE.WRITE, DELETE_SITE, grabbed_ns);
         return FileHandling.Errors.ENOENT;
       }
       if (checker_.IfDirectory(path)) {
-        ReleaseLock(path, LOCK_MODE.WRITE);
+        ReleaseLock(path, LOCK_MODE.WRITE, DELETE_SITE, grabbed_ns);
         return FileHandling.Errors.EISDIR;
       }
-      boolean success = f.delete();
+      boolean success;
+      if (IfPacked(path)) {
+        try {
+          pack_store_.Remove(ProxyPathOf(path));
+          success = true;
+        } catch (IOException e) {
+          e.printStackTrace();
+          success = false;
+        }
+      } else {
+        success = f.delete();
+      }
       if (success) {
         file_to_timestamp_map_.remove(path);
+        file_to_meta_map_.remove(path);
+        file_to_fingerprint_map_.remove(path);
+        BumpEpoch(path, timestamp_.incrementAndGet());
       }
-      ReleaseLock(path, LOCK_MODE.WRITE);
+      ReleaseLock(path, LOCK_MODE.WRITE, DELETE_SITE, grabbed_ns);
       return (success) ? SUCCESS : FileHandling.Errors.EPERM;
     } catch (SecurityException e) {
       e.printStackTrace();
@@ -380,6 +1109,20 @@ public class Server extends UnicastRemoteObject implements FileManagerRemote {
     }
   }
 
+  /**
+   * RMI: Delete several files in one request, in the given order
+   * return the error code of each delete, as Delete would
+   */
+  @Override
+  public int[] DeleteBatch(ArrayList<String> paths) throws RemoteException {
+    stats_.Request(ZERO, ZERO);
+    int[] codes = new int[paths.size()];
+    for (int i = 0; i < codes.length; i++) {
+      codes[i] = DeleteFile(paths.get(i));
+    }
+    return codes;
+  }
+
   /**
    * Upon server starts, scan over the existing files in the service directory
    * and make initial versions for them
@@ -389,13 +1132,26 @@ public class Server extends UnicastRemoteObject implements FileManagerRemote {
     mtx_.lock();
     try {
       File root = new File(root_dir_);
-      ScanVersionHelper(
-          ((root.getName().equals(".")) ? "" : root.getName() + Slash), root);
+      // same key format as FormatPath so that scanned files can be validated
+      ScanVersionHelper((root_key_.isEmpty() ? "" : root_key_ + Slash), root);
     } finally {
       mtx_.unlock();
     }
   }
 
+  /*
+   * map a server-side file address back to the proxy-side file address
+   */
+  private String ProxyPathOf(String path) {
+    if (root_key_.isEmpty()) {
+      return path;
+    }
+    // the root directory itself has no separator after it
+    return (path.length() > root_key_.length())
+        ? path.substring(root_key_.length() + 1)
+        : "";
+  }
+
   /*
    * format a proxy-side file address to the server-side file address
    */
@@ -411,32 +1167,87 @@ public class Server extends UnicastRemoteObject implements FileManagerRemote {
   private void ScanVersionHelper(String previous_path, File directory) {
     // make sure the directory exist
     for (File f : directory.listFiles()) {
-      if (f.isFile() && !f.isHidden()) {
+      if (f.isFile() && STAGING_NAME.matcher(f.getName()).matches()) {
+        // an upload that never committed before Server stopped
+        f.delete();
+      } else if (f.isFile() && !f.isHidden()) {
         String full_path = previous_path + f.getName();
-        file_to_timestamp_map_.put(full_path, timestamp_++);
+        long timestamp = timestamp_.getAndIncrement();
+        file_to_timestamp_map_.put(full_path, timestamp);
+        file_to_fingerprint_map_.put(full_path, Fingerprint(full_path));
         file_to_lock_.put(full_path, new ReentrantReadWriteLock());
+        BumpEpoch(full_path, timestamp);
       } else if (f.isDirectory() && !f.isHidden()) {
         ScanVersionHelper(previous_path + f.getName() + Slash, f);
       }
     }
   }
 
-  public static void main(String[] args)
-      throws RemoteException, MalformedURLException {
+  public static void main(String[] args) throws Exception {
+    StartupTimer timer = new StartupTimer("Server");
     int port = Integer.parseInt(args[0]);
     String root_dir = args[1];
+    // only the scan has to finish before Naming.rebind, the rest runs beside
+    CompletableFuture<Registry> registry =
+        timer.Async("registry", () -> LocateRegistry.createRegistry(port));
+    CompletableFuture<UringEngine> engine =
+        (Long.getLong("filecache.io_uring", 0) != 0)
+            ? timer.Async("io_uring", UringEngine::Create)
+            : null;
+    String pack_dir = System.getProperty("filecache.pack_dir");
+    int pack_max_bytes =
+        Long.getLong("filecache.pack_max_bytes", DEFAULT_PACK_MAX_BYTES)
+            .intValue();
+    CompletableFuture<PackStore> pack_store =
+        (pack_dir != null)
+            ? timer.Async("pack", () -> new PackStore(pack_dir, pack_max_bytes))
+            : null;
+
+    // create our Server instance (first runs on a random port)
+    Server server = timer.Time("scan", () -> new Server(root_dir));
     try {
-      LocateRegistry.createRegistry(port);
+      StartupTimer.Await(registry);
     } catch (RemoteException e) {
       e.printStackTrace();
-      return;
+      // the Server object is exported already and would keep the JVM up
+      System.exit(1);
+    }
+    if (engine != null && !server.EnableUring(StartupTimer.Await(engine))) {
+      System.err.println("io_uring not available, using RandomAccessFile");
+    }
+    if (pack_store != null) {
+      try {
+        server.EnablePackStore(StartupTimer.Await(pack_store));
+      } catch (IOException e) {
+        e.printStackTrace();
+        // exported already like above, returning would leave it running
+        System.exit(1);
+      }
     }
-
-    // create our Server instance (first runs on a random port)
-    Server server = new Server(root_dir);
     // add reference to registry so clients can find it using name FileServer
     String address =
         "//127.0.0.1:" + args[0] + Slash + FileManagerRemote.SERVER_NAME;
-    Naming.rebind(address, server);
+    timer.Time("bind", () -> {
+      Naming.rebind(address, server);
+      return null;
+    });
+    if (Long.getLong("filecache.watch_root", 0) != 0) {
+      try {
+        server.WatchRoot();
+      } catch (IOException e) {
+        e.printStackTrace();
+      }
+    }
+    long stats_port = Long.getLong("filecache.stats_port", -1);
+    if (stats_port >= ZERO) {
+      try {
+        System.err.println("stats on http://127.0.0.1:" +
+                           server.ServeStats((int)stats_port) + "/stats");
+      } catch (IOException e) {
+        e.printStackTrace();
+      }
+    }
+    timer.Report();
+    StartupTimer.ExitIfTraining();
   }
 }
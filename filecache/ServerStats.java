@@ -0,0 +1,276 @@
+/**
+ * file: ServerStats.java
+ * author: Yukun Jiang
+ * date: Mar 11
+ *
+ * Server-wide load accounting, served as JSON on a loopback HTTP port
+ *   curl http://127.0.0.1:<stats_port>/stats
+ *
+ * It keeps, per proxy host, the number of requests and the bytes moved each
+ * way, the wait and hold time of the file locks per hot path, and the top-K
+ * hottest files. Files are counted in a count-min sketch, and only those whose
+ * estimate beats the coldest of the current top-K touch the heavy-hitter set,
+ * so that accounting a request is a handful of atomic adds
+ *
+ * With a LockProfiler set, its per-path profile is served next to it
+ *   curl http://127.0.0.1:<stats_port>/locks[?reset]
+ * */
+
+import com.sun.net.httpserver.HttpExchange;
+import com.sun.net.httpserver.HttpServer;
+import java.io.IOException;
+import java.io.OutputStream;
+import java.net.InetAddress;
+import java.net.InetSocketAddress;
+import java.nio.charset.StandardCharsets;
+import java.rmi.server.RemoteServer;
+import java.rmi.server.ServerNotActiveException;
+import java.util.ArrayList;
+import java.util.Map;
+import java.util.TreeMap;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.atomic.AtomicLongArray;
+import java.util.concurrent.atomic.LongAdder;
+import java.util.function.IntSupplier;
+
+public class ServerStats {
+  /* what one proxy host asked of Server */
+  private static class ProxyStats {
+    public final LongAdder requests = new LongAdder();
+    public final LongAdder bytes_up = new LongAdder();
+    public final LongAdder bytes_down = new LongAdder();
+  }
+
+  /* the file lock as taken by one hot path */
+  private static class LockStats {
+    public final LongAdder acquires = new LongAdder();
+    public final LongAdder wait_ns = new LongAdder();
+    public final LongAdder hold_ns = new LongAdder();
+  }
+
+  /* requests that did not come over RMI, e.g. the startup scan */
+  private static final String LOCAL_HOST = "local";
+
+  private static final int SKETCH_DEPTH = 4;
+
+  private static final int SKETCH_WIDTH = 4096;
+
+  private static final int TOP_K = 20;
+
+  private static final String STATS_PATH = "/stats";
+
+  /* '?reset' dumps and starts a new profiling window */
+  private static final String LOCKS_PATH = "/locks";
+
+  private final long start_ms_ = System.currentTimeMillis();
+
+  private final ConcurrentHashMap<String, ProxyStats> proxies_ =
+      new ConcurrentHashMap<>();
+
+  private final ConcurrentHashMap<String, LockStats> locks_ =
+      new ConcurrentHashMap<>();
+
+  /* count-min sketch of file accesses, row after row */
+  private final AtomicLongArray sketch_ =
+      new AtomicLongArray(SKETCH_DEPTH * SKETCH_WIDTH);
+
+  /* heavy hitters -> their estimated count, at most TOP_K of them */
+  private final ConcurrentHashMap<String, Long> top_ =
+      new ConcurrentHashMap<>();
+
+  /* the smallest estimate in top_ once it is full, to skip cold files fast */
+  private volatile long top_floor_ = 0;
+
+  private IntSupplier download_sessions_ = () -> 0;
+
+  private IntSupplier upload_sessions_ = () -> 0;
+
+  private HttpServer http_server_ = null;
+
+  private LockProfiler lock_profiler_ = null;
+
+  /* where the active chunk sessions are counted from */
+  public void SetSessionCounters(IntSupplier download_sessions,
+                                 IntSupplier upload_sessions) {
+    download_sessions_ = download_sessions;
+    upload_sessions_ = upload_sessions;
+  }
+
+  /* serve the contention profile of the file locks at LOCKS_PATH as well */
+  public void SetLockProfiler(LockProfiler lock_profiler) {
+    lock_profiler_ = lock_profiler;
+  }
+
+  /* one RPC from the calling proxy, moving 'bytes_up' and 'bytes_down' */
+  public void Request(long bytes_up, long bytes_down) {
+    ProxyStats proxy = proxies_.computeIfAbsent(CallerHost(),
+                                                k -> new ProxyStats());
+    proxy.requests.increment();
+    if (bytes_up > 0) {
+      proxy.bytes_up.add(bytes_up);
+    }
+    if (bytes_down > 0) {
+      proxy.bytes_down.add(bytes_down);
+    }
+  }
+
+  /* bytes sent back on a request already counted */
+  public void BytesDown(long bytes) {
+    proxies_.computeIfAbsent(CallerHost(), k -> new ProxyStats())
+        .bytes_down.add(bytes);
+  }
+
+  /* a request touching 'path', for the hottest files */
+  public void Access(String path) {
+    long estimate = Long.MAX_VALUE;
+    int hash = path.hashCode();
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+      int column = Math.floorMod(Mix(hash, row), SKETCH_WIDTH);
+      long count = sketch_.incrementAndGet(row * SKETCH_WIDTH + column);
+      estimate = Math.min(estimate, count);
+    }
+    if (estimate <= top_floor_ && !top_.containsKey(path)) {
+      return;
+    }
+    synchronized (top_) {
+      top_.put(path, estimate);
+      if (top_.size() > TOP_K) {
+        String coldest = null;
+        for (Map.Entry<String, Long> entry : top_.entrySet()) {
+          if (coldest == null || entry.getValue() < top_.get(coldest)) {
+            coldest = entry.getKey();
+          }
+        }
+        top_.remove(coldest);
+      }
+      if (top_.size() == TOP_K) {
+        top_floor_ = top_.values().stream().min(Long::compare).get();
+      }
+    }
+  }
+
+  /* a file lock of hot path 'site' was granted after waiting 'wait_ns' */
+  public void LockWaited(String site, long wait_ns) {
+    LockStats lock = locks_.computeIfAbsent(site, k -> new LockStats());
+    lock.acquires.increment();
+    lock.wait_ns.add(wait_ns);
+  }
+
+  /* a file lock of hot path 'site' was released after 'hold_ns' */
+  public void LockHeld(String site, long hold_ns) {
+    locks_.computeIfAbsent(site, k -> new LockStats()).hold_ns.add(hold_ns);
+  }
+
+  /* serve Dump() on the loopback interface, port 0 picks a free one */
+  public int Serve(int port) throws IOException {
+    http_server_ = HttpServer.create(
+        new InetSocketAddress(InetAddress.getLoopbackAddress(), port), 0);
+    http_server_.createContext(STATS_PATH,
+                               exchange -> Respond(exchange, Dump()));
+    if (lock_profiler_ != null) {
+      http_server_.createContext(LOCKS_PATH, exchange -> {
+        String query = exchange.getRequestURI().getQuery();
+        Respond(exchange, lock_profiler_.Dump(
+                              query != null && query.contains("reset")));
+      });
+    }
+    http_server_.start();
+    return http_server_.getAddress().getPort();
+  }
+
+  private static void Respond(HttpExchange exchange, String json)
+      throws IOException {
+    byte[] body = json.getBytes(StandardCharsets.UTF_8);
+    exchange.getResponseHeaders().set("Content-Type", "application/json");
+    exchange.sendResponseHeaders(200, body.length);
+    try (OutputStream out = exchange.getResponseBody()) {
+      out.write(body);
+    }
+  }
+
+  /* the whole snapshot as one JSON object */
+  public String Dump() {
+    StringBuilder json = new StringBuilder("{\n");
+    json.append("  \"uptime_ms\": ")
+        .append(System.currentTimeMillis() - start_ms_)
+        .append(",\n");
+    json.append("  \"sessions\": {\"download\": ")
+        .append(download_sessions_.getAsInt())
+        .append(", \"upload\": ")
+        .append(upload_sessions_.getAsInt())
+        .append("},\n");
+    json.append("  \"proxies\": {");
+    String separator = "\n";
+    for (Map.Entry<String, ProxyStats> entry :
+         new TreeMap<>(proxies_).entrySet()) {
+      ProxyStats proxy = entry.getValue();
+      json.append(separator)
+          .append("    ")
+          .append(Quote(entry.getKey()))
+          .append(": {\"requests\": ")
+          .append(proxy.requests.sum())
+          .append(", \"bytes_up\": ")
+          .append(proxy.bytes_up.sum())
+          .append(", \"bytes_down\": ")
+          .append(proxy.bytes_down.sum())
+          .append("}");
+      separator = ",\n";
+    }
+    json.append("\n  },\n  \"locks\": {");
+    separator = "\n";
+    for (Map.Entry<String, LockStats> entry :
+         new TreeMap<>(locks_).entrySet()) {
+      LockStats lock = entry.getValue();
+      json.append(separator)
+          .append("    ")
+          .append(Quote(entry.getKey()))
+          .append(": {\"acquires\": ")
+          .append(lock.acquires.sum())
+          .append(", \"wait_us\": ")
+          .append(lock.wait_ns.sum() / 1000)
+          .append(", \"hold_us\": ")
+          .append(lock.hold_ns.sum() / 1000)
+          .append("}");
+      separator = ",\n";
+    }
+    json.append("\n  },\n  \"top_files\": [");
+    ArrayList<Map.Entry<String, Long>> top;
+    synchronized (top_) {
+      top = new ArrayList<>(top_.entrySet());
+    }
+    top.sort((a, b) -> Long.compare(b.getValue(), a.getValue()));
+    separator = "\n";
+    for (Map.Entry<String, Long> entry : top) {
+      json.append(separator)
+          .append("    {\"path\": ")
+          .append(Quote(entry.getKey()))
+          .append(", \"estimate\": ")
+          .append(entry.getValue())
+          .append("}");
+      separator = ",\n";
+    }
+    return json.append("\n  ]\n}\n").toString();
+  }
+
+  /* the host of the proxy whose RMI call this thread serves */
+  private static String CallerHost() {
+    try {
+      return RemoteServer.getClientHost();
+    } catch (ServerNotActiveException e) {
+      return LOCAL_HOST;
+    }
+  }
+
+  /* an independent hash per sketch row */
+  private static int Mix(int hash, int row) {
+    long h = (hash & 0xffffffffL) * 0x9E3779B97F4A7C15L;
+    h += row * 0xBF58476D1CE4E5B9L;
+    h ^= (h >>> 31);
+    h *= 0x94D049BB133111EBL;
+    return (int)(h ^ (h >>> 29));
+  }
+
+  static String Quote(String s) {
+    return "\"" + s.replace("\\", "\\\\").replace("\"", "\\\"") + "\"";
+  }
+}
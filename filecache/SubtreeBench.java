@@ -0,0 +1,137 @@
+/**
+ * file: SubtreeBench.java
+ * author: Yukun Jiang
+ * date: Mar 02
+ *
+ * This is a benchmark of whole-subtree validation against per-file
+ * validation, on a generated tree of (by default) 100k files
+ *
+ * Server is driven in-process, so the reported time is the server-side cost
+ * only. The number of RPCs each mode needs is reported as well, together with
+ * an estimate of the total time under a given RPC round trip time
+ *
+ * usage: java SubtreeBench [num_files] [rtt_us]
+ * */
+
+import java.io.File;
+import java.io.FileOutputStream;
+import java.io.IOException;
+
+public class SubtreeBench {
+  private static final String ROOT = "subtree_bench_root";
+
+  private static final int DEFAULT_NUM_FILES = 100000;
+
+  private static final long DEFAULT_RTT_US = 200;
+
+  private static final int FILES_PER_DIR = 1000;
+
+  private static final int SUB_DIRS = 10;
+
+  private static final int CHANGED_FILES = 100;
+
+  private static final long NO_TIMESTAMP = -1;
+
+  private static final byte[] CONTENT = "subtree bench\n".getBytes();
+
+  private static long rtt_us_;
+
+  /* two levels of directories, so epochs really go up a path chain */
+  private static String FilePath(int i) {
+    int sub = i / FILES_PER_DIR;
+    return "t" + (sub / SUB_DIRS) + "/s" + (sub % SUB_DIRS) + "/f" + i + ".txt";
+  }
+
+  private static void BuildTree(int num_files) throws IOException {
+    for (int i = 0; i < num_files; i++) {
+      File f = new File(ROOT + "/" + FilePath(i));
+      f.getParentFile().mkdirs();
+      try (FileOutputStream out = new FileOutputStream(f)) {
+        out.write(CONTENT);
+      }
+    }
+  }
+
+  private static void DeleteTree(File f) {
+    File[] children = f.listFiles();
+    if (children != null) {
+      for (File child : children) {
+        DeleteTree(child);
+      }
+    }
+    f.delete();
+  }
+
+  private static void Report(String mode, long rpcs, long elapsed_ns) {
+    double elapsed_ms = elapsed_ns / 1e6;
+    double estimate_ms = elapsed_ms + rpcs * rtt_us_ / 1e3;
+    System.out.printf("%-28s rpcs=%-8d server_ms=%-10.2f est_ms@rtt=%.2f\n",
+                      mode, rpcs, elapsed_ms, estimate_ms);
+  }
+
+  public static void main(String[] args) throws Exception {
+    int num_files =
+        (args.length > 0) ? Integer.parseInt(args[0]) : DEFAULT_NUM_FILES;
+    rtt_us_ = (args.length > 1) ? Long.parseLong(args[1]) : DEFAULT_RTT_US;
+    DeleteTree(new File(ROOT));
+    long start = System.nanoTime();
+    BuildTree(num_files);
+    System.out.printf("built %d files in %.2f ms, assuming rtt=%dus\n",
+                      num_files, (System.nanoTime() - start) / 1e6, rtt_us_);
+
+    start = System.nanoTime();
+    Server server = new Server(ROOT);
+    Report("server start (scan)", 0, System.nanoTime() - start);
+
+    // cold pass: learn the timestamp of every file, as a fresh proxy would
+    long[] timestamps = new long[num_files];
+    start = System.nanoTime();
+    for (int i = 0; i < num_files; i++) {
+      ValidateResult res = server.Validate(new ValidateParam(
+          FilePath(i), FileHandling.OpenOption.READ, NO_TIMESTAMP));
+      timestamps[i] = res.timestamp;
+    }
+    Report("per-file validate (cold)", num_files, System.nanoTime() - start);
+
+    // warm pass: every file is already up-to-date
+    start = System.nanoTime();
+    for (int i = 0; i < num_files; i++) {
+      server.Validate(new ValidateParam(
+          FilePath(i), FileHandling.OpenOption.READ, timestamps[i]));
+    }
+    Report("per-file validate (warm)", num_files, System.nanoTime() - start);
+
+    long epoch = server.ValidateSubtree("", NO_TIMESTAMP).epoch;
+    start = System.nanoTime();
+    SubtreeResult unchanged = server.ValidateSubtree("", epoch);
+    Report("subtree validate (unchanged)", 1, System.nanoTime() - start);
+    if (unchanged.epoch != epoch || !unchanged.changed.isEmpty()) {
+      System.out.println("unexpected change reported on an unchanged tree");
+    }
+
+    // modify a few files spread across the tree, then revalidate
+    int changed_files = Math.min(CHANGED_FILES, num_files);
+    for (int i = 0; i < changed_files; i++) {
+      int victim = (int)((long)i * num_files / changed_files);
+      server.Upload(FilePath(victim), new FileChunk(CONTENT, true, -1));
+    }
+    start = System.nanoTime();
+    SubtreeResult changed = server.ValidateSubtree("", epoch);
+    for (String path : changed.changed) {
+      int i = Integer.parseInt(path.substring(path.lastIndexOf("/f") + 2,
+                                              path.lastIndexOf(".txt")));
+      server.Validate(new ValidateParam(path, FileHandling.OpenOption.READ,
+                                        timestamps[i]));
+    }
+    Report("subtree validate (" + changed.changed.size() + " changed)",
+           1 + changed.changed.size(), System.nanoTime() - start);
+    if (changed.changed.size() != changed_files) {
+      System.out.printf("expected %d changed files, server reported %d\n",
+                        changed_files, changed.changed.size());
+    }
+
+    DeleteTree(new File(ROOT));
+    // the exported RMI object keeps the JVM alive otherwise
+    System.exit(0);
+  }
+}
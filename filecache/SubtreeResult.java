@@ -0,0 +1,28 @@
+/**
+ * file: SubtreeResult.java
+ * author: Yukun Jiang
+ * date: Mar 02
+ *
+ * This is return value class from server back to proxy
+ * about the validation of a whole directory subtree
+ *
+ * every Upload/Delete bumps the epoch of all directories up the path chain,
+ * so an unchanged epoch vouches for every file under the subtree at once
+ * */
+
+import java.io.Serializable;
+import java.util.ArrayList;
+
+/* the aggregated return info when validating a subtree with server */
+public class SubtreeResult implements Serializable {
+  /* the newest modification epoch of the subtree, SERVER_NO_EXIST if unknown */
+  long epoch;
+
+  /* proxy-side paths of files changed or deleted since the proxy's epoch */
+  ArrayList<String> changed;
+
+  public SubtreeResult(long epoch) {
+    this.epoch = epoch;
+    this.changed = new ArrayList<>();
+  }
+}
@@ -0,0 +1,104 @@
+/**
+ * file: UploadBatcher.java
+ * author: Yukun Jiang
+ * date: Mar 09
+ *
+ * Groups the uploads of small closed files into one UploadBatch RPC
+ *
+ * The first close that finds no open batch leads one: it waits for the
+ * aggregation window (or until the batch is full) while later closes join,
+ * then sends the whole batch and hands every member its own timestamp.
+ * Server still commits each file atomically on its own
+ * */
+
+import java.io.IOException;
+import java.util.ArrayList;
+import java.util.concurrent.TimeUnit;
+
+public class UploadBatcher {
+  private static final int MAX_BATCH_FILES = 256;
+
+  private static final long MAX_BATCH_BYTES = 4L * FileChunk.CHUNK_SIZE;
+
+  private static class Batch {
+    public final ArrayList<String> paths = new ArrayList<>();
+    public final ArrayList<FileChunk> chunks = new ArrayList<>();
+    public long bytes = 0;
+    public boolean done = false;
+    /* null if the RPC failed altogether */
+    public long[] timestamps = null;
+  }
+
+  private final FileManagerRemote remote_manager_;
+  private final long window_ns_;
+
+  /* the batch new closes join, null if none is collecting */
+  private Batch open_batch_ = null;
+
+  public UploadBatcher(FileManagerRemote remote_manager, long window_ms) {
+    remote_manager_ = remote_manager;
+    window_ns_ = TimeUnit.MILLISECONDS.toNanos(window_ms);
+  }
+
+  /**
+   * Upload a whole file that fits in one chunk as part of a batch
+   * return the timestamp Server assigned, or null if the batch or this file
+   * failed, in which case the caller should upload it on its own
+   */
+  public Long Submit(String path, FileChunk chunk) throws InterruptedException {
+    Batch batch;
+    int index;
+    boolean leader;
+    synchronized (this) {
+      leader = (open_batch_ == null);
+      if (leader) {
+        open_batch_ = new Batch();
+      }
+      batch = open_batch_;
+      index = batch.paths.size();
+      batch.paths.add(path);
+      batch.chunks.add(chunk);
+      batch.bytes += chunk.data.length;
+      if (batch.paths.size() >= MAX_BATCH_FILES ||
+          batch.bytes >= MAX_BATCH_BYTES) {
+        // full, send it without waiting out the window
+        open_batch_ = null;
+        notifyAll();
+      }
+      if (leader) {
+        long deadline = System.nanoTime() + window_ns_;
+        long remain;
+        while (open_batch_ == batch &&
+               (remain = deadline - System.nanoTime()) > 0) {
+          TimeUnit.NANOSECONDS.timedWait(this, remain);
+        }
+        if (open_batch_ == batch) {
+          open_batch_ = null;
+        }
+      }
+    }
+    if (leader) {
+      long[] timestamps = null;
+      try {
+        timestamps = remote_manager_.UploadBatch(batch.paths, batch.chunks);
+      } catch (IOException e) {
+        e.printStackTrace();
+      }
+      synchronized (this) {
+        batch.timestamps = timestamps;
+        batch.done = true;
+        notifyAll();
+      }
+    }
+    synchronized (this) {
+      while (!batch.done) {
+        wait();
+      }
+      if (batch.timestamps == null ||
+          batch.timestamps[index] == Server.SERVER_NO_EXIST) {
+        return null;
+      }
+      return batch.timestamps[index];
+    }
+  }
+}
@@ -0,0 +1,218 @@
+/**
+ * file: UringEngine.java
+ * author: Yukun Jiang
+ * date: Mar 15
+ *
+ * Optional io_uring engine for Server's chunk reads and writes, backed by
+ * uring_engine.cpp through JNI
+ *
+ * Concurrent RMI threads hand their requests to one leader at a time, which
+ * sends everything queued so far as one native batch: one io_uring_enter for
+ * the lot instead of a blocking syscall each. Requests that arrive while a
+ * batch is in flight form the next one, so nobody waits on a timer
+ *
+ * Requests name a file the caller already has open, so a batch costs no
+ * open or close syscalls. Reads and writes loop until done, a short read
+ * only ends at end of file
+ *
+ * Create() returns null if the library is missing or the kernel refuses
+ * io_uring, and callers keep using RandomAccessFile. A ring that broke on
+ * an io_uring_enter error is not used again, the engine then does its I/O
+ * through FileChannel
+ * */
+
+import java.io.FileDescriptor;
+import java.io.IOException;
+import java.io.RandomAccessFile;
+import java.nio.ByteBuffer;
+import java.util.ArrayList;
+import java.util.Arrays;
+
+public class UringEngine {
+  private static final String LIBRARY = "filecache_uring";
+
+  private static final int RING_ENTRIES = 64;
+
+  /* a registered buffer holds one whole chunk */
+  private static final int POOL_BUFFERS = 64;
+
+  private static native long Open(int entries, int buffer_count,
+                                  int buffer_size);
+
+  private static native int BatchLimit(long handle);
+
+  /* false once the ring is broken */
+  private static native boolean Submit(long handle, FileDescriptor[] fds,
+                                       long[] offsets, byte[][] data,
+                                       boolean[] writes, int[] results);
+
+  private static class Request {
+    public final RandomAccessFile file;
+    public final long offset;
+    public final byte[] data;
+    public final boolean write;
+    public int result = 0;
+    public boolean done = false;
+
+    public Request(RandomAccessFile file, long offset, byte[] data,
+                   boolean write) {
+      this.file = file;
+      this.offset = offset;
+      this.data = data;
+      this.write = write;
+    }
+  }
+
+  private final long handle_;
+
+  private final int batch_limit_;
+
+  private final ArrayList<Request> queue_ = new ArrayList<>();
+
+  /* a leader is running a batch */
+  private boolean busy_ = false;
+
+  /* the ring failed with requests possibly in flight, see Submit */
+  private volatile boolean broken_ = false;
+
+  private UringEngine(long handle) {
+    handle_ = handle;
+    batch_limit_ = BatchLimit(handle);
+  }
+
+  /* the engine, or null to stay on the Java I/O path */
+  public static UringEngine Create() {
+    try {
+      System.loadLibrary(LIBRARY);
+    } catch (UnsatisfiedLinkError e) {
+      return null;
+    }
+    long handle = Open(RING_ENTRIES, POOL_BUFFERS, FileChunk.CHUNK_SIZE);
+    return (handle == 0) ? null : new UringEngine(handle);
+  }
+
+  /* up to 'length' bytes of 'file' from 'offset', shorter at end of file.
+     Leaves the file pointer where it is */
+  public byte[] Read(RandomAccessFile file, long offset, int length)
+      throws IOException {
+    byte[] data = new byte[length];
+    int filled = 0;
+    while (filled < length) {
+      Request request = new Request(file, offset + filled,
+                                    new byte[length - filled], false);
+      Execute(request);
+      if (request.result == 0) {
+        break;
+      }
+      System.arraycopy(request.data, 0, data, filled, request.result);
+      filled += request.result;
+    }
+    return (filled == length) ? data : Arrays.copyOf(data, filled);
+  }
+
+  /* all of 'data' into 'file' at 'offset'. Leaves the file pointer */
+  public void Write(RandomAccessFile file, long offset, byte[] data)
+      throws IOException {
+    int written = 0;
+    while (written < data.length) {
+      byte[] rest = (written == 0)
+                        ? data
+                        : Arrays.copyOfRange(data, written, data.length);
+      Request request = new Request(file, offset + written, rest, true);
+      Execute(request);
+      if (request.result == 0) {
+        throw new IOException("write made no progress at " + offset);
+      }
+      written += request.result;
+    }
+  }
+
+  private void Execute(Request request) throws IOException {
+    if (request.data.length > FileChunk.CHUNK_SIZE) {
+      throw new IOException("request larger than a chunk");
+    }
+    if (broken_) {
+      Fallback(request);
+      return;
+    }
+    ArrayList<Request> batch = new ArrayList<>();
+    synchronized (this) {
+      queue_.add(request);
+      while (busy_ && !request.done) {
+        try {
+          wait();
+        } catch (InterruptedException e) {
+          Thread.currentThread().interrupt();
+          throw new IOException("interrupted waiting for io_uring");
+        }
+      }
+      if (!request.done) {
+        // lead the next batch, which includes this request
+        busy_ = true;
+        batch.add(request);
+        queue_.remove(request);
+        while (!queue_.isEmpty() && batch.size() < batch_limit_) {
+          batch.add(queue_.remove(0));
+        }
+      }
+    }
+    if (!batch.isEmpty()) {
+      RunBatch(batch);
+    }
+    if (request.result < 0 && broken_) {
+      // failed with the ring, or queued behind the batch that broke it
+      Fallback(request);
+      return;
+    }
+    if (request.result < 0) {
+      throw new IOException("io_uring error " + (-request.result));
+    }
+  }
+
+  /* the same request through the file's channel, without the ring */
+  private static void Fallback(Request request) throws IOException {
+    ByteBuffer buffer = ByteBuffer.wrap(request.data);
+    if (request.write) {
+      request.result = request.file.getChannel().write(buffer, request.offset);
+    } else {
+      request.result =
+          Math.max(request.file.getChannel().read(buffer, request.offset), 0);
+    }
+  }
+
+  private void RunBatch(ArrayList<Request> batch) {
+    int n = batch.size();
+    FileDescriptor[] fds = new FileDescriptor[n];
+    long[] offsets = new long[n];
+    byte[][] data = new byte[n][];
+    boolean[] writes = new boolean[n];
+    int[] results = new int[n];
+    for (int i = 0; i < n; i++) {
+      Request request = batch.get(i);
+      try {
+        fds[i] = request.file.getFD();
+      } catch (IOException e) {
+        // an invalid descriptor, the native side answers EBADF
+        fds[i] = new FileDescriptor();
+      }
+      offsets[i] = request.offset;
+      data[i] = request.data;
+      writes[i] = request.write;
+    }
+    try {
+      if (!Submit(handle_, fds, offsets, data, writes, results)) {
+        System.err.println("io_uring ring broke, falling back to FileChannel");
+        broken_ = true;
+      }
+    } finally {
+      synchronized (this) {
+        for (int i = 0; i < n; i++) {
+          batch.get(i).result = results[i];
+          batch.get(i).done = true;
+        }
+        busy_ = false;
+        notifyAll();
+      }
+    }
+  }
+}
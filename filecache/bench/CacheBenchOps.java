@@ -0,0 +1,182 @@
+/**
+ * file: CacheBenchOps.java
+ * author: Yukun Jiang
+ * date: Mar 06
+ *
+ * The Proxy's cache hot paths packaged for the JMH suite in bench/jmh
+ *
+ * JMH refuses benchmarks in the default package, and a named package cannot
+ * see the default-package Cache classes, so the benchmarks reach these static
+ * entry points through method handles. Every operation takes the same lock
+ * Cache.open/close hold around it, so that the thread sweep shows contention
+ * */
+
+import java.io.File;
+import java.io.RandomAccessFile;
+import java.lang.reflect.Field;
+import java.util.ArrayDeque;
+import java.util.HashMap;
+import java.util.concurrent.locks.ReentrantLock;
+
+public class CacheBenchOps {
+  /* only this many entries get a real file on disk, for reader opens */
+  private static final int MATERIALIZED_FILES = 4096;
+
+  /* accounted size of every entry */
+  private static final long ENTRY_SIZE = 4096;
+
+  private static final int PERCENT = 100;
+
+  /* stands for Cache.mtx_, held by Proxy around open and close */
+  private static final ReentrantLock mtx_ = new ReentrantLock();
+
+  private final String[] paths_;
+  private final Version[] versions_;
+  private final FileRecord[] records_;
+
+  /* unpinned versions in LRU order, the next eviction victim at the head */
+  private final ArrayDeque<Version> evictable_;
+
+  private CacheBenchOps(int entries) {
+    paths_ = new String[entries];
+    versions_ = new Version[entries];
+    records_ = new FileRecord[entries];
+    evictable_ = new ArrayDeque<>();
+  }
+
+  /**
+   * Fill a fresh cache rooted at cache_dir with 'entries' reader versions
+   * the oldest pinned_percent of them are held open by a pretend reader
+   */
+  public static Object Setup(String cache_dir, int entries, int pinned_percent)
+      throws Exception {
+    CacheBenchOps ops = new CacheBenchOps(entries);
+    Cache cache = new Cache();
+    cache.SetCacheDirectory(cache_dir);
+    cache.SetCacheCapacity(entries * ENTRY_SIZE);
+    cache.AddRemoteFileManager(new FakeFileManager());
+    Cache.lru_.clear();
+    RecordMap().clear();
+    Cache.DecreaseCacheOccupancy(Cache.TOP_TIER, cache.GetCacheOccupancy());
+    new File(cache_dir).mkdirs();
+    int pinned = (int)((long)entries * pinned_percent / PERCENT);
+    for (int i = 0; i < entries; i++) {
+      String path = "dir" + (i % 64) + "/file" + i;
+      FileRecord record = new FileRecord(path, FileRecord.NON_EXIST_VERSION,
+                                         FileRecord.NON_EXIST_VERSION);
+      int version_id = record.IncrementLatestVersionId();
+      Version version = new Version(path, version_id);
+      record.version_map_.put(version_id, version);
+      record.SetReaderVersionId(version_id);
+      RecordMap().put(path, record);
+      Cache.HitFileInLRUCache(version);
+      Cache.IncreaseCacheOccupancy(Cache.TOP_TIER, ENTRY_SIZE);
+      if (i < MATERIALIZED_FILES) {
+        File file = new File(Cache.FormatPath(version));
+        file.getParentFile().mkdirs();
+        file.createNewFile();
+      }
+      if (i < pinned) {
+        version.PlusRefCount();
+      } else {
+        ops.evictable_.addLast(version);
+      }
+      ops.paths_[i] = path;
+      ops.versions_[i] = version;
+      ops.records_[i] = record;
+    }
+    return ops;
+  }
+
+  /* remove every file Setup created */
+  public static void TearDown(String cache_dir) {
+    DeleteTree(new File(cache_dir));
+  }
+
+  /* an open/close refreshes one entry's LRU position */
+  public static void Hit(Object state, int i) {
+    CacheBenchOps ops = (CacheBenchOps)state;
+    mtx_.lock();
+    try {
+      Cache.HitFileInLRUCache(ops.versions_[i % ops.versions_.length]);
+    } finally {
+      mtx_.unlock();
+    }
+  }
+
+  /* a write grows a file while the cache still has room */
+  public static boolean Reserve(Object state) {
+    mtx_.lock();
+    try {
+      Cache.DecreaseCacheOccupancy(Cache.TOP_TIER, ENTRY_SIZE);
+      return Cache.ReserveCacheSpace(ENTRY_SIZE, false);
+    } finally {
+      mtx_.unlock();
+    }
+  }
+
+  /* the cache is full: evict the LRU unpinned entry, then a new download
+     takes its place at the MRU end. The fixture files are empty, so the
+     occupancy is left as it is */
+  public static boolean Evict(Object state) {
+    CacheBenchOps ops = (CacheBenchOps)state;
+    mtx_.lock();
+    try {
+      if (!Cache.EvictOneCacheEntry()) {
+        return false;
+      }
+      Version victim = ops.evictable_.pollFirst();
+      RecordMap().get(victim.filename_).SetReaderVersionId(victim.version_);
+      Cache.HitFileInLRUCache(victim);
+      ops.evictable_.addLast(victim);
+      return true;
+    } finally {
+      mtx_.unlock();
+    }
+  }
+
+  /* a read-only open followed by its close, as Cache.open/close do it */
+  public static int OpenClose(Object state, int i) throws Exception {
+    CacheBenchOps ops = (CacheBenchOps)state;
+    FileRecord record =
+        ops.records_[i % Math.min(MATERIALIZED_FILES, ops.records_.length)];
+    FileReturnVal val;
+    mtx_.lock();
+    try {
+      val = record.GetReaderFile();
+    } finally {
+      mtx_.unlock();
+    }
+    val.file_handle_.close();
+    mtx_.lock();
+    try {
+      record.CloseReaderFile(val.version_);
+    } finally {
+      mtx_.unlock();
+    }
+    return val.version_;
+  }
+
+  /* map a logical path into the cache directory */
+  public static String FormatPath(Object state, int i) {
+    CacheBenchOps ops = (CacheBenchOps)state;
+    return Cache.FormatPath(ops.paths_[i % ops.paths_.length]);
+  }
+
+  @SuppressWarnings("unchecked")
+  private static HashMap<String, FileRecord> RecordMap() throws Exception {
+    Field field = Cache.class.getDeclaredField("record_map_");
+    field.setAccessible(true);
+    return (HashMap<String, FileRecord>)field.get(null);
+  }
+
+  private static void DeleteTree(File f) {
+    File[] children = f.listFiles();
+    if (children != null) {
+      for (File child : children) {
+        DeleteTree(child);
+      }
+    }
+    f.delete();
+  }
+}
@@ -0,0 +1,87 @@
+/**
+ * file: FakeFileManager.java
+ * author: Yukun Jiang
+ * date: Mar 06
+ *
+ * A Server stand-in for benchmarks of the Proxy's bookkeeping
+ * every RPC answers immediately as if the proxy's copy is up-to-date,
+ * so that only the Proxy-side cost is measured
+ * */
+
+import java.io.IOException;
+import java.rmi.RemoteException;
+import java.util.ArrayList;
+
+public class FakeFileManager implements FileManagerRemote {
+  private static final int SUCCESS = 0;
+
+  private long timestamp_ = 0;
+
+  @Override
+  public ValidateResult Validate(ValidateParam param) throws RemoteException {
+    return new ValidateResult(SUCCESS, false, param.proxy_timestamp);
+  }
+
+  @Override
+  public SubtreeResult ValidateSubtree(String path, long since)
+      throws RemoteException {
+    return new SubtreeResult(since);
+  }
+
+  @Override
+  public FileChunk DownloadChunk(Integer chunk_id)
+      throws RemoteException, IOException {
+    return new FileChunk(new byte[0], true, chunk_id);
+  }
+
+  @Override
+  public FileChunk DownloadRange(String path, long timestamp, long offset)
+      throws RemoteException, IOException {
+    return new FileChunk(new byte[0], true, FileChunk.NO_SESSION, offset);
+  }
+
+  @Override
+  public synchronized Long[] Upload(String path, FileChunk chunk)
+      throws RemoteException, IOException {
+    return new Long[] {++timestamp_, (long)FileChunk.NO_SESSION};
+  }
+
+  @Override
+  public synchronized Long UploadChunk(FileChunk chunk)
+      throws RemoteException, IOException {
+    return chunk.end_of_file ? ++timestamp_ : Server.SERVER_NO_EXIST;
+  }
+
+  @Override
+  public synchronized long[] UploadBatch(ArrayList<String> paths,
+                                         ArrayList<FileChunk> chunks)
+      throws RemoteException, IOException {
+    long[] timestamps = new long[paths.size()];
+    for (int i = 0; i < timestamps.length; i++) {
+      timestamps[i] = ++timestamp_;
+    }
+    return timestamps;
+  }
+
+  @Override
+  public long UploadOffset(Integer chunk_id) throws RemoteException {
+    return Server.SERVER_NO_EXIST;
+  }
+
+  @Override
+  public void CancelChunk(Integer chunk_id) throws RemoteException {}
+
+  @Override
+  public int Delete(String path) throws RemoteException {
+    return SUCCESS;
+  }
+
+  @Override
+  public int[] DeleteBatch(ArrayList<String> paths) throws RemoteException {
+    return new int[paths.size()];
+  }
+
+  @Override
+  public void Subscribe(PushReceiverRemote receiver, ArrayList<String> prefixes)
+      throws RemoteException {}
+}
@@ -0,0 +1,162 @@
+/**
+ * file: CacheBench.java
+ * author: Yukun Jiang
+ * date: Mar 06
+ *
+ * JMH microbenchmarks of the Proxy cache hot paths: LRU hit, space
+ * reservation, eviction with pinned entries, reader open/close and path
+ * formatting, from 1k to 1M cache entries
+ *
+ * The cache classes live in the default package, which cannot be imported,
+ * so every operation is reached through a method handle on CacheBenchOps.
+ * The thread count is swept by 'make bench' with JMH's -t option
+ * */
+
+package jmh;
+
+import java.lang.invoke.MethodHandle;
+import java.lang.invoke.MethodHandles;
+import java.lang.invoke.MethodType;
+import java.util.concurrent.TimeUnit;
+import org.openjdk.jmh.annotations.Benchmark;
+import org.openjdk.jmh.annotations.BenchmarkMode;
+import org.openjdk.jmh.annotations.Fork;
+import org.openjdk.jmh.annotations.Level;
+import org.openjdk.jmh.annotations.Measurement;
+import org.openjdk.jmh.annotations.Mode;
+import org.openjdk.jmh.annotations.OutputTimeUnit;
+import org.openjdk.jmh.annotations.Param;
+import org.openjdk.jmh.annotations.Scope;
+import org.openjdk.jmh.annotations.Setup;
+import org.openjdk.jmh.annotations.State;
+import org.openjdk.jmh.annotations.TearDown;
+import org.openjdk.jmh.annotations.Warmup;
+
+@BenchmarkMode(Mode.AverageTime)
+@OutputTimeUnit(TimeUnit.NANOSECONDS)
+@Warmup(iterations = 3, time = 1)
+@Measurement(iterations = 5, time = 1)
+@Fork(1)
+public class CacheBench {
+  /* a tmpfs directory keeps the disk out of the reader open/close numbers */
+  private static final String BENCH_DIR =
+      System.getProperty("filecache.bench_dir", "/dev/shm/filecache_bench");
+
+  private static final MethodHandle SETUP;
+  private static final MethodHandle TEAR_DOWN;
+  private static final MethodHandle HIT;
+  private static final MethodHandle RESERVE;
+  private static final MethodHandle EVICT;
+  private static final MethodHandle OPEN_CLOSE;
+  private static final MethodHandle FORMAT_PATH;
+
+  static {
+    try {
+      Class<?> ops = Class.forName("CacheBenchOps");
+      MethodHandles.Lookup lookup = MethodHandles.publicLookup();
+      SETUP = lookup.findStatic(
+          ops, "Setup",
+          MethodType.methodType(Object.class, String.class, int.class,
+                                int.class));
+      TEAR_DOWN = lookup.findStatic(
+          ops, "TearDown", MethodType.methodType(void.class, String.class));
+      HIT = lookup.findStatic(
+          ops, "Hit",
+          MethodType.methodType(void.class, Object.class, int.class));
+      RESERVE = lookup.findStatic(
+          ops, "Reserve", MethodType.methodType(boolean.class, Object.class));
+      EVICT = lookup.findStatic(
+          ops, "Evict", MethodType.methodType(boolean.class, Object.class));
+      OPEN_CLOSE = lookup.findStatic(
+          ops, "OpenClose",
+          MethodType.methodType(int.class, Object.class, int.class));
+      FORMAT_PATH = lookup.findStatic(
+          ops, "FormatPath",
+          MethodType.methodType(String.class, Object.class, int.class));
+    } catch (ReflectiveOperationException e) {
+      throw new ExceptionInInitializerError(e);
+    }
+  }
+
+  /* one cache shared by every benchmark thread, as in the Proxy */
+  @State(Scope.Benchmark)
+  public static class CacheState {
+    @Param({"1000", "100000", "1000000"})
+    public int entries;
+
+    public Object ops;
+
+    @Setup(Level.Trial)
+    public void SetUp() throws Throwable {
+      ops = (Object)SETUP.invokeExact(BENCH_DIR, entries, 0);
+    }
+
+    @TearDown(Level.Trial)
+    public void TearDown() throws Throwable {
+      TEAR_DOWN.invokeExact(BENCH_DIR);
+    }
+  }
+
+  /* a full cache whose LRU head is held open by readers */
+  @State(Scope.Benchmark)
+  public static class PinnedState {
+    @Param({"1000", "100000", "1000000"})
+    public int entries;
+
+    @Param({"0", "50", "99"})
+    public int pinned_percent;
+
+    public Object ops;
+
+    @Setup(Level.Trial)
+    public void SetUp() throws Throwable {
+      ops = (Object)SETUP.invokeExact(BENCH_DIR, entries, pinned_percent);
+    }
+
+    @TearDown(Level.Trial)
+    public void TearDown() throws Throwable {
+      TEAR_DOWN.invokeExact(BENCH_DIR);
+    }
+  }
+
+  /* every thread walks the entries from its own starting point */
+  @State(Scope.Thread)
+  public static class Cursor {
+    private static final int STRIDE = 7919;
+
+    private int next_;
+
+    @Setup(Level.Trial)
+    public void SetUp() {
+      next_ = (int)Thread.currentThread().getId() * STRIDE;
+    }
+
+    public int Next() { return (next_ += STRIDE) & Integer.MAX_VALUE; }
+  }
+
+  @Benchmark
+  public void HitLru(CacheState state, Cursor cursor) throws Throwable {
+    HIT.invokeExact(state.ops, cursor.Next());
+  }
+
+  @Benchmark
+  public boolean ReserveFastPath(CacheState state) throws Throwable {
+    return (boolean)RESERVE.invokeExact(state.ops);
+  }
+
+  @Benchmark
+  public boolean EvictWithPinned(PinnedState state) throws Throwable {
+    return (boolean)EVICT.invokeExact(state.ops);
+  }
+
+  @Benchmark
+  public int ReaderOpenClose(CacheState state, Cursor cursor)
+      throws Throwable {
+    return (int)OPEN_CLOSE.invokeExact(state.ops, cursor.Next());
+  }
+
+  @Benchmark
+  public String FormatPath(CacheState state, Cursor cursor) throws Throwable {
+    return (String)FORMAT_PATH.invokeExact(state.ops, cursor.Next());
+  }
+}
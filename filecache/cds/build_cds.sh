@@ -0,0 +1,70 @@
+#!/usr/bin/env bash
+#
+# file: build_cds.sh
+# author: Yukun Jiang
+#
+# Build the AppCDS archive behind 'make cds': start a Server and a Proxy once
+# with -XX:DumpLoadedClassList on an empty root, stop them once they are
+# ready to serve, and dump the classes both loaded into cds/filecache.jsa.
+# JDK 11 has no -XX:ArchiveClassesAtExit, hence the class list round trip
+#
+# usage: cds/build_cds.sh   (from filecache/, after 'make all')
+
+set -u
+CDS_DIR="cds"
+SERVER_PORT="${CDS_SERVER_PORT:-15741}"
+export proxyport15440="${CDS_PROXY_PORT:-15742}"
+export pin15440="${pin15440:-123456789}"
+# the archive only applies to runs with this same class path
+export CLASSPATH="${PWD}:${PWD}/../lib"
+START_TIMEOUT_S="${CDS_START_TIMEOUT_S:-60}"
+
+# wait until the training Server is bound and listening, as perf/run_perf.sh
+wait_for_server() {
+  local deadline=$((SECONDS + START_TIMEOUT_S))
+  until grep -q "startup:" "${CDS_DIR}/server.log" 2>/dev/null &&
+      (exec 3<>"/dev/tcp/127.0.0.1/${SERVER_PORT}") 2>/dev/null; do
+    if ! kill -0 "${SERVER_PID}" 2>/dev/null; then
+      echo "training Server exited during startup, see ${CDS_DIR}/server.log"
+      exit 1
+    fi
+    if [ "${SECONDS}" -ge "${deadline}" ]; then
+      echo "training Server not listening after ${START_TIMEOUT_S}s"
+      exit 1
+    fi
+    sleep 0.1
+  done
+}
+
+TRAIN_DIR="$(mktemp -d)"
+mkdir -p "${TRAIN_DIR}/root" "${TRAIN_DIR}/cache"
+rm -f "${CDS_DIR}"/*.classlist "${CDS_DIR}/filecache.jsa"
+
+java -Xshare:off -XX:DumpLoadedClassList="${CDS_DIR}/server.classlist" \
+  Server "${SERVER_PORT}" "${TRAIN_DIR}/root" \
+  > "${CDS_DIR}/server.log" 2>&1 &
+SERVER_PID=$!
+trap 'kill ${SERVER_PID} 2>/dev/null; rm -rf "${TRAIN_DIR}"' EXIT
+wait_for_server
+
+# returns once Proxy is connected, warmed up and ready to serve
+if ! java -Xshare:off -XX:DumpLoadedClassList="${CDS_DIR}/proxy.classlist" \
+    -Dfilecache.exit_after_start=1 \
+    Proxy 127.0.0.1 "${SERVER_PORT}" "${TRAIN_DIR}/cache" 1048576 \
+    > "${CDS_DIR}/proxy.log" 2>&1; then
+  echo "training Proxy failed, see ${CDS_DIR}/proxy.log"
+  exit 1
+fi
+# a normal exit flushes the Server's class list
+kill "${SERVER_PID}"
+wait "${SERVER_PID}" 2>/dev/null
+
+sort -u "${CDS_DIR}/server.classlist" "${CDS_DIR}/proxy.classlist" \
+  > "${CDS_DIR}/filecache.classlist"
+java -Xshare:dump -XX:SharedClassListFile="${CDS_DIR}/filecache.classlist" \
+  -XX:SharedArchiveFile="${CDS_DIR}/filecache.jsa" \
+  > "${CDS_DIR}/dump.log" 2>&1 || {
+  echo "archive dump failed, see ${CDS_DIR}/dump.log"
+  exit 1
+}
+echo "built ${CDS_DIR}/filecache.jsa for CLASSPATH=${CLASSPATH}"
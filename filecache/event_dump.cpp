@@ -0,0 +1,202 @@
+/**
+ * file: event_dump.cpp
+ * author: Yukun Jiang
+ *
+ * Summarizes a Proxy's cache event ring by path prefix, to tell why the hit
+ * rate dropped: stale versions, cold paths, evictions (and their reasons),
+ * failed space reservations or writers spilled out of the full cache.
+ *
+ * The input is the TSV a Proxy started with -Dfilecache.events_port serves,
+ * one event per line: time_ms, kind, size, detail, path. Kinds are hit,
+ * stale, cold, evict, enomem, install and spill. Only events within window_s
+ * seconds of the newest one are counted, 0 counts all of them.
+ *
+ * Usage:
+ *   curl -s http://127.0.0.1:<events_port>/events |
+ *       ./event_dump [window_s] [depth] [top]
+ *
+ * Paths are grouped by their first 'depth' directories, the prefixes with the
+ * most misses, evictions and ENOMEMs come first, at most 'top' of them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+static const long DEFAULT_WINDOW_S = 60;
+static const int DEFAULT_DEPTH = 1;
+static const int DEFAULT_TOP = 20;
+static const int FIELDS = 5;
+static const char* ROOT_PREFIX = ".";
+
+struct Event {
+  long time_ms = 0;
+  std::string kind;
+  long size = 0;
+  std::string detail;
+  std::string path;
+};
+
+/* counts of one prefix, or of everything */
+struct Summary {
+  long hit = 0;
+  long stale = 0;
+  long cold = 0;
+  long evict = 0;
+  long enomem = 0;
+  long install = 0;
+  long spill = 0;
+  long missed_bytes = 0;
+  long evicted_bytes = 0;
+  std::map<std::string, long> evict_reasons;
+  std::map<std::string, long> enomem_sites;
+
+  long Trouble() const { return stale + cold + evict + enomem; }
+
+  void Add(const Event& e) {
+    if (e.kind == "hit") {
+      hit++;
+    } else if (e.kind == "stale") {
+      stale++;
+      missed_bytes += e.size;
+    } else if (e.kind == "cold") {
+      cold++;
+      missed_bytes += e.size;
+    } else if (e.kind == "evict") {
+      evict++;
+      evicted_bytes += e.size;
+      evict_reasons[e.detail]++;
+    } else if (e.kind == "enomem") {
+      enomem++;
+      enomem_sites[e.detail]++;
+    } else if (e.kind == "install") {
+      install++;
+    } else if (e.kind == "spill") {
+      spill++;
+    }
+  }
+};
+
+/* "time_ms\tkind\tsize\tdetail\tpath", the path may hold anything but '\n' */
+static bool ParseLine(char* line, Event* e) {
+  line[strcspn(line, "\n")] = '\0';
+  char* fields[FIELDS];
+  char* cursor = line;
+  for (int i = 0; i < FIELDS - 1; i++) {
+    char* tab = strchr(cursor, '\t');
+    if (tab == NULL) {
+      return false;
+    }
+    *tab = '\0';
+    fields[i] = cursor;
+    cursor = tab + 1;
+  }
+  fields[FIELDS - 1] = cursor;
+  e->time_ms = atol(fields[0]);
+  e->kind = fields[1];
+  e->size = atol(fields[2]);
+  e->detail = fields[3];
+  e->path = fields[4];
+  return true;
+}
+
+/* the first 'depth' directories of 'path' */
+static std::string PrefixOf(const std::string& path, int depth) {
+  size_t end = 0;
+  for (int i = 0; i < depth; i++) {
+    size_t slash = path.find('/', (i == 0) ? 0 : end + 1);
+    if (slash == std::string::npos) {
+      break;
+    }
+    end = slash;
+  }
+  return (end == 0) ? ROOT_PREFIX : path.substr(0, end);
+}
+
+static std::string Breakdown(const std::map<std::string, long>& counts) {
+  std::string out;
+  for (const auto& entry : counts) {
+    if (!out.empty()) {
+      out += ",";
+    }
+    out += (entry.first.empty() ? "-" : entry.first) + "=" +
+           std::to_string(entry.second);
+  }
+  return out.empty() ? "-" : out;
+}
+
+static void PrintRow(const std::string& name, const Summary& s) {
+  long opens = s.hit + s.stale + s.cold;
+  double hit_rate = (opens == 0) ? 0 : 100.0 * s.hit / opens;
+  printf("%-32s %7ld %6.1f%% %7ld %7ld %7ld %7ld %7ld %7ld %10.1f %10.1f  %s | "
+         "%s\n",
+         name.c_str(), opens, hit_rate, s.stale, s.cold, s.evict, s.enomem,
+         s.install, s.spill, s.missed_bytes / 1048576.0,
+         s.evicted_bytes / 1048576.0, Breakdown(s.evict_reasons).c_str(),
+         Breakdown(s.enomem_sites).c_str());
+}
+
+int main(int argc, char** argv) {
+  long window_s = (argc > 1) ? atol(argv[1]) : DEFAULT_WINDOW_S;
+  int depth = (argc > 2) ? atoi(argv[2]) : DEFAULT_DEPTH;
+  int top = (argc > 3) ? atoi(argv[3]) : DEFAULT_TOP;
+
+  std::vector<Event> events;
+  char* line = NULL;
+  size_t capacity = 0;
+  long malformed = 0;
+  while (getline(&line, &capacity, stdin) != -1) {
+    Event e;
+    if (ParseLine(line, &e)) {
+      events.push_back(e);
+    } else {
+      malformed++;
+    }
+  }
+  free(line);
+  if (events.empty()) {
+    fprintf(stderr, "no events on stdin\n");
+    return 1;
+  }
+
+  long newest_ms = 0;
+  for (const Event& e : events) {
+    newest_ms = std::max(newest_ms, e.time_ms);
+  }
+  long since_ms = (window_s > 0) ? newest_ms - window_s * 1000 : 0;
+  long oldest_ms = newest_ms;
+  long counted = 0;
+  Summary total;
+  std::map<std::string, Summary> prefixes;
+  for (const Event& e : events) {
+    if (e.time_ms < since_ms) {
+      continue;
+    }
+    oldest_ms = std::min(oldest_ms, e.time_ms);
+    counted++;
+    total.Add(e);
+    prefixes[PrefixOf(e.path, depth)].Add(e);
+  }
+
+  std::vector<std::pair<std::string, Summary>> rows(prefixes.begin(),
+                                                    prefixes.end());
+  std::sort(rows.begin(), rows.end(),
+            [](const std::pair<std::string, Summary>& a,
+               const std::pair<std::string, Summary>& b) {
+              return a.second.Trouble() > b.second.Trouble();
+            });
+  printf("%ld events over %.1f s, %ld malformed lines skipped\n", counted,
+         (newest_ms - oldest_ms) / 1000.0, malformed);
+  printf("%-32s %7s %7s %7s %7s %7s %7s %7s %7s %10s %10s  %s\n", "prefix",
+         "opens", "hit", "stale", "cold", "evict", "enomem", "install", "spill",
+         "miss_MB", "evict_MB", "evict reasons | enomem sites");
+  PrintRow("(all)", total);
+  for (size_t i = 0; i < rows.size() && (int)i < top; i++) {
+    PrintRow(rows[i].first, rows[i].second);
+  }
+  return 0;
+}
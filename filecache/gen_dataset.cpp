@@ -0,0 +1,382 @@
+/**
+ * file: gen_dataset.cpp
+ * author: Yukun Jiang
+ *
+ * Synthetic dataset generator for Server roots.
+ *
+ * Builds a server root directory from a spec instead of hand-made fixtures
+ * like A.txt..H.txt or 1mb.txt, and writes matching manifests for the load
+ * generators. The same spec and seed always give the same tree, byte for
+ * byte: every file's size, place and content derive only from (seed, index),
+ * so files are generated by several threads in any order.
+ *
+ * Usage:
+ *   ./gen_dataset [spec_file] [key=value ...]
+ *
+ * The spec file holds "key = value" lines ('#' starts a comment), and
+ * key=value arguments override it. Keys and defaults:
+ *   root=dataset_root       directory to create the files under
+ *   files=10000             number of files
+ *   size_dist=lognormal     fixed | lognormal | bimodal
+ *   size=65536              fixed: size of every file
+ *   median=16384 sigma=1.5  lognormal: median size and sigma of ln(size)
+ *   small=4096 large=8388608 large_percent=5
+ *                           bimodal: two lognormal modes sharing sigma
+ *   max_size=268435456      sizes are clamped to [0, max_size]
+ *   depth=2 fanout=16       directory levels and sub-directories per level
+ *   compressibility=0.3     fraction of 4KB blocks that are a repeated byte
+ *   dup_percent=10          percent of files duplicating an earlier file
+ *   seed=15440              seed of everything above
+ *   threads=8               generator threads
+ *   ops=100000 read_percent=90 zipf=0.99
+ *                           the workload manifest: operations, share of
+ *                           reads and popularity skew over the files
+ *
+ * Outputs next to the root:
+ *   <root>.manifest   "path<TAB>size<TAB>content_id" per file, duplicates
+ *                     share their original's content_id
+ *   <root>.workload   one "R path" or "W path size" per operation
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const size_t BLOCK = 4096;
+static const size_t POOL_SIZE = 64 * 1024 * 1024;
+static const int MAX_DUP_CHAIN = 64;
+static const uint64_t ZIPF_STRIDE = 1000003;  // prime, spreads hot files
+
+struct Spec {
+  std::string root = "dataset_root";
+  long files = 10000;
+  std::string size_dist = "lognormal";
+  double size = 65536;
+  double median = 16384;
+  double sigma = 1.5;
+  double small = 4096;
+  double large = 8388608;
+  double large_percent = 5;
+  double max_size = 268435456;
+  int depth = 2;
+  int fanout = 16;
+  double compressibility = 0.3;
+  double dup_percent = 10;
+  uint64_t seed = 15440;
+  int threads = 8;
+  long ops = 100000;
+  double read_percent = 90;
+  double zipf = 0.99;
+};
+
+/* what a file is, derived only from the spec and its index */
+struct FileInfo {
+  long content_id;  // index of the file whose bytes this one has
+  size_t size;
+};
+
+/* splitmix64, portable so that a seed means the same tree everywhere */
+uint64_t mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/* uniform in (0, 1) from a hash */
+double unit(uint64_t h) { return ((h >> 11) + 0.5) / 9007199254740992.0; }
+
+/* independent random stream per (seed, file, purpose) */
+uint64_t draw(const Spec& spec, long index, uint64_t purpose) {
+  return mix(mix(spec.seed ^ (purpose << 56)) ^ (uint64_t)index);
+}
+
+double lognormal(double median, double sigma, uint64_t h1, uint64_t h2) {
+  // Box-Muller
+  double normal = sqrt(-2.0 * log(unit(h1))) * cos(2 * M_PI * unit(h2));
+  return median * exp(sigma * normal);
+}
+
+size_t draw_size(const Spec& spec, long index) {
+  double size;
+  uint64_t h1 = draw(spec, index, 1), h2 = draw(spec, index, 2);
+  if (spec.size_dist == "fixed") {
+    size = spec.size;
+  } else if (spec.size_dist == "bimodal") {
+    bool large = unit(draw(spec, index, 3)) * 100 < spec.large_percent;
+    size = lognormal(large ? spec.large : spec.small, spec.sigma, h1, h2);
+  } else {
+    size = lognormal(spec.median, spec.sigma, h1, h2);
+  }
+  return (size_t)std::max(0.0, std::min(size, spec.max_size));
+}
+
+FileInfo file_info(const Spec& spec, long index) {
+  // a duplicate copies an earlier file, follow the chain to an original
+  for (int hop = 0; hop < MAX_DUP_CHAIN && index > 0; hop++) {
+    if (unit(draw(spec, index, 4)) * 100 >= spec.dup_percent) {
+      break;
+    }
+    index = draw(spec, index, 5) % index;
+  }
+  return FileInfo{index, draw_size(spec, index)};
+}
+
+/* directory of a file: files go round-robin over the leaf directories */
+std::string dir_of(const Spec& spec, long index, long leaves) {
+  long leaf = index % leaves;
+  std::string dir;
+  for (int level = 0; level < spec.depth; level++) {
+    dir += "d" + std::to_string(leaf % spec.fanout) + "/";
+    leaf /= spec.fanout;
+  }
+  return dir;
+}
+
+std::string path_of(const Spec& spec, long index, long leaves) {
+  return dir_of(spec, index, leaves) + "f" + std::to_string(index) + ".dat";
+}
+
+/* fill a file from the shared pool, one 4KB block at a time */
+bool write_file(const Spec& spec, const std::string& path, const FileInfo& info,
+                const std::vector<char>& pool) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    return false;
+  }
+  std::vector<char> repeated(BLOCK);
+  size_t written = 0;
+  for (uint64_t block = 0; written < info.size; block++) {
+    size_t len = std::min(BLOCK, info.size - written);
+    uint64_t h = draw(spec, info.content_id, 16 + block % 16) ^ mix(block);
+    const char* data;
+    if (unit(h) < spec.compressibility) {
+      memset(repeated.data(), 'a' + (h >> 8) % 26, len);
+      data = repeated.data();
+    } else {
+      data = pool.data() + (h >> 12) % (pool.size() - BLOCK);
+    }
+    if (write(fd, data, len) != (ssize_t)len) {
+      close(fd);
+      return false;
+    }
+    written += len;
+  }
+  return close(fd) == 0;
+}
+
+/* mkdir -p of every leaf directory the files will use */
+bool make_dirs(const Spec& spec, long leaves) {
+  mkdir(spec.root.c_str(), S_IRWXU);
+  for (long leaf = 0; leaf < leaves; leaf++) {
+    std::string dir = spec.root;
+    std::string rel = dir_of(spec, leaf, leaves);
+    size_t start = 0, slash;
+    while ((slash = rel.find('/', start)) != std::string::npos) {
+      dir = spec.root + "/" + rel.substr(0, slash);
+      if (mkdir(dir.c_str(), S_IRWXU) != 0 && errno != EEXIST) {
+        printf("mkdir %s failed errno=%d\n", dir.c_str(), errno);
+        return false;
+      }
+      start = slash + 1;
+    }
+  }
+  return true;
+}
+
+bool write_manifest(const Spec& spec, long leaves) {
+  std::ofstream out(spec.root + ".manifest");
+  for (long i = 0; i < spec.files; i++) {
+    FileInfo info = file_info(spec, i);
+    out << path_of(spec, i, leaves) << '\t' << info.size << '\t'
+        << info.content_id << '\n';
+  }
+  return out.good();
+}
+
+/* operations over the files with zipf popularity, writes keep their size */
+bool write_workload(const Spec& spec, long leaves) {
+  std::vector<double> cdf(spec.files);
+  double total = 0;
+  for (long rank = 0; rank < spec.files; rank++) {
+    total += 1.0 / pow(rank + 1, spec.zipf);
+    cdf[rank] = total;
+  }
+  uint64_t stride = (spec.files % ZIPF_STRIDE == 0) ? 1 : ZIPF_STRIDE;
+  std::ofstream out(spec.root + ".workload");
+  for (long op = 0; op < spec.ops; op++) {
+    double pick = unit(draw(spec, op, 6)) * total;
+    long rank = std::lower_bound(cdf.begin(), cdf.end(), pick) - cdf.begin();
+    long index = (long)((uint64_t)rank * stride % (uint64_t)spec.files);
+    std::string path = path_of(spec, index, leaves);
+    if (unit(draw(spec, op, 7)) * 100 < spec.read_percent) {
+      out << "R " << path << '\n';
+    } else {
+      out << "W " << path << ' ' << file_info(spec, index).size << '\n';
+    }
+  }
+  return out.good();
+}
+
+void set_key(Spec* spec, const std::string& key, const std::string& value) {
+  std::map<std::string, double*> doubles = {
+      {"size", &spec->size},
+      {"median", &spec->median},
+      {"sigma", &spec->sigma},
+      {"small", &spec->small},
+      {"large", &spec->large},
+      {"large_percent", &spec->large_percent},
+      {"max_size", &spec->max_size},
+      {"compressibility", &spec->compressibility},
+      {"dup_percent", &spec->dup_percent},
+      {"read_percent", &spec->read_percent},
+      {"zipf", &spec->zipf}};
+  if (doubles.count(key)) {
+    *doubles[key] = atof(value.c_str());
+  } else if (key == "root") {
+    spec->root = value;
+  } else if (key == "size_dist") {
+    spec->size_dist = value;
+  } else if (key == "files") {
+    spec->files = atol(value.c_str());
+  } else if (key == "ops") {
+    spec->ops = atol(value.c_str());
+  } else if (key == "depth") {
+    spec->depth = atoi(value.c_str());
+  } else if (key == "fanout") {
+    spec->fanout = atoi(value.c_str());
+  } else if (key == "seed") {
+    spec->seed = strtoull(value.c_str(), nullptr, 10);
+  } else if (key == "threads") {
+    spec->threads = atoi(value.c_str());
+  } else {
+    printf("ignoring unknown key '%s'\n", key.c_str());
+  }
+}
+
+std::string trim(const std::string& s) {
+  size_t start = s.find_first_not_of(" \t\r");
+  size_t end = s.find_last_not_of(" \t\r");
+  return (start == std::string::npos) ? "" : s.substr(start, end - start + 1);
+}
+
+/* "key = value" or "key=value", with '#' comments */
+void parse_line(Spec* spec, std::string line) {
+  line = line.substr(0, line.find('#'));
+  size_t eq = line.find('=');
+  if (eq != std::string::npos) {
+    set_key(spec, trim(line.substr(0, eq)), trim(line.substr(eq + 1)));
+  }
+}
+
+double now_sec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[]) {
+  Spec spec;
+  for (int i = 1; i < argc; i++) {
+    if (strchr(argv[i], '=')) {
+      continue;
+    }
+    std::ifstream in(argv[i]);
+    if (!in) {
+      printf("cannot read spec %s\n", argv[i]);
+      return 1;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+      parse_line(&spec, line);
+    }
+  }
+  for (int i = 1; i < argc; i++) {
+    // overrides win over the spec file, whatever the order
+    if (strchr(argv[i], '=')) {
+      parse_line(&spec, argv[i]);
+    }
+  }
+  if (spec.files <= 0 || spec.fanout <= 0 || spec.depth < 0 ||
+      spec.threads <= 0) {
+    printf("files, fanout and threads must be positive, depth non-negative\n");
+    return 1;
+  }
+
+  long leaves = 1;
+  for (int level = 0; level < spec.depth && leaves < spec.files; level++) {
+    leaves *= spec.fanout;
+  }
+  leaves = std::min(leaves, spec.files);
+  double start = now_sec();
+  if (!make_dirs(spec, leaves)) {
+    return 1;
+  }
+
+  // blocks of real content are slices of one seeded random pool
+  std::vector<char> pool(POOL_SIZE);
+  for (size_t i = 0; i < POOL_SIZE; i += sizeof(uint64_t)) {
+    uint64_t h = mix(spec.seed * POOL_SIZE + i);
+    memcpy(pool.data() + i, &h, sizeof(h));
+  }
+
+  std::atomic<long> next(0);
+  std::atomic<long> failed(0);
+  std::atomic<long> duplicates(0);
+  std::atomic<unsigned long long> bytes(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < spec.threads; t++) {
+    workers.emplace_back([&]() {
+      long i;
+      while ((i = next++) < spec.files) {
+        FileInfo info = file_info(spec, i);
+        std::string path = spec.root + "/" + path_of(spec, i, leaves);
+        if (!write_file(spec, path, info, pool)) {
+          failed++;
+          continue;
+        }
+        bytes += info.size;
+        if (info.content_id != i) {
+          duplicates++;
+        }
+      }
+    });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  double generated = now_sec();
+  if (!write_manifest(spec, leaves) || !write_workload(spec, leaves)) {
+    printf("failed to write the manifests\n");
+    return 1;
+  }
+
+  printf("root=%s files=%ld dirs=%ld duplicates=%ld bytes=%llu seed=%llu\n",
+         spec.root.c_str(), spec.files, leaves, duplicates.load(),
+         bytes.load(), (unsigned long long)spec.seed);
+  printf("generated in %.2f s (%.0f files/s, %.1f MB/s), manifests in %.2f s\n",
+         generated - start, spec.files / (generated - start),
+         bytes.load() / (1024.0 * 1024.0) / (generated - start),
+         now_sec() - generated);
+  if (failed > 0) {
+    printf("%ld files failed, errno=%d\n", failed.load(), errno);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,14 @@
+# dataset of 'make perf', keep it fixed or the baseline means nothing
+files = 2000
+size_dist = bimodal
+small = 4096
+large = 4194304
+large_percent = 1
+sigma = 0.5
+max_size = 16777216
+depth = 2
+fanout = 8
+compressibility = 0.3
+dup_percent = 10
+seed = 15440
+ops = 10000
@@ -0,0 +1,79 @@
+#!/usr/bin/env bash
+#
+# file: run_perf.sh
+# author: Yukun Jiang
+#
+# Regression gate behind 'make perf': generate the perf dataset, start a
+# Server and a Proxy on it, run perf_suite through the Proxy and compare the
+# results against perf/baseline.json
+#
+# usage: perf/run_perf.sh [--update-baseline]   (from filecache/)
+
+set -u
+PERF_DIR="perf"
+TOOLS="../tools"
+SERVER_PORT="${PERF_SERVER_PORT:-15641}"
+CACHE_CAPACITY="${PERF_CACHE_CAPACITY:-1073741824}"
+export proxyport15440="${PERF_PROXY_PORT:-15642}"
+export pin15440="${pin15440:-123456789}"
+export CLASSPATH="${PWD}:${PWD}/../lib"
+START_TIMEOUT_S="${PERF_START_TIMEOUT_S:-60}"
+
+# wait until 'name' reported its startup and accepts connections on 'port',
+# fail if it exits first. Server's registry port opens before it is bound
+wait_for_port() {
+  local name="$1" pid="$2" port="$3"
+  local deadline=$((SECONDS + START_TIMEOUT_S))
+  until grep -q "startup:" "${PERF_DIR}/${name}.log" 2>/dev/null &&
+      (exec 3<>"/dev/tcp/127.0.0.1/${port}") 2>/dev/null; do
+    if ! kill -0 "${pid}" 2>/dev/null; then
+      echo "${name} exited during startup, see ${PERF_DIR}/${name}.log"
+      exit 1
+    fi
+    if [ "${SECONDS}" -ge "${deadline}" ]; then
+      echo "${name} not listening on ${port} after ${START_TIMEOUT_S}s"
+      exit 1
+    fi
+    sleep 0.1
+  done
+}
+
+if [ "${1:-}" != "--update-baseline" ] &&
+    ! "${TOOLS}/perf_suite" recorded "${PERF_DIR}/baseline.json"; then
+  # nothing to gate against yet, a fresh tree must not fail on that
+  echo "perf gate skipped: ${PERF_DIR}/baseline.json holds no recorded" \
+    "numbers, run 'make perf_baseline' on the reference machine and commit it"
+  exit 0
+fi
+
+rm -rf "${PERF_DIR}/root" "${PERF_DIR}/cache" "${PERF_DIR}/root.manifest" \
+  "${PERF_DIR}/root.workload" "${PERF_DIR}/current.json"
+mkdir -p "${PERF_DIR}/cache"
+"${TOOLS}/gen_dataset" "${PERF_DIR}/dataset.spec" root="${PERF_DIR}/root" \
+  || exit 1
+
+java Server "${SERVER_PORT}" "${PERF_DIR}/root" \
+  > "${PERF_DIR}/server.log" 2>&1 &
+SERVER_PID=$!
+PROXY_PID=""
+trap 'kill ${SERVER_PID} ${PROXY_PID} 2>/dev/null' EXIT
+wait_for_port server "${SERVER_PID}" "${SERVER_PORT}"
+java Proxy 127.0.0.1 "${SERVER_PORT}" "${PERF_DIR}/cache" "${CACHE_CAPACITY}" \
+  > "${PERF_DIR}/proxy.log" 2>&1 &
+PROXY_PID=$!
+wait_for_port proxy "${PROXY_PID}" "${proxyport15440}"
+
+if ! LD_PRELOAD=../lib/lib440lib.so "${TOOLS}/perf_suite" run \
+    < "${PERF_DIR}/root.manifest" > "${PERF_DIR}/current.json"; then
+  echo "perf suite failed, see ${PERF_DIR}/server.log and ${PERF_DIR}/proxy.log"
+  exit 1
+fi
+
+if [ "${1:-}" = "--update-baseline" ]; then
+  "${TOOLS}/perf_suite" baseline "${PERF_DIR}/current.json" \
+    > "${PERF_DIR}/baseline.json"
+  echo "recorded ${PERF_DIR}/baseline.json"
+  exit 0
+fi
+"${TOOLS}/perf_suite" compare "${PERF_DIR}/current.json" \
+  "${PERF_DIR}/baseline.json"
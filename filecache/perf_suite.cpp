@@ -0,0 +1,375 @@
+/**
+ * file: perf_suite.cpp
+ * author: Yukun Jiang
+ *
+ * Fixed performance suite and regression gate behind 'make perf'.
+ *
+ * Usage:
+ *   LD_PRELOAD=../lib/lib440lib.so ./perf_suite run < <root>.manifest
+ *       runs the suite through the Proxy over the files of a gen_dataset
+ *       manifest and prints the results as JSON on stdout
+ *   ./perf_suite compare <current.json> <baseline.json>
+ *       prints a per-metric diff, exits with 1 if any metric is outside its
+ *       tolerance band or missing, and with 2 if the baseline was never
+ *       recorded
+ *   ./perf_suite baseline <current.json> [tolerance_pct]
+ *       prints a new baseline from a run
+ *
+ * Everything local goes through stdin/stdout, since every path opened under
+ * LD_PRELOAD is sent to the Proxy.
+ *
+ * Metrics (median of each sample unless noted):
+ *   cold_small_open_us   open+close of a small file the Proxy never saw
+ *   warm_small_open_us   the same open+close again, served from the cache
+ *   large_read_mbps      full read of a large file, cold
+ *   concurrent_reads_per_s
+ *                        warm small-file read sessions per second summed
+ *                        over CONCURRENT_READERS client processes
+ *   writer_close_us      close of a freshly written small file (upload)
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const size_t SMALL_LIMIT = 64 * 1024;
+static const size_t LARGE_LIMIT = 1024 * 1024;
+static const int SMALL_SAMPLES = 200;
+static const int LARGE_SAMPLES = 3;
+static const int WRITER_SAMPLES = 100;
+static const size_t WRITER_SIZE = 16 * 1024;
+static const int CONCURRENT_READERS = 8;
+static const double CONCURRENT_SECONDS = 3.0;
+static const size_t IO_BUF = 1024 * 1024;
+static const double DEFAULT_TOLERANCE_PCT = 20;
+/* 1 in a baseline made by 'perf_suite baseline', absent or 0 otherwise */
+static const char* RECORDED_KEY = "recorded";
+static const double MB = 1024.0 * 1024.0;
+
+/* a metric of the suite and which direction is an improvement */
+struct Metric {
+  const char* name;
+  bool lower_is_better;
+};
+
+static const Metric METRICS[] = {
+    {"cold_small_open_us", true},    {"warm_small_open_us", true},
+    {"large_read_mbps", false},      {"concurrent_reads_per_s", false},
+    {"writer_close_us", true},
+};
+static const int NUM_METRICS = sizeof(METRICS) / sizeof(METRICS[0]);
+
+double now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+double median(std::vector<double> samples) {
+  if (samples.empty()) {
+    return 0;
+  }
+  std::sort(samples.begin(), samples.end());
+  return samples[samples.size() / 2];
+}
+
+/* open, read everything, close; return bytes read or -1 */
+long read_whole(const std::string& path, std::vector<char>* buf) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  long total = 0;
+  ssize_t this_read;
+  while ((this_read = read(fd, buf->data(), buf->size())) > 0) {
+    total += this_read;
+  }
+  close(fd);
+  return (this_read < 0) ? -1 : total;
+}
+
+/* latency of open+close, the Validate (and download if cold) round trip */
+double open_close_us(const std::string& path) {
+  double start = now_us();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  close(fd);
+  return now_us() - start;
+}
+
+/* one concurrent reader process: warm read sessions until the deadline */
+int run_reader(const std::vector<std::string>& small, int pipe_fd) {
+  std::vector<char> buf(IO_BUF);
+  double deadline = now_us() + CONCURRENT_SECONDS * 1e6;
+  long sessions = 0;
+  for (size_t i = 0; now_us() < deadline; i++) {
+    if (read_whole(small[i % small.size()], &buf) >= 0) {
+      sessions++;
+    }
+  }
+  char line[64];
+  int len = snprintf(line, sizeof(line), "%ld\n", sessions);
+  // bypass the interposition library, the pipe is local
+  syscall(SYS_write, pipe_fd, line, len);
+  return 0;
+}
+
+/* sessions per second of CONCURRENT_READERS processes, each its own client */
+double concurrent_reads(const std::vector<std::string>& small) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return 0;
+  }
+  std::vector<pid_t> pids;
+  for (int r = 0; r < CONCURRENT_READERS; r++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      // a fresh exec gets its own Proxy connection from the library
+      std::string self = "perf_suite", mode = "reader";
+      std::string fd = std::to_string(fds[1]);
+      std::vector<char*> argv = {&self[0], &mode[0], &fd[0]};
+      for (const std::string& path : small) {
+        argv.push_back(const_cast<char*>(path.c_str()));
+      }
+      argv.push_back(nullptr);
+      execv("/proc/self/exe", argv.data());
+      _exit(1);
+    }
+    pids.push_back(pid);
+  }
+  close(fds[1]);
+  FILE* in = fdopen(fds[0], "r");
+  long total = 0, sessions;
+  while (fscanf(in, "%ld", &sessions) == 1) {
+    total += sessions;
+  }
+  fclose(in);
+  for (pid_t pid : pids) {
+    int status;
+    waitpid(pid, &status, 0);
+  }
+  return total / CONCURRENT_SECONDS;
+}
+
+int run_suite() {
+  std::vector<std::string> small, large;
+  char line[4096];
+  while (fgets(line, sizeof(line), stdin)) {
+    char path[4096];
+    size_t size;
+    if (sscanf(line, "%4095[^\t]\t%zu", path, &size) != 2) {
+      continue;
+    }
+    if (size <= SMALL_LIMIT && (int)small.size() < SMALL_SAMPLES) {
+      small.push_back(path);
+    } else if (size >= LARGE_LIMIT && (int)large.size() < LARGE_SAMPLES) {
+      large.push_back(path);
+    }
+  }
+  if (small.empty() || large.empty()) {
+    fprintf(stderr, "the manifest needs small (<=%zu) and large (>=%zu) "
+                    "files\n", SMALL_LIMIT, LARGE_LIMIT);
+    return 1;
+  }
+  std::map<std::string, double> results;
+  std::vector<double> cold, warm;
+  for (const std::string& path : small) {
+    cold.push_back(open_close_us(path));
+  }
+  for (const std::string& path : small) {
+    warm.push_back(open_close_us(path));
+  }
+  if (*std::min_element(cold.begin(), cold.end()) < 0) {
+    fprintf(stderr, "cannot open the dataset through the Proxy\n");
+    return 1;
+  }
+  results["cold_small_open_us"] = median(cold);
+  results["warm_small_open_us"] = median(warm);
+
+  std::vector<char> buf(IO_BUF);
+  std::vector<double> mbps;
+  for (const std::string& path : large) {
+    double start = now_us();
+    long bytes = read_whole(path, &buf);
+    if (bytes > 0) {
+      mbps.push_back(bytes / MB / ((now_us() - start) / 1e6));
+    }
+  }
+  results["large_read_mbps"] = median(mbps);
+  results["concurrent_reads_per_s"] = concurrent_reads(small);
+
+  std::vector<char> content(WRITER_SIZE, 'w');
+  std::vector<double> closes;
+  for (int i = 0; i < WRITER_SAMPLES; i++) {
+    std::string path = "perf_writer_" + std::to_string(i) + ".dat";
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT, S_IRWXU);
+    if (fd < 0 || write(fd, content.data(), content.size()) < 0) {
+      fprintf(stderr, "cannot write %s errno=%d\n", path.c_str(), errno);
+      return 1;
+    }
+    double start = now_us();
+    close(fd);
+    closes.push_back(now_us() - start);
+    unlink(path.c_str());
+  }
+  results["writer_close_us"] = median(closes);
+
+  printf("{\n");
+  for (int m = 0; m < NUM_METRICS; m++) {
+    printf("  \"%s\": %.3f%s\n", METRICS[m].name, results[METRICS[m].name],
+           (m + 1 < NUM_METRICS) ? "," : "");
+  }
+  printf("}\n");
+  return 0;
+}
+
+/**
+ * Read the flat JSON both files use: a metric maps either to a number (a run)
+ * or to {"value": n, "tolerance_pct": n} (a baseline). Nested fields are
+ * flattened as "metric.field"
+ */
+bool parse_json(const char* file, std::map<std::string, double>* out) {
+  std::ifstream in(file);
+  if (!in) {
+    fprintf(stderr, "cannot read %s\n", file);
+    return false;
+  }
+  std::stringstream ss;
+  ss << in.rdbuf();
+  std::string text = ss.str();
+  std::string outer, key;
+  bool in_object = false;
+  for (size_t i = 0; i < text.size(); i++) {
+    char c = text[i];
+    if (c == '"') {
+      size_t end = text.find('"', i + 1);
+      if (end == std::string::npos) {
+        return false;
+      }
+      key = text.substr(i + 1, end - i - 1);
+      i = end;
+    } else if (c == '{' && !key.empty()) {
+      outer = key;
+      in_object = true;
+    } else if (c == '}') {
+      in_object = false;
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+      char* end;
+      double value = strtod(text.c_str() + i, &end);
+      (*out)[in_object ? outer + "." + key : key] = value;
+      i = end - text.c_str() - 1;
+    }
+  }
+  return true;
+}
+
+// 0 if 'baseline_file' holds numbers recorded by 'make perf_baseline'
+int recorded(const char* baseline_file) {
+  std::map<std::string, double> baseline;
+  if (!parse_json(baseline_file, &baseline)) {
+    return 1;
+  }
+  return (baseline[RECORDED_KEY] == 0) ? 1 : 0;
+}
+
+int compare(const char* current_file, const char* baseline_file) {
+  std::map<std::string, double> current, baseline;
+  if (!parse_json(current_file, &current) ||
+      !parse_json(baseline_file, &baseline)) {
+    return 1;
+  }
+  if (baseline[RECORDED_KEY] == 0) {
+    // numbers nobody measured would pass or fail everything
+    fprintf(stderr,
+            "%s holds no recorded numbers, run 'make perf_baseline' on the "
+            "reference machine and commit it\n",
+            baseline_file);
+    return 2;
+  }
+  int failures = 0;
+  printf("%-24s %12s %12s %9s %9s  %s\n", "metric", "baseline", "current",
+         "diff", "allowed", "result");
+  for (int m = 0; m < NUM_METRICS; m++) {
+    std::string name = METRICS[m].name;
+    if (!current.count(name) || !baseline.count(name + ".value")) {
+      printf("%-24s missing from %s\n", name.c_str(),
+             current.count(name) ? baseline_file : current_file);
+      failures++;
+      continue;
+    }
+    double base = baseline[name + ".value"];
+    double tolerance = baseline.count(name + ".tolerance_pct")
+                           ? baseline[name + ".tolerance_pct"]
+                           : DEFAULT_TOLERANCE_PCT;
+    double value = current[name];
+    double diff_pct = (base != 0) ? (value - base) * 100 / base : 0;
+    // only a change in the worse direction counts against the band
+    double worse_pct = METRICS[m].lower_is_better ? diff_pct : -diff_pct;
+    bool pass = worse_pct <= tolerance;
+    printf("%-24s %12.3f %12.3f %+8.1f%% %8.1f%%  %s\n", name.c_str(), base,
+           value, diff_pct, tolerance, pass ? "ok" : "REGRESSION");
+    if (!pass) {
+      failures++;
+    }
+  }
+  printf("%s: %d of %d metrics failed\n", failures ? "FAIL" : "PASS",
+         failures, NUM_METRICS);
+  return failures ? 1 : 0;
+}
+
+int make_baseline(const char* current_file, double tolerance) {
+  std::map<std::string, double> current;
+  if (!parse_json(current_file, &current)) {
+    return 1;
+  }
+  printf("{\n  \"%s\": 1,\n", RECORDED_KEY);
+  for (int m = 0; m < NUM_METRICS; m++) {
+    printf("  \"%s\": {\"value\": %.3f, \"tolerance_pct\": %.1f}%s\n",
+           METRICS[m].name, current[METRICS[m].name], tolerance,
+           (m + 1 < NUM_METRICS) ? "," : "");
+  }
+  printf("}\n");
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc >= 2 && strcmp(argv[1], "run") == 0) {
+    return run_suite();
+  }
+  if (argc >= 4 && strcmp(argv[1], "reader") == 0) {
+    return run_reader(std::vector<std::string>(argv + 3, argv + argc),
+                      atoi(argv[2]));
+  }
+  if (argc >= 4 && strcmp(argv[1], "compare") == 0) {
+    return compare(argv[2], argv[3]);
+  }
+  if (argc >= 3 && strcmp(argv[1], "recorded") == 0) {
+    return recorded(argv[2]);
+  }
+  if (argc >= 3 && strcmp(argv[1], "baseline") == 0) {
+    return make_baseline(argv[2],
+                         (argc >= 4) ? atof(argv[3]) : DEFAULT_TOLERANCE_PCT);
+  }
+  printf("usage: LD_PRELOAD=../lib/lib440lib.so %s run < <root>.manifest\n",
+         argv[0]);
+  printf("       %s compare <current.json> <baseline.json>\n", argv[0]);
+  printf("       %s baseline <current.json> [tolerance_pct]\n", argv[0]);
+  printf("       %s recorded <baseline.json>\n", argv[0]);
+  return 1;
+}
@@ -0,0 +1,312 @@
+/**
+ * file: read_sweep.cpp
+ * author: Yukun Jiang
+ *
+ * Buffer size sweep benchmark for the interposition path.
+ *
+ * tester.cpp always reads 1024 bytes at a time, which hides how the per-call
+ * RPC cost through lib440lib.so scales with the buffer size. This benchmark
+ * sweeps read and write buffer sizes from 512B to 8MB across small, medium
+ * and large files, for both a cold and a warm proxy cache.
+ *
+ * Usage:
+ *   1. populate the server root before the Server starts
+ *        ./read_sweep prepare <server_root>
+ *   2. start Server and Proxy (cache must hold all files for warm numbers),
+ *      then run through the interposition library
+ *        LD_PRELOAD=../lib/lib440lib.so ./read_sweep run [warm_rounds]
+ *
+ * Running "run" inside the server root without LD_PRELOAD gives the local
+ * disk baseline for the same sweep.
+ *
+ * Every (file class, buffer size) pair reads its own file, so the first open
+ * of it is guaranteed cold (downloaded from Server) and the later rounds are
+ * warm (served from the Proxy cache).
+ *
+ * The per-call overhead is split with a null call: lseek(fd, 0, SEEK_CUR)
+ * does no work in the Proxy, so its latency is the fixed cost of the
+ * interposition layer and the RPC round trip. Whatever a read/write call
+ * costs above that floor is spent inside the Proxy (data copy and disk).
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static const char* SWEEP_DIR = "sweep";
+static const size_t MIN_BUF = 512;
+static const size_t MAX_BUF = 8 * 1024 * 1024;
+static const int NULL_CALLS = 2000;
+static const int DEFAULT_WARM_ROUNDS = 3;
+static const double MB = 1024.0 * 1024.0;
+
+struct FileClass {
+  const char* name;
+  size_t size;
+};
+
+/* small fits in one chunk, medium spans a few chunks, large spans many */
+static const FileClass FILE_CLASSES[] = {
+    {"small", 16 * 1024},
+    {"medium", 2 * 1024 * 1024},
+    {"large", 32 * 1024 * 1024},
+};
+static const int NUM_CLASSES = sizeof(FILE_CLASSES) / sizeof(FILE_CLASSES[0]);
+
+/* aggregated measurement of one open + io + close session */
+struct Sample {
+  double open_us = 0;
+  double io_us = 0;
+  double close_us = 0;
+  long calls = 0;
+  long bytes = 0;
+};
+
+double now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+std::vector<size_t> buffer_sizes() {
+  std::vector<size_t> sizes;
+  for (size_t b = MIN_BUF; b <= MAX_BUF; b *= 2) {
+    sizes.push_back(b);
+  }
+  return sizes;
+}
+
+std::string file_name(const char* prefix, const FileClass& cls, size_t buf) {
+  char name[256];
+  snprintf(name, sizeof(name), "%s/%s%s_%zu.dat", SWEEP_DIR, prefix, cls.name,
+           buf);
+  return std::string(name);
+}
+
+/* write exactly len bytes, with buf_size bytes per write call */
+bool full_write(int fd, const char* buf, size_t len, size_t buf_size,
+                long* calls) {
+  size_t written = 0;
+  while (written < len) {
+    size_t this_len = std::min(buf_size, len - written);
+    ssize_t this_write = write(fd, buf, this_len);
+    if (this_write <= 0) {
+      return false;
+    }
+    written += this_write;
+    ++*calls;
+  }
+  return true;
+}
+
+/* read until EOF, with buf_size bytes per read call */
+long full_read(int fd, char* buf, size_t buf_size, long* calls) {
+  long reads = 0;
+  ssize_t this_read;
+  while ((this_read = read(fd, buf, buf_size)) > 0) {
+    reads += this_read;
+    ++*calls;
+  }
+  ++*calls;  // the final call hitting EOF
+  return (this_read < 0) ? -1 : reads;
+}
+
+/**
+ * Create every read fixture directly under the server root.
+ * Must run without LD_PRELOAD and before the Server scans its root.
+ */
+int prepare(const char* server_root) {
+  std::vector<char> content(FILE_CLASSES[NUM_CLASSES - 1].size);
+  for (size_t i = 0; i < content.size(); i++) {
+    content[i] = 'a' + (i % 26);
+  }
+  std::string dir = std::string(server_root) + "/" + SWEEP_DIR;
+  mkdir(dir.c_str(), S_IRWXU);
+  for (int c = 0; c < NUM_CLASSES; c++) {
+    for (size_t buf : buffer_sizes()) {
+      std::string path =
+          std::string(server_root) + "/" + file_name("", FILE_CLASSES[c], buf);
+      int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+      long calls = 0;
+      if (fd < 0 || !full_write(fd, content.data(), FILE_CLASSES[c].size,
+                                MAX_BUF, &calls)) {
+        printf("failed to prepare %s errno=%d\n", path.c_str(), errno);
+        return 1;
+      }
+      close(fd);
+    }
+  }
+  printf("prepared %d files under %s\n",
+         NUM_CLASSES * (int)buffer_sizes().size(), dir.c_str());
+  return 0;
+}
+
+/* latency of one call that only round-trips through interposition + Proxy */
+double null_call_us(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  double start = now_us();
+  for (int i = 0; i < NULL_CALLS; i++) {
+    lseek(fd, 0, SEEK_CUR);
+  }
+  double elapsed = now_us() - start;
+  close(fd);
+  return elapsed / NULL_CALLS;
+}
+
+bool read_session(const std::string& path, char* buf, size_t buf_size,
+                  Sample* s) {
+  double t0 = now_us();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    printf("open %s failed errno=%d\n", path.c_str(), errno);
+    return false;
+  }
+  double t1 = now_us();
+  long calls = 0;
+  long bytes = full_read(fd, buf, buf_size, &calls);
+  double t2 = now_us();
+  close(fd);
+  double t3 = now_us();
+  if (bytes < 0) {
+    printf("read %s failed errno=%d\n", path.c_str(), errno);
+    return false;
+  }
+  s->open_us += t1 - t0;
+  s->io_us += t2 - t1;
+  s->close_us += t3 - t2;
+  s->calls += calls;
+  s->bytes += bytes;
+  return true;
+}
+
+bool write_session(const std::string& path, const char* buf, size_t len,
+                   size_t buf_size, Sample* s) {
+  double t0 = now_us();
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT, S_IRWXU);
+  if (fd < 0) {
+    printf("open %s failed errno=%d\n", path.c_str(), errno);
+    return false;
+  }
+  double t1 = now_us();
+  long calls = 0;
+  bool success = full_write(fd, buf, len, buf_size, &calls);
+  double t2 = now_us();
+  // close uploads the new version, so it is part of the write cost
+  close(fd);
+  double t3 = now_us();
+  if (!success) {
+    printf("write %s failed errno=%d\n", path.c_str(), errno);
+    return false;
+  }
+  s->open_us += t1 - t0;
+  s->io_us += t2 - t1;
+  s->close_us += t3 - t2;
+  s->calls += calls;
+  s->bytes += len;
+  return true;
+}
+
+void print_header() {
+  printf("%-5s %-6s %-4s %8s %10s %10s %10s %10s %10s %10s %10s\n", "op",
+         "class", "mode", "buf", "open_ms", "close_ms", "ops/s", "MB/s",
+         "us/call", "floor_us", "proxy_us");
+}
+
+void print_sample(const char* op, const FileClass& cls, const char* mode,
+                  size_t buf, const Sample& s, int rounds, double floor_us) {
+  double per_call = (s.calls > 0) ? s.io_us / s.calls : 0;
+  double ops = (s.io_us > 0) ? s.calls / (s.io_us / 1e6) : 0;
+  double mbps = (s.io_us > 0) ? (s.bytes / MB) / (s.io_us / 1e6) : 0;
+  double proxy_us = (per_call > floor_us) ? per_call - floor_us : 0;
+  printf(
+      "%-5s %-6s %-4s %8zu %10.3f %10.3f %10.0f %10.2f %10.2f %10.2f %10.2f\n",
+      op, cls.name, mode, buf, s.open_us / rounds / 1e3,
+      s.close_us / rounds / 1e3, ops, mbps, per_call, floor_us, proxy_us);
+}
+
+int run(int warm_rounds) {
+  std::vector<char> buf(MAX_BUF);
+  memset(buf.data(), 'x', buf.size());
+  std::vector<size_t> sizes = buffer_sizes();
+
+  // warm the floor file first so the null calls never hit the Server
+  std::string floor_path = file_name("", FILE_CLASSES[0], MIN_BUF);
+  Sample ignored;
+  if (!read_session(floor_path, buf.data(), MIN_BUF, &ignored)) {
+    printf("missing fixtures, run './read_sweep prepare <server_root>'\n");
+    return 1;
+  }
+  double floor_us = null_call_us(floor_path.c_str());
+  printf("null call (interposition + RPC floor) = %.2f us\n\n", floor_us);
+  print_header();
+
+  for (int c = 0; c < NUM_CLASSES; c++) {
+    const FileClass& cls = FILE_CLASSES[c];
+    for (size_t b : sizes) {
+      std::string path = file_name("", cls, b);
+      Sample cold, warm;
+      // the floor file was already read once, it cannot be cold anymore
+      bool is_cold = (path != floor_path);
+      if (is_cold && !read_session(path, buf.data(), b, &cold)) {
+        return 1;
+      }
+      for (int r = 0; r < warm_rounds; r++) {
+        if (!read_session(path, buf.data(), b, &warm)) {
+          return 1;
+        }
+      }
+      if (is_cold) {
+        print_sample("read", cls, "cold", b, cold, 1, floor_us);
+      }
+      print_sample("read", cls, "warm", b, warm, warm_rounds, floor_us);
+    }
+  }
+
+  for (int c = 0; c < NUM_CLASSES; c++) {
+    const FileClass& cls = FILE_CLASSES[c];
+    for (size_t b : sizes) {
+      // cold write creates a new file, warm write copies the cached version
+      std::string path = file_name("w_", cls, b);
+      unlink(path.c_str());
+      Sample cold, warm;
+      if (!write_session(path, buf.data(), cls.size, b, &cold)) {
+        return 1;
+      }
+      for (int r = 0; r < warm_rounds; r++) {
+        if (!write_session(path, buf.data(), cls.size, b, &warm)) {
+          return 1;
+        }
+      }
+      print_sample("write", cls, "cold", b, cold, 1, floor_us);
+      print_sample("write", cls, "warm", b, warm, warm_rounds, floor_us);
+      unlink(path.c_str());
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc >= 3 && strcmp(argv[1], "prepare") == 0) {
+    return prepare(argv[2]);
+  }
+  if (argc >= 2 && strcmp(argv[1], "run") == 0) {
+    int warm_rounds = (argc >= 3) ? atoi(argv[2]) : DEFAULT_WARM_ROUNDS;
+    return run((warm_rounds > 0) ? warm_rounds : DEFAULT_WARM_ROUNDS);
+  }
+  printf("usage: %s prepare <server_root>\n", argv[0]);
+  printf("       LD_PRELOAD=../lib/lib440lib.so %s run [warm_rounds]\n",
+         argv[0]);
+  return 1;
+}
@@ -0,0 +1,475 @@
+/**
+ * file: session_oracle.cpp
+ * author: Yukun Jiang
+ *
+ * Session-semantics correctness oracle for concurrent stress runs.
+ *
+ * tester.cpp's test_5 and test_lru_4 print what concurrent readers and
+ * writers see and leave the judgement to the eye. This tool runs randomized
+ * concurrent open/read/write/close histories through one or more Proxies and
+ * checks every read session against session semantics automatically:
+ *
+ *   torn        a read session saw bytes of more than one version
+ *   phantom     a read session saw a version no writer ever closed
+ *   uncommitted a read session saw a version whose close started only after
+ *               the read's open returned
+ *   stale       a read session saw a version older than one whose close had
+ *               already returned before the read's open started
+ *   error       an open/read/write/close failed
+ *
+ * Every writer fills the whole file with fixed-size records naming the file,
+ * itself and a sequence number, so any read identifies the version it saw.
+ * All versions of a file have the same length, so an overwrite never leaves
+ * the tail of an older version behind. Times come from CLOCK_MONOTONIC,
+ * which all client processes on one machine share.
+ *
+ * Usage:
+ *   ./session_oracle <lib440lib.so> <port[,port...]> [clients] [sessions]
+ *                    [files] [seed] [write_percent] [stale_slack_ms]
+ *
+ * Each client is a separate process preloaded with the interposition library
+ * and bound round-robin to one of the Proxy ports. A non-zero stale_slack_ms
+ * tolerates Proxies that validate lazily (e.g. subtree validation windows).
+ * The exit code is 1 if any violation was found.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+static const char* PORT_ENV = "proxyport15440";
+static const char* FILE_PREFIX = "oracle_f";
+static const int RECORD_SIZE = 32;
+static const int RECORDS_PER_FILE = 2048;  // 64KB, spans no chunk boundary
+static const int FILE_LEN = RECORD_SIZE * RECORDS_PER_FILE;
+static const int MAX_IO = 8192;
+static const int MAX_PAUSE_US = 2000;
+static const int INIT_WRITER = 999;
+static const long NO_VERSION = -1;
+static const long TORN_VERSION = -2;
+static const int MAX_REPORTED = 20;
+
+static const int DEFAULT_CLIENTS = 8;
+static const int DEFAULT_SESSIONS = 200;
+static const int DEFAULT_FILES = 4;
+static const int DEFAULT_SEED = 15440;
+static const int DEFAULT_WRITE_PERCENT = 30;
+
+/* one open..close session as a client saw it */
+struct Session {
+  char kind = 'R';  // 'R'ead or 'W'rite
+  int client = 0;
+  int file = 0;
+  long version = NO_VERSION;  // written, or seen by a read
+  double open_start = 0;
+  double open_end = 0;
+  double close_start = 0;
+  double close_end = 0;
+  int err = 0;
+  long bytes = 0;
+};
+
+double now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+std::string file_name(int file) {
+  return std::string(FILE_PREFIX) + std::to_string(file) + ".dat";
+}
+
+long version_of(int writer, int seq) { return (long)writer * 1000000 + seq; }
+
+/* the record a version repeats over its whole file */
+std::string make_record(int file, long version) {
+  char record[RECORD_SIZE + 1];
+  int len = snprintf(record, sizeof(record), "f%d v%ld|", file, version);
+  memset(record + len, '.', RECORD_SIZE - len - 1);
+  record[RECORD_SIZE - 1] = '\n';
+  return std::string(record, RECORD_SIZE);
+}
+
+/* which version a whole file's content is, TORN_VERSION if not just one */
+long parse_content(int file, const std::vector<char>& content) {
+  if (content.size() != (size_t)FILE_LEN) {
+    return TORN_VERSION;
+  }
+  long version;
+  int parsed_file;
+  std::string first(content.data(), RECORD_SIZE);
+  if (sscanf(first.c_str(), "f%d v%ld|", &parsed_file, &version) != 2 ||
+      parsed_file != file || make_record(file, version) != first) {
+    return TORN_VERSION;
+  }
+  for (int r = 1; r < RECORDS_PER_FILE; r++) {
+    if (memcmp(content.data() + r * RECORD_SIZE, first.data(), RECORD_SIZE)) {
+      return TORN_VERSION;
+    }
+  }
+  return version;
+}
+
+/* report to the parent around the interposition library */
+void report(int pipe_fd, const Session& s) {
+  char line[256];
+  int len = snprintf(line, sizeof(line),
+                     "%c %d %d %ld %.3f %.3f %.3f %.3f %d %ld\n", s.kind,
+                     s.client, s.file, s.version, s.open_start, s.open_end,
+                     s.close_start, s.close_end, s.err, s.bytes);
+  // one write below PIPE_BUF is atomic among all clients sharing the pipe
+  syscall(SYS_write, pipe_fd, line, len);
+}
+
+Session write_session(int client, int file, long version, std::mt19937* rng) {
+  Session s;
+  s.kind = 'W';
+  s.client = client;
+  s.file = file;
+  s.version = version;
+  std::string record = make_record(file, version);
+  std::string content;
+  for (int r = 0; r < RECORDS_PER_FILE; r++) {
+    content += record;
+  }
+  s.open_start = now_us();
+  int fd = open(file_name(file).c_str(), O_WRONLY | O_CREAT, S_IRWXU);
+  s.open_end = now_us();
+  if (fd < 0) {
+    s.err = errno;
+    return s;
+  }
+  std::uniform_int_distribution<int> io_size(1, MAX_IO);
+  std::uniform_int_distribution<int> pause(0, MAX_PAUSE_US);
+  while (s.bytes < FILE_LEN) {
+    int len = std::min(io_size(*rng), FILE_LEN - (int)s.bytes);
+    ssize_t written = write(fd, content.data() + s.bytes, len);
+    if (written <= 0) {
+      s.err = errno;
+      break;
+    }
+    s.bytes += written;
+    if (s.bytes < FILE_LEN && pause(*rng) < MAX_PAUSE_US / 8) {
+      // stay open a while so that sessions overlap
+      usleep(pause(*rng));
+    }
+  }
+  s.close_start = now_us();
+  if (close(fd) != 0 && s.err == 0) {
+    s.err = errno;
+  }
+  s.close_end = now_us();
+  return s;
+}
+
+Session read_session(int client, int file, std::mt19937* rng) {
+  Session s;
+  s.kind = 'R';
+  s.client = client;
+  s.file = file;
+  std::vector<char> content;
+  std::vector<char> buf(MAX_IO);
+  s.open_start = now_us();
+  int fd = open(file_name(file).c_str(), O_RDONLY);
+  s.open_end = now_us();
+  if (fd < 0) {
+    s.err = errno;
+    return s;
+  }
+  std::uniform_int_distribution<int> io_size(1, MAX_IO);
+  std::uniform_int_distribution<int> pause(0, MAX_PAUSE_US);
+  ssize_t this_read;
+  while ((this_read = read(fd, buf.data(), io_size(*rng))) > 0) {
+    content.insert(content.end(), buf.data(), buf.data() + this_read);
+    if (pause(*rng) < MAX_PAUSE_US / 8) {
+      // give writers the chance to commit in the middle of this session
+      usleep(pause(*rng));
+    }
+  }
+  if (this_read < 0) {
+    s.err = errno;
+  }
+  s.bytes = content.size();
+  s.close_start = now_us();
+  if (close(fd) != 0 && s.err == 0) {
+    s.err = errno;
+  }
+  s.close_end = now_us();
+  s.version = parse_content(file, content);
+  return s;
+}
+
+/* create the initial version of every file */
+int run_init(int files, int pipe_fd) {
+  std::mt19937 rng(0);
+  for (int f = 0; f < files; f++) {
+    report(pipe_fd, write_session(INIT_WRITER, f, version_of(INIT_WRITER, f),
+                                  &rng));
+  }
+  return 0;
+}
+
+int run_client(int client, int sessions, int files, int seed,
+               int write_percent, int pipe_fd) {
+  std::mt19937 rng(seed * 7919 + client);
+  std::uniform_int_distribution<int> pick_file(0, files - 1);
+  std::uniform_int_distribution<int> percent(0, 99);
+  int seq = 0;
+  for (int i = 0; i < sessions; i++) {
+    int file = pick_file(rng);
+    if (percent(rng) < write_percent) {
+      report(pipe_fd,
+             write_session(client, file, version_of(client, seq++), &rng));
+    } else {
+      report(pipe_fd, read_session(client, file, &rng));
+    }
+  }
+  return 0;
+}
+
+/* re-exec this binary preloaded and bound to one Proxy */
+pid_t spawn(const char* lib, const std::string& port,
+            std::vector<std::string> args) {
+  pid_t pid = fork();
+  if (pid != 0) {
+    return pid;
+  }
+  setenv("LD_PRELOAD", lib, 1);
+  setenv(PORT_ENV, port.c_str(), 1);
+  std::vector<char*> argv;
+  std::string self = "session_oracle";
+  argv.push_back(&self[0]);
+  for (std::string& arg : args) {
+    argv.push_back(&arg[0]);
+  }
+  argv.push_back(nullptr);
+  execv("/proc/self/exe", argv.data());
+  perror("execv");
+  _exit(1);
+}
+
+/* read every reported session until all writers of the pipe are gone */
+std::vector<Session> collect(int pipe_fd) {
+  std::vector<Session> sessions;
+  FILE* in = fdopen(pipe_fd, "r");
+  char line[256];
+  while (fgets(line, sizeof(line), in)) {
+    Session s;
+    if (sscanf(line, "%c %d %d %ld %lf %lf %lf %lf %d %ld", &s.kind,
+               &s.client, &s.file, &s.version, &s.open_start, &s.open_end,
+               &s.close_start, &s.close_end, &s.err, &s.bytes) == 10) {
+      sessions.push_back(s);
+    }
+  }
+  fclose(in);
+  return sessions;
+}
+
+void wait_all(const std::vector<pid_t>& pids) {
+  for (pid_t pid : pids) {
+    int status;
+    waitpid(pid, &status, 0);
+  }
+}
+
+/* committed writers of one file, with the latest close_start among all
+   writers whose close returned no later than each one, in close_end order */
+struct FileWriters {
+  std::vector<double> close_end;
+  std::vector<double> max_close_start;
+};
+
+int check(const std::vector<Session>& sessions, double stale_slack_us) {
+  std::map<long, const Session*> committed;
+  std::map<long, const Session*> uncertain;
+  std::map<int, std::vector<const Session*>> by_file;
+  for (const Session& s : sessions) {
+    if (s.kind != 'W') {
+      continue;
+    }
+    if (s.err == 0) {
+      committed[s.version] = &s;
+      by_file[s.file].push_back(&s);
+    } else {
+      // a failed close may or may not have committed on Server
+      uncertain[s.version] = &s;
+    }
+  }
+  std::map<int, FileWriters> writers;
+  for (auto& entry : by_file) {
+    std::vector<const Session*>& list = entry.second;
+    std::sort(list.begin(), list.end(), [](const Session* a, const Session* b) {
+      return a->close_end < b->close_end;
+    });
+    FileWriters& fw = writers[entry.first];
+    double max_start = 0;
+    for (const Session* w : list) {
+      max_start = std::max(max_start, w->close_start);
+      fw.close_end.push_back(w->close_end);
+      fw.max_close_start.push_back(max_start);
+    }
+  }
+
+  std::map<std::string, int> counts;
+  int violations = 0;
+  auto violate = [&](const char* rule, const Session& s, const char* detail) {
+    counts[rule]++;
+    if (++violations <= MAX_REPORTED) {
+      printf("VIOLATION %-11s client=%d file=%d version=%ld open=[%.0f,%.0f]"
+             " %s\n",
+             rule, s.client, s.file, s.version, s.open_start, s.open_end,
+             detail);
+    }
+  };
+  for (const Session& s : sessions) {
+    if (s.err != 0) {
+      char detail[64];
+      snprintf(detail, sizeof(detail), "%s errno=%d",
+               (s.kind == 'R') ? "read" : "write", s.err);
+      violate("error", s, detail);
+      continue;
+    }
+    if (s.kind != 'R') {
+      continue;
+    }
+    if (s.version == TORN_VERSION) {
+      violate("torn", s, "");
+      continue;
+    }
+    auto it = committed.find(s.version);
+    if (it == committed.end()) {
+      if (uncertain.find(s.version) == uncertain.end()) {
+        violate("phantom", s, "");
+      }
+      continue;
+    }
+    const Session& w = *it->second;
+    if (w.close_start > s.open_end) {
+      violate("uncommitted", s, "writer closed after the read opened");
+      continue;
+    }
+    // every writer whose close returned before this open started must not
+    // be newer than the version this read saw
+    const FileWriters& fw = writers[s.file];
+    size_t n = std::lower_bound(fw.close_end.begin(), fw.close_end.end(),
+                                s.open_start - stale_slack_us) -
+               fw.close_end.begin();
+    if (n > 0 && w.close_end < fw.max_close_start[n - 1]) {
+      violate("stale", s, "a newer version was already closed");
+    }
+  }
+  if (violations > MAX_REPORTED) {
+    printf("... %d more violations not shown\n", violations - MAX_REPORTED);
+  }
+  for (auto& entry : counts) {
+    printf("%-11s %d\n", entry.first.c_str(), entry.second);
+  }
+  return violations;
+}
+
+void report_throughput(const std::vector<Session>& sessions,
+                       double elapsed_us) {
+  long reads = 0, writes = 0, bytes = 0;
+  double read_us = 0, write_us = 0;
+  for (const Session& s : sessions) {
+    if (s.client == INIT_WRITER) {
+      continue;
+    }
+    if (s.kind == 'R') {
+      reads++;
+      read_us += s.close_end - s.open_start;
+    } else {
+      writes++;
+      write_us += s.close_end - s.open_start;
+    }
+    bytes += s.bytes;
+  }
+  double secs = elapsed_us / 1e6;
+  printf("sessions=%ld (reads=%ld writes=%ld) in %.2f s\n", reads + writes,
+         reads, writes, secs);
+  printf("throughput: %.1f sessions/s, %.2f MB/s\n", (reads + writes) / secs,
+         bytes / (1024.0 * 1024.0) / secs);
+  printf("mean session latency: read %.3f ms, write %.3f ms\n",
+         reads ? read_us / reads / 1e3 : 0,
+         writes ? write_us / writes / 1e3 : 0);
+}
+
+std::vector<std::string> split_ports(const char* ports) {
+  std::vector<std::string> list;
+  std::string all(ports);
+  size_t start = 0, comma;
+  while ((comma = all.find(',', start)) != std::string::npos) {
+    list.push_back(all.substr(start, comma - start));
+    start = comma + 1;
+  }
+  list.push_back(all.substr(start));
+  return list;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc >= 4 && strcmp(argv[1], "init") == 0) {
+    return run_init(atoi(argv[2]), atoi(argv[3]));
+  }
+  if (argc >= 8 && strcmp(argv[1], "client") == 0) {
+    return run_client(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]),
+                      atoi(argv[5]), atoi(argv[6]), atoi(argv[7]));
+  }
+  if (argc < 3) {
+    printf("usage: %s <lib440lib.so> <port[,port...]> [clients] [sessions] "
+           "[files] [seed] [write_percent] [stale_slack_ms]\n",
+           argv[0]);
+    return 1;
+  }
+  const char* lib = argv[1];
+  std::vector<std::string> ports = split_ports(argv[2]);
+  int clients = (argc > 3) ? atoi(argv[3]) : DEFAULT_CLIENTS;
+  int sessions = (argc > 4) ? atoi(argv[4]) : DEFAULT_SESSIONS;
+  int files = (argc > 5) ? atoi(argv[5]) : DEFAULT_FILES;
+  int seed = (argc > 6) ? atoi(argv[6]) : DEFAULT_SEED;
+  int write_percent = (argc > 7) ? atoi(argv[7]) : DEFAULT_WRITE_PERCENT;
+  double stale_slack_us = (argc > 8) ? atof(argv[8]) * 1e3 : 0;
+
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    return 1;
+  }
+  std::string pipe_fd = std::to_string(fds[1]);
+  std::vector<pid_t> pids;
+  pids.push_back(
+      spawn(lib, ports[0], {"init", std::to_string(files), pipe_fd}));
+  wait_all(pids);
+  pids.clear();
+
+  double start = now_us();
+  for (int c = 0; c < clients; c++) {
+    pids.push_back(spawn(lib, ports[c % ports.size()],
+                         {"client", std::to_string(c), std::to_string(sessions),
+                          std::to_string(files), std::to_string(seed),
+                          std::to_string(write_percent), pipe_fd}));
+  }
+  close(fds[1]);
+  std::vector<Session> history = collect(fds[0]);
+  wait_all(pids);
+  double elapsed = now_us() - start;
+
+  printf("clients=%d proxies=%zu files=%d seed=%d write=%d%%\n", clients,
+         ports.size(), files, seed, write_percent);
+  report_throughput(history, elapsed);
+  int violations = check(history, stale_slack_us);
+  printf("%d violations\n", violations);
+  return (violations > 0) ? 1 : 0;
+}
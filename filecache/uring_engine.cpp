@@ -0,0 +1,393 @@
+/**
+ * file: uring_engine.cpp
+ * author: Yukun Jiang
+ * date: Mar 15
+ *
+ * Native io_uring engine behind UringEngine.java, built into
+ * ../lib/libfilecache_uring.so by 'make uring_engine'
+ *
+ * One call submits a whole batch of chunk reads and writes with a single
+ * io_uring_enter and waits for all of them. Data goes through buffers
+ * registered once with the ring (READ_FIXED / WRITE_FIXED), taken from a
+ * shared pool, so the kernel does not pin pages per request. Requests name
+ * the FileDescriptor of a file the Java side already has open, so a batch
+ * makes no open or close syscalls
+ *
+ * A ring whose io_uring_enter fails in a way that may leave requests in
+ * flight is never used again: Submit reports it broken, and the Java side
+ * does its I/O through FileChannel from then on
+ *
+ * Uses the raw syscalls and <linux/io_uring.h> only, no liburing. If the
+ * kernel or a seccomp filter refuses io_uring_setup, Open returns 0 and the
+ * Java side stays on RandomAccessFile
+ * */
+
+#include <errno.h>
+#include <jni.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+int IoUringSetup(unsigned entries, io_uring_params *params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+int IoUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+                 unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      nullptr, 0);
+}
+
+int IoUringRegister(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* one read or write of a batch */
+struct Request {
+  int fd;
+  bool write;
+  unsigned long long offset;
+  unsigned length;
+  int buffer;
+  int result;
+};
+
+class Ring {
+ public:
+  ~Ring() { Close(); }
+
+  /* false if io_uring is not usable here */
+  bool Open(unsigned entries, unsigned buffer_count, unsigned buffer_size) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd_ = IoUringSetup(entries, &params);
+    if (ring_fd_ < 0) {
+      return false;
+    }
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+      sq_size_ = cq_size_ = (sq_size_ > cq_size_) ? sq_size_ : cq_size_;
+    }
+    sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+      sq_ptr_ = nullptr;
+      return false;
+    }
+    cq_ptr_ = single_mmap
+                  ? sq_ptr_
+                  : mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring_fd_,
+                         IORING_OFF_CQ_RING);
+    if (cq_ptr_ == MAP_FAILED) {
+      cq_ptr_ = nullptr;
+      return false;
+    }
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = (io_uring_sqe *)mmap(nullptr, sqes_size_,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring_fd_,
+                                 IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+      sqes_ = nullptr;
+      return false;
+    }
+    char *sq = (char *)sq_ptr_;
+    char *cq = (char *)cq_ptr_;
+    sq_head_ = (std::atomic<unsigned> *)(sq + params.sq_off.head);
+    sq_tail_ = (std::atomic<unsigned> *)(sq + params.sq_off.tail);
+    sq_mask_ = *(unsigned *)(sq + params.sq_off.ring_mask);
+    sq_array_ = (unsigned *)(sq + params.sq_off.array);
+    cq_head_ = (std::atomic<unsigned> *)(cq + params.cq_off.head);
+    cq_tail_ = (std::atomic<unsigned> *)(cq + params.cq_off.tail);
+    cq_mask_ = *(unsigned *)(cq + params.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    entries_ = params.sq_entries;
+
+    // the shared pool, registered once so requests skip page pinning
+    buffer_size_ = buffer_size;
+    std::vector<iovec> iovecs(buffer_count);
+    for (unsigned i = 0; i < buffer_count; i++) {
+      void *buffer = nullptr;
+      if (posix_memalign(&buffer, 4096, buffer_size) != 0) {
+        return false;
+      }
+      buffers_.push_back(buffer);
+      iovecs[i].iov_base = buffer;
+      iovecs[i].iov_len = buffer_size;
+    }
+    return IoUringRegister(ring_fd_, IORING_REGISTER_BUFFERS, iovecs.data(),
+                           buffer_count) == 0;
+  }
+
+  void Close() {
+    if (sqes_ != nullptr) {
+      munmap(sqes_, sqes_size_);
+    }
+    if (cq_ptr_ != nullptr && cq_ptr_ != sq_ptr_) {
+      munmap(cq_ptr_, cq_size_);
+    }
+    if (sq_ptr_ != nullptr) {
+      munmap(sq_ptr_, sq_size_);
+    }
+    if (ring_fd_ >= 0) {
+      close(ring_fd_);
+    }
+    for (void *buffer : buffers_) {
+      free(buffer);
+    }
+    sqes_ = nullptr;
+    cq_ptr_ = sq_ptr_ = nullptr;
+    ring_fd_ = -1;
+    buffers_.clear();
+  }
+
+  unsigned BatchLimit() const {
+    return (entries_ < buffers_.size()) ? entries_ : (unsigned)buffers_.size();
+  }
+
+  unsigned BufferSize() const { return buffer_size_; }
+
+  char *Buffer(int index) { return (char *)buffers_[index]; }
+
+  /* the kernel may still use the buffers of an earlier batch */
+  bool Broken() const { return broken_; }
+
+  /**
+   * Run 'requests' (at most BatchLimit) with one submit, wait for all
+   * If io_uring_enter fails, every entry the kernel took is still waited
+   * for, so that no completion is left to a later batch. If that cannot be
+   * made sure of, the ring is Broken and must not run anything anymore
+   */
+  void Run(std::vector<Request> &requests) {
+    unsigned tail = sq_tail_->load(std::memory_order_relaxed);
+    for (size_t i = 0; i < requests.size(); i++) {
+      Request &r = requests[i];
+      unsigned index = tail & sq_mask_;
+      io_uring_sqe *sqe = &sqes_[index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = r.write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+      sqe->fd = r.fd;
+      sqe->off = r.offset;
+      sqe->addr = (unsigned long long)buffers_[r.buffer];
+      sqe->len = r.length;
+      sqe->buf_index = (unsigned short)r.buffer;
+      sqe->user_data = i;
+      sq_array_[index] = index;
+      tail++;
+    }
+    sq_tail_->store(tail, std::memory_order_release);
+    unsigned total = (unsigned)requests.size();
+    std::vector<bool> done(total, false);
+    unsigned completed = 0;
+    int error = 0;
+    while (completed < total) {
+      // entries the kernel has not consumed yet
+      unsigned to_submit = tail - sq_head_->load(std::memory_order_acquire);
+      int ret = IoUringEnter(ring_fd_, to_submit, total - completed,
+                             IORING_ENTER_GETEVENTS);
+      if (ret < 0 && errno != EINTR) {
+        error = errno;
+        break;
+      }
+      completed += Reap(requests, done);
+    }
+    if (error == 0) {
+      return;
+    }
+    if (sq_head_->load(std::memory_order_acquire) != tail) {
+      // these would run with a later batch, on buffers it reuses
+      broken_ = true;
+    }
+    while (!broken_ && completed < total) {
+      // wait out what is in flight without submitting anything
+      int ret = IoUringEnter(ring_fd_, 0, total - completed,
+                             IORING_ENTER_GETEVENTS);
+      if (ret < 0 && errno != EINTR) {
+        broken_ = true;
+        break;
+      }
+      completed += Reap(requests, done);
+    }
+    for (unsigned i = 0; i < total; i++) {
+      if (!done[i]) {
+        requests[i].result = -error;
+      }
+    }
+  }
+
+  /* one batch at a time owns the ring */
+  std::mutex mtx_;
+
+ private:
+  /* record every completion queued so far, return how many */
+  unsigned Reap(std::vector<Request> &requests, std::vector<bool> &done) {
+    unsigned reaped = 0;
+    unsigned head = cq_head_->load(std::memory_order_relaxed);
+    while (head != cq_tail_->load(std::memory_order_acquire)) {
+      io_uring_cqe *cqe = &cqes_[head & cq_mask_];
+      if (cqe->user_data < requests.size() && !done[cqe->user_data]) {
+        requests[cqe->user_data].result = cqe->res;
+        done[cqe->user_data] = true;
+        reaped++;
+      }
+      head++;
+    }
+    cq_head_->store(head, std::memory_order_release);
+    return reaped;
+  }
+
+  int ring_fd_ = -1;
+  bool broken_ = false;
+  void *sq_ptr_ = nullptr;
+  void *cq_ptr_ = nullptr;
+  size_t sq_size_ = 0;
+  size_t cq_size_ = 0;
+  size_t sqes_size_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  std::atomic<unsigned> *sq_head_ = nullptr;
+  std::atomic<unsigned> *sq_tail_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned *sq_array_ = nullptr;
+  std::atomic<unsigned> *cq_head_ = nullptr;
+  std::atomic<unsigned> *cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe *cqes_ = nullptr;
+  unsigned entries_ = 0;
+  unsigned buffer_size_ = 0;
+  std::vector<void *> buffers_;
+};
+
+}  // namespace
+
+extern "C" {
+
+/* a ring handle, 0 if io_uring is not available */
+JNIEXPORT jlong JNICALL Java_UringEngine_Open(JNIEnv *env, jclass clazz,
+                                              jint entries,
+                                              jint buffer_count,
+                                              jint buffer_size) {
+  Ring *ring = new Ring();
+  if (!ring->Open((unsigned)entries, (unsigned)buffer_count,
+                  (unsigned)buffer_size)) {
+    delete ring;
+    return 0;
+  }
+  return (jlong)ring;
+}
+
+/* how many requests one Submit may carry */
+JNIEXPORT jint JNICALL Java_UringEngine_BatchLimit(JNIEnv *env, jclass clazz,
+                                                   jlong handle) {
+  return (jint)((Ring *)handle)->BatchLimit();
+}
+
+/**
+ * Run a batch: request i reads data[i].length bytes of the open file fds[i]
+ * at offsets[i] into data[i], or writes all of data[i] there if writes[i]
+ * results[i] is the bytes transferred or -errno
+ * return false once the ring is broken, see Ring::Run
+ */
+JNIEXPORT jboolean JNICALL Java_UringEngine_Submit(
+    JNIEnv *env, jclass clazz, jlong handle, jobjectArray fds,
+    jlongArray offsets, jobjectArray data, jbooleanArray writes,
+    jintArray results) {
+  Ring *ring = (Ring *)handle;
+  // java.io.FileDescriptor keeps the raw fd in a private int field
+  static jfieldID fd_field = nullptr;
+  if (fd_field == nullptr) {
+    jclass descriptor = env->FindClass("java/io/FileDescriptor");
+    fd_field = env->GetFieldID(descriptor, "fd", "I");
+    env->DeleteLocalRef(descriptor);
+  }
+  jsize n = env->GetArrayLength(fds);
+  std::vector<jlong> offset(n);
+  std::vector<jboolean> write(n);
+  std::vector<jint> result(n);
+  env->GetLongArrayRegion(offsets, 0, n, offset.data());
+  env->GetBooleanArrayRegion(writes, 0, n, write.data());
+
+  std::vector<Request> requests;
+  std::vector<jsize> request_of(n, -1);
+  for (jsize i = 0; i < n; i++) {
+    jobject descriptor = env->GetObjectArrayElement(fds, i);
+    jbyteArray bytes = (jbyteArray)env->GetObjectArrayElement(data, i);
+    int fd = env->GetIntField(descriptor, fd_field);
+    jsize length = env->GetArrayLength(bytes);
+    result[i] = 0;
+    if (fd < 0) {
+      result[i] = -EBADF;
+    } else if ((unsigned)length > ring->BufferSize()) {
+      result[i] = -EINVAL;
+    } else {
+      request_of[i] = (jsize)requests.size();
+      requests.push_back(Request{fd, write[i] != JNI_FALSE,
+                                 (unsigned long long)offset[i],
+                                 (unsigned)length, (int)requests.size(), 0});
+    }
+    env->DeleteLocalRef(descriptor);
+    env->DeleteLocalRef(bytes);
+  }
+
+  if (requests.size() > ring->BatchLimit()) {
+    // more than the pool holds, the Java side never sends that
+    for (jsize i = 0; i < n; i++) {
+      result[i] = (request_of[i] >= 0) ? -E2BIG : result[i];
+    }
+    env->SetIntArrayRegion(results, 0, n, result.data());
+    return JNI_TRUE;
+  }
+
+  bool broken;
+  {
+    std::lock_guard<std::mutex> guard(ring->mtx_);
+    if (ring->Broken()) {
+      for (jsize i = 0; i < n; i++) {
+        result[i] = (request_of[i] >= 0) ? -EIO : result[i];
+      }
+      env->SetIntArrayRegion(results, 0, n, result.data());
+      return JNI_FALSE;
+    }
+    for (jsize i = 0; i < n; i++) {
+      if (request_of[i] >= 0 && write[i]) {
+        jbyteArray bytes = (jbyteArray)env->GetObjectArrayElement(data, i);
+        Request &r = requests[request_of[i]];
+        env->GetByteArrayRegion(bytes, 0, (jsize)r.length,
+                                (jbyte *)ring->Buffer(r.buffer));
+        env->DeleteLocalRef(bytes);
+      }
+    }
+    ring->Run(requests);
+    broken = ring->Broken();
+    for (jsize i = 0; i < n; i++) {
+      if (request_of[i] < 0) {
+        continue;
+      }
+      Request &r = requests[request_of[i]];
+      result[i] = r.result;
+      if (!r.write && r.result > 0) {
+        jbyteArray bytes = (jbyteArray)env->GetObjectArrayElement(data, i);
+        env->SetByteArrayRegion(bytes, 0, (jsize)r.result,
+                                (const jbyte *)ring->Buffer(r.buffer));
+        env->DeleteLocalRef(bytes);
+      }
+    }
+  }
+  env->SetIntArrayRegion(results, 0, n, result.data());
+  return broken ? JNI_FALSE : JNI_TRUE;
+}
+
+}  // extern "C"